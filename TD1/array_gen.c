@@ -0,0 +1,27 @@
+#include <stdlib.h>
+#include "array_gen.h"
+
+/* slices with at least this number of elements are generated by all the threads */
+#define GENERATE_OMP_THRESHOLD (1 << 16)
+
+void generate_slice(int *slice, int seed, int array_index, long first, long count)
+{
+    long i;
+
+#pragma omp parallel for schedule(static) if (count >= GENERATE_OMP_THRESHOLD)
+    for (i = 0; i < count; i++)
+    {
+        slice[i] = array_element(seed, array_index, first + i);
+    }
+}
+
+int *generate_array(int seed, int size, int array_index)
+{
+    /*
+    This function generate an array based on the seed and the size.
+    */
+    int *array = (int *)malloc(size * sizeof(int));
+
+    generate_slice(array, seed, array_index, 0, size);
+    return array;
+}
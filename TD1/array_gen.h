@@ -0,0 +1,35 @@
+#ifndef ARRAY_GEN_H
+#define ARRAY_GEN_H
+#include <stdint.h>
+
+/*
+Counter-based generation of the arrays of the max programs.
+
+Element i of array m only depends on (seed, m, i): it is computed directly
+with the splitmix64 mixing function instead of being the next number of a
+global lrand48 stream. Any process or thread can therefore generate any
+slice of any array, without generating what precedes it, and the arrays are
+the same for a given seed whatever the number of processes.
+*/
+
+static inline uint64_t array_gen_mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/* element i of array array_index, in [0, 2^31) like lrand48 */
+static inline int array_element(int seed, int array_index, long i)
+{
+    uint64_t stream = array_gen_mix(((uint64_t)(uint32_t)seed << 32) | (uint32_t)array_index);
+    return (int)(array_gen_mix(stream + (uint64_t)(i + 1) * 0x9E3779B97F4A7C15ull) >> 33);
+}
+
+/* fill slice[0] ... slice[count - 1] with the elements first ... first + count - 1 of array array_index */
+void generate_slice(int *slice, int seed, int array_index, long first, long count);
+
+/* allocate and fill the whole array array_index (size elements) */
+int *generate_array(int seed, int size, int array_index);
+
+#endif
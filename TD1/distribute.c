@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include "distribute.h"
+
+int block_count(int size, int nb_proc, int rank)
+{
+    return size / nb_proc + (rank < size % nb_proc ? 1 : 0);
+}
+
+int block_first(int size, int nb_proc, int rank)
+{
+    return rank * (size / nb_proc) + (rank < size % nb_proc ? rank : size % nb_proc);
+}
+
+int *scatter_blocks(int *array, int size, int root, MPI_Comm comm, int *count)
+{
+    int rank, nb_proc;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nb_proc);
+
+    *count = block_count(size, nb_proc, rank);
+
+    if (rank == root)
+    {
+        int *counts = (int *)malloc(nb_proc * sizeof(int));
+        int *displs = (int *)malloc(nb_proc * sizeof(int));
+        for (int proc = 0; proc < nb_proc; proc++)
+        {
+            counts[proc] = block_count(size, nb_proc, proc);
+            displs[proc] = block_first(size, nb_proc, proc);
+        }
+        MPI_Scatterv(array, counts, displs, MPI_INT, MPI_IN_PLACE, 0, MPI_INT, root, comm);
+        free(counts);
+        free(displs);
+        return array + block_first(size, nb_proc, rank);
+    }
+
+    int *block = (int *)malloc((*count > 0 ? *count : 1) * sizeof(int));
+    MPI_Scatterv(NULL, NULL, NULL, MPI_INT, block, *count, MPI_INT, root, comm);
+    return block;
+}
+
+int cyclic_count(int size, int nb_proc, int rank, int block)
+{
+    int round = nb_proc * block;
+    int tail = size % round - rank * block;
+    tail = tail < 0 ? 0 : (tail > block ? block : tail);
+    return size / round * block + tail;
+}
+
+int cyclic_global_index(int index, int nb_proc, int rank, int block)
+{
+    return index / block * nb_proc * block + rank * block + index % block;
+}
+
+MPI_Datatype cyclic_type(int size, int nb_proc, int rank, int block)
+{
+    int round = nb_proc * block;
+    int nb_rounds = size / round;
+    int tail = cyclic_count(size, nb_proc, rank, block) - nb_rounds * block;
+
+    // the complete rounds: nb_rounds blocks, one every round elements
+    MPI_Datatype rounds;
+    MPI_Type_vector(nb_rounds, block, round, MPI_INT, &rounds);
+
+    // the vector starts at the first block of rank, the tail in the last (partial) round
+    int lengths[2] = {1, tail};
+    MPI_Aint displs[2] = {(MPI_Aint)rank * block * sizeof(int),
+                          ((MPI_Aint)nb_rounds * round + (MPI_Aint)rank * block) * sizeof(int)};
+    MPI_Datatype types[2] = {rounds, MPI_INT};
+    MPI_Datatype type;
+    MPI_Type_create_struct(2, lengths, displs, types, &type);
+    MPI_Type_commit(&type);
+    MPI_Type_free(&rounds);
+    return type;
+}
+
+int *scatter_cyclic(int *array, int size, int block, int root, MPI_Comm comm, int *count)
+{
+    int rank, nb_proc;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nb_proc);
+
+    *count = cyclic_count(size, nb_proc, rank, block);
+    int *local = (int *)malloc((*count > 0 ? *count : 1) * sizeof(int));
+    MPI_Request recv;
+    MPI_Irecv(local, *count, MPI_INT, root, 0, comm, &recv);
+
+    if (rank == root)
+    {
+        // each process has its own datatype, which MPI_Scatterv cannot express: one send per process
+        MPI_Request *sends = (MPI_Request *)malloc(nb_proc * sizeof(MPI_Request));
+        for (int proc = 0; proc < nb_proc; proc++)
+        {
+            MPI_Datatype type = cyclic_type(size, nb_proc, proc, block);
+            MPI_Isend(array, 1, type, proc, 0, comm, &sends[proc]);
+            // freeing a datatype does not affect the pending communications that use it
+            MPI_Type_free(&type);
+        }
+        MPI_Waitall(nb_proc, sends, MPI_STATUSES_IGNORE);
+        free(sends);
+    }
+
+    MPI_Wait(&recv, MPI_STATUS_IGNORE);
+    return local;
+}
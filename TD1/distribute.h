@@ -0,0 +1,57 @@
+#ifndef DISTRIBUTE_H
+#define DISTRIBUTE_H
+#include <mpi.h>
+
+/*
+Block distribution of an array between the processes of a communicator.
+
+The size % nb_proc elements that do not divide evenly are spread over the
+first processes, one each: the blocks differ by at most one element and no
+element is dropped.
+*/
+
+/* number of elements of the block of process rank */
+int block_count(int size, int nb_proc, int rank);
+
+/* index of the first element of the block of process rank */
+int block_first(int size, int nb_proc, int rank);
+
+/*
+Scatter array (size elements, only significant on root) with one MPI_Scatterv.
+Return the block of the calling process and store its number of elements in count.
+On root, the block is array + block_first(...): root keeps its block in place
+(MPI_IN_PLACE) and nothing is copied. On the other processes, the block is
+allocated with malloc and must be freed by the caller.
+*/
+int *scatter_blocks(int *array, int size, int root, MPI_Comm comm, int *count);
+
+/*
+Block-cyclic distribution: the array is cut into blocks of block elements that
+are dealt to the processes in turn (block 0 to process 0, block 1 to process 1,
+..., block nb_proc to process 0 again). With block = 1, this is the strided
+distribution: process rank owns the elements rank, rank + nb_proc, rank + 2 * nb_proc...
+*/
+
+/* number of elements owned by process rank */
+int cyclic_count(int size, int nb_proc, int rank, int block);
+
+/* index, in the whole array, of the element at position index among those of process rank */
+int cyclic_global_index(int index, int nb_proc, int rank, int block);
+
+/*
+Datatype that selects, in the whole array, the cyclic_count(...) elements of
+process rank: an MPI_Type_vector over the complete rounds of blocks, followed by
+the partial block of the last round, if any. Free it with MPI_Type_free.
+*/
+MPI_Datatype cyclic_type(int size, int nb_proc, int rank, int block);
+
+/*
+Scatter array (only significant on root) with a block-cyclic distribution.
+Root sends one message per process, described by cyclic_type: the elements go
+from the array to the network without being packed in a temporary buffer. Every
+process, root included, receives its elements contiguously in a block allocated
+with malloc that must be freed by the caller.
+*/
+int *scatter_cyclic(int *array, int size, int block, int root, MPI_Comm comm, int *count);
+
+#endif
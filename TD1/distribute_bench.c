@@ -0,0 +1,190 @@
+/*
+Cost of sending non-contiguous data.
+
+usage: mpirun -np 2 distribute_bench [block [stride_factor [max_count]]]
+
+Process 0 sends count elements to process 1, for count = 16, 64, ... up to max_count (default 4M).
+The elements are laid out like a block-cyclic portion (see distribute.h): blocks of block elements
+(default 1: a strided layout), one every stride_factor * block elements (default 4, as for 4 processes).
+Process 1 always receives them contiguously. The transfers are:
+
+contiguous : the same number of elements, contiguous on the sender. This is the reference: the cost of
+             the data if it had the right layout
+packed     : the sender copies the blocks into a temporary buffer and sends it (the copy is timed)
+vector     : the sender sends the blocks directly with an MPI_Type_vector
+subarray   : same with an MPI_Type_create_subarray on the 2D view (rows of stride_factor * block
+             elements, the first block of each row)
+
+Process 1 acknowledges each message so that a transfer is timed from the first send to its reception.
+The datatypes are created before the timing: they are meant to be built once and reused.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+enum mode
+{
+    MODE_CONTIGUOUS,
+    MODE_PACKED,
+    MODE_VECTOR,
+    MODE_SUBARRAY,
+    NB_MODES
+};
+
+static const char *mode_names[NB_MODES] = {"contiguous", "packed", "vector", "subarray"};
+
+/* time one transfer of count elements, averaged over repeat transfers */
+double transfer(enum mode mode, int *source, int *buffer, int count, int block, int stride, int repeat, int rank)
+{
+    int nb_blocks = count / block;
+    MPI_Datatype type = MPI_INT;
+    if (mode == MODE_VECTOR)
+    {
+        MPI_Type_vector(nb_blocks, block, stride, MPI_INT, &type);
+        MPI_Type_commit(&type);
+    }
+    else if (mode == MODE_SUBARRAY)
+    {
+        int sizes[2] = {nb_blocks, stride};
+        int subsizes[2] = {nb_blocks, block};
+        int starts[2] = {0, 0};
+        MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_INT, &type);
+        MPI_Type_commit(&type);
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t1 = MPI_Wtime();
+    for (int r = 0; r < repeat; r++)
+    {
+        if (rank == 0)
+        {
+            switch (mode)
+            {
+            case MODE_CONTIGUOUS:
+                MPI_Send(source, count, MPI_INT, 1, 0, MPI_COMM_WORLD);
+                break;
+            case MODE_PACKED:
+                for (int b = 0; b < nb_blocks; b++)
+                {
+                    for (int i = 0; i < block; i++)
+                    {
+                        buffer[b * block + i] = source[b * stride + i];
+                    }
+                }
+                MPI_Send(buffer, count, MPI_INT, 1, 0, MPI_COMM_WORLD);
+                break;
+            default:
+                MPI_Send(source, 1, type, 1, 0, MPI_COMM_WORLD);
+                break;
+            }
+            MPI_Recv(NULL, 0, MPI_INT, 1, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        }
+        else if (rank == 1)
+        {
+            MPI_Recv(buffer, count, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            MPI_Send(NULL, 0, MPI_INT, 0, 1, MPI_COMM_WORLD);
+        }
+    }
+    double t2 = MPI_Wtime();
+
+    if (type != MPI_INT)
+    {
+        MPI_Type_free(&type);
+    }
+    return (t2 - t1) / repeat;
+}
+
+/* check that process 1 received the blocks of the layout (elements are their index in source) */
+int check(int *buffer, int count, int block, int stride)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (buffer[i] != i / block * stride + i % block)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    int rank, nb_proc;
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &nb_proc);
+
+    int block = argc > 1 ? atoi(argv[1]) : 1;
+    int stride_factor = argc > 2 ? atoi(argv[2]) : 4;
+    int max_count = argc > 3 ? atoi(argv[3]) : 1 << 22;
+    if (nb_proc < 2 || block < 1 || stride_factor < 1 || max_count < block)
+    {
+        if (rank == 0)
+        {
+            fprintf(stderr, "usage: mpirun -np 2 %s [block [stride_factor [max_count]]]\n", argv[0]);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    int stride = stride_factor * block;
+    // whole number of blocks
+    max_count -= max_count % block;
+
+    int *source = NULL;
+    int *buffer = (int *)malloc(max_count * sizeof(int));
+    if (rank == 0)
+    {
+        source = (int *)malloc((size_t)max_count / block * stride * sizeof(int));
+        for (long i = 0; i < (long)max_count / block * stride; i++)
+        {
+            source[i] = i;
+        }
+        printf("# block=%d stride=%d (elements), times in us per message, bandwidth of the useful data in MB/s\n", block, stride);
+        printf("# %10s", "count");
+        for (int mode = 0; mode < NB_MODES; mode++)
+        {
+            printf(" %12s %9s", mode_names[mode], "MB/s");
+        }
+        printf("\n");
+    }
+
+    int first = block > 16 ? block : 16;
+    for (int count = first; count <= max_count; count *= 4)
+    {
+        count -= count % block;
+        // about 64MB per measure, but at least 5 transfers
+        int repeat = (1 << 24) / count;
+        repeat = repeat < 5 ? 5 : (repeat > 1000 ? 1000 : repeat);
+        double times[NB_MODES];
+        int correct = 1;
+        for (int mode = 0; mode < NB_MODES; mode++)
+        {
+            // warm up the buffers and the datatype engine
+            transfer(mode, source, buffer, count, block, stride, 1, rank);
+            if (rank == 1 && mode != MODE_CONTIGUOUS)
+            {
+                correct &= check(buffer, count, block, stride);
+            }
+            times[mode] = transfer(mode, source, buffer, count, block, stride, repeat, rank);
+        }
+        if (rank == 1 && !correct)
+        {
+            fprintf(stderr, "count %d: wrong data received\n", count);
+        }
+        if (rank == 0)
+        {
+            printf("  %10d", count);
+            for (int mode = 0; mode < NB_MODES; mode++)
+            {
+                printf(" %12.2f %9.1f", times[mode] * 1e6, count * sizeof(int) / times[mode] / 1e6);
+            }
+            printf("\n");
+        }
+    }
+
+    free(source);
+    free(buffer);
+    MPI_Finalize();
+    return 0;
+}
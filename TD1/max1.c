@@ -12,6 +12,8 @@ To evaluate the performance of the program, we need to measure its execution tim
 #include <stdio.h>
 #include <stdlib.h>
 #include <mpi.h>
+#include "max_kernel.h"
+#include "array_gen.h"
 
 // Function main takes 2 arguments:
 // Seed S
@@ -20,48 +22,6 @@ To evaluate the performance of the program, we need to measure its execution tim
 //This is the sequential version of the program, used as a reference
 
 
-int *generate_array(int seed, int size)
-{
-    //TODO : use stride and offset to generate a non contiguous array and test the performance
-    /*
-    This function generate an array based on the seed and the size.
-    */
-    int i;
-    int *array;
-
-    
-    if (seed > -1) srand48(seed);
-
-    array = (int *)malloc(size * sizeof(int));
-
-    for (i = 0; i < size; i++)
-    {
-        array[i] = lrand48();
-    }
-
-    return array;
-}
-
-int max_array(int *array, int size, int offset)
-{
-    /*
-    This function returns the maximum value inside an array.
-    */
-    int i;
-    int max;
-
-    max = array[offset];
-    for (i = offset + 1; i < size; i += 1)
-    {
-        if (array[i] > max)
-        {
-            max = array[i];
-        }
-    }
-
-    return max;
-}
-
 int main(int argc, char **argv)
 {
     MPI_Init(&argc, &argv);
@@ -81,7 +41,7 @@ int main(int argc, char **argv)
     seed = atoi(argv[1]);
     N = atoi(argv[2]);
     
-    array = generate_array(seed, N);
+    array = generate_array(seed, N, 0);
     
     float t1 = MPI_Wtime();
     printf("Time to generate the array : %f ms\n", (t1 - t0) * 1000);
@@ -22,49 +22,8 @@ This application will first generate M arrays of N elements each based on the se
 #include <stdio.h>
 #include <stdlib.h>
 #include <mpi.h>
-
-int *generate_array(int seed, int size)
-{
-    //TODO : use stride and offset to generate a non contiguous array and test the performance
-    /*
-    This function generate an array based on the seed and the size.
-    */
-    int i;
-    int *array;
-
-    
-    if (seed > -1) srand48(seed);
-
-    array = (int *)malloc(size * sizeof(int));
-
-    for (i = 0; i < size; i++)
-    {
-        array[i] = lrand48();
-    }
-
-    return array;
-}
-
-int max_array(int *array, int size, int offset)
-{
-    /*
-    This function returns the maximum value inside an array.
-    */
-    int i;
-    int max;
-
-    max = array[offset];
-    for (i = offset + 1; i < size; i += 1)
-    {
-        if (array[i] > max)
-        {
-            max = array[i];
-        }
-    }
-
-    return max;
-}
-
+#include "max_kernel.h"
+#include "array_gen.h"
 
 int main(int argc, char **argv)
 {
@@ -88,10 +47,9 @@ int main(int argc, char **argv)
     
     int *array[M];
 
-    srand48(seed);
     for (int i = 0; i < M; i++)
     {
-        array[i] = generate_array(-1, N);
+        array[i] = generate_array(seed, N, i);
     }
     float t1 = MPI_Wtime();
     
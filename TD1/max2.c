@@ -15,7 +15,23 @@ we take generation out of the equation, it is still not faster than max1.
 Implementation 2 :
 every worker generates the array and computes the max on its portion.
 This is exactly as fast as max1 because the bottleneck is not computing the max, but generating the array.
+With the counter-based generator (array_gen.h), every worker now generates only its portion, so the generation
+is split between the workers too.
 
+Implementation 3 :
+same as implementation 1, but the array is dealt in blocks of CYCLIC_BLOCK elements to the workers in turn
+(block-cyclic distribution, CYCLIC_BLOCK = 1 is a strided distribution). The non-contiguous portions are sent
+with MPI derived datatypes, without packing. For the max, every layout gives the same result: this is the layout
+for data whose cost varies along the array. distribute_bench measures what the non-contiguous transfers cost.
+
+Implementation 4 (SHARED_MEMORY=1) :
+same as implementation 1, but the array is generated in memory shared by the processes of the node of process 0
+(see shared.h): they read their portion in place. Only the other nodes receive their portion, with one message each.
+
+
+Every implementation also reports the index of the maximum in the array: each process finds its first maximum
+(argmax_array), converts its position to an index in the whole array, and the pairs are reduced with MPI_MAXLOC,
+so the first maximum of the array wins whatever the distribution.
 
 If we look only at the time taken to compute the max, implementation 2 is faster than max1.
 However, it relies on the fact that every one is able to recompute the array.
@@ -25,139 +41,184 @@ In the case of a simple operation like max there is no gain in doing that.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <mpi.h>
+#include "max_kernel.h"
+#include "array_gen.h"
+#include "reduce.h"
+#include "distribute.h"
+#include "shared.h"
 
-int *generate_array(int seed, int size)
-{
-    // TODO : use stride and offset to generate a non contiguous array
-    /*
-    This function generate an array based on the seed and the size.
-    */
-    int i;
-    int *array;
-
-    if (seed > -1) srand48(seed);
-
-    array = (int *)malloc(size * sizeof(int));
-
-    // Wtf this loop is taking non deterministic time, varying from 1ms to 6ms :o (for 100000 elements)
-    for (i = 0; i < size; i++)
-    {
-        array[i] = lrand48();
-    }
-
-    return array;
-}
-
-int max_array(int *array, int size, int offset)
-{
-    /*
-    This function returns the maximum value inside an array.
-    */
-    int i;
-    int max;
-
-    max = array[offset];
-    for (i = offset + 1; i < size; i += 1)
-    {
-        if (array[i] > max)
-        {
-            max = array[i];
-        }
-    }
-
-    return max;
-}
-
-int fuse_max(int max, int rank, int nb_proc)
-{
-    if (rank == 0)
-    {
-        for (int i = 1; i < nb_proc; i++)
-        {
-            int tmp;
-            MPI_Recv(&tmp, 1, MPI_INT, i, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            if (tmp > max)
-            {
-                max = tmp;
-            }
-        }
-    }
-    else
-    {
-        MPI_Send(&max, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
-    }
-    return max;
-}
-
-int worker_v0(int seed, int N, int rank, int nb_proc)
+struct max_loc worker_v0(int seed, int N, int rank, int nb_proc)
 {
     /*
     This worker computes the maximum value inside a portion of the array based on the rank of the process.
     Only the master process will generate the array and send it to the other processes.
     */
-    int max;
+    struct max_loc max;
     int *array;
+    int *block;
+    int count;
 
     if (rank == 0)
     {
         float t1 = MPI_Wtime();
-        array = generate_array(seed, N);
+        array = generate_array(seed, N, 0);
         float t2 = MPI_Wtime();
         printf("%d Time to generate array: %f ms\n", rank, (t2 - t1) * 1000);
         float t3 = MPI_Wtime();
-        for (int i = 1; i < nb_proc; i++)
-        {
-            MPI_Send(
-                array + N / nb_proc * i, // pointer to the first element of the portion of the array to be sent
-                N/nb_proc,
-                MPI_INT, i, 0, MPI_COMM_WORLD
-            );
-        }
+        // one MPI_Scatterv; the portion of process 0 is not copied
+        block = scatter_blocks(array, N, 0, MPI_COMM_WORLD, &count);
         float t4 = MPI_Wtime();
         printf("%d Time to distribute array: %f ms\n", rank, (t4 - t3) * 1000);
 
         float t5 = MPI_Wtime();
-        max = max_array(array, N / nb_proc, 0);
+        int k = argmax_array(block, count, 0);
         float t6 = MPI_Wtime();
         printf("%d Time to compute max: %f ms\n", rank, (t6 - t5) * 1000);
+        max.value = k >= 0 ? block[k] : INT_MIN;
+        // an empty portion loses every MPI_MAXLOC comparison
+        max.index = k >= 0 ? block_first(N, nb_proc, rank) + k : INT_MAX;
         free(array);
     }
     else
     {
-        array = (int *)malloc(N / nb_proc * sizeof(int));
-        MPI_Recv(array, N / nb_proc, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        block = scatter_blocks(NULL, N, 0, MPI_COMM_WORLD, &count);
         float t3 = MPI_Wtime();
-        max = max_array(array, N / nb_proc, 0);
+        int k = argmax_array(block, count, 0);
         float t4 = MPI_Wtime();
         printf("%d Time to compute max: %f ms\n", rank, (t4 - t3) * 1000);
-        free(array);
+        max.value = k >= 0 ? block[k] : INT_MIN;
+        max.index = k >= 0 ? block_first(N, nb_proc, rank) + k : INT_MAX;
+        free(block);
     }
 
-    max = fuse_max(max, rank, nb_proc);
+    // the max of all the processes and its index end up on process 0 (see reduce.h for the algorithms)
+    reduce(&max, 1, MPI_2INT, MPI_MAXLOC, 0, MPI_COMM_WORLD, reduce_algo_from_env());
 
     return max;
 }
 
-int worker_v1(int seed, int N, int rank, int nb_proc)
+struct max_loc worker_v1(int seed, int N, int rank, int nb_proc)
 {
     /*
-    This worker generates the whole array instead of receiving it as argument to avoid large communications and compare the performance.
+    This worker generates its own portion of the array instead of receiving it to avoid large communications and compare the performance.
+    The generator is counter-based, so the portion is generated directly, without the elements that precede it.
     */
-    int max;
+    struct max_loc max;
     int *array;
 
     float t1 = MPI_Wtime();
-    array = generate_array(seed, N);
+    int count = block_count(N, nb_proc, rank);
+    array = (int *)malloc((count > 0 ? count : 1) * sizeof(int));
+    generate_slice(array, seed, 0, block_first(N, nb_proc, rank), count);
     float t2 = MPI_Wtime();
     printf("%d Time to generate array: %f ms\n", rank, (t2 - t1) * 1000);
     float t3 = MPI_Wtime();
-    max = max_array(array, N / nb_proc * (rank + 1), N / nb_proc * rank);
+    int k = argmax_array(array, count, 0);
     float t4 = MPI_Wtime();
     printf("%d Time to compute max: %f ms\n", rank, (t4 - t3) * 1000);
+    max.value = k >= 0 ? array[k] : INT_MIN;
+    // an empty portion loses every MPI_MAXLOC comparison
+    max.index = k >= 0 ? block_first(N, nb_proc, rank) + k : INT_MAX;
+    free(array);
+
+    // the max of all the processes and its index end up on process 0 (see reduce.h for the algorithms)
+    reduce(&max, 1, MPI_2INT, MPI_MAXLOC, 0, MPI_COMM_WORLD, reduce_algo_from_env());
+
+    return max;
+}
+
+struct max_loc worker_v2(int seed, int N, int rank, int nb_proc, int block)
+{
+    /*
+    This worker receives a block-cyclic portion of the array generated by the master process.
+    The portion is not contiguous in the array: it is described by a derived datatype (see distribute.h).
+    */
+    struct max_loc max;
+    int *array = NULL;
+    int *local;
+    int count;
+
+    if (rank == 0)
+    {
+        float t1 = MPI_Wtime();
+        array = generate_array(seed, N, 0);
+        float t2 = MPI_Wtime();
+        printf("%d Time to generate array: %f ms\n", rank, (t2 - t1) * 1000);
+    }
+    float t3 = MPI_Wtime();
+    local = scatter_cyclic(array, N, block, 0, MPI_COMM_WORLD, &count);
+    float t4 = MPI_Wtime();
+    printf("%d Time to distribute array: %f ms\n", rank, (t4 - t3) * 1000);
     free(array);
 
-    max = fuse_max(max, rank, nb_proc);
+    float t5 = MPI_Wtime();
+    int k = argmax_array(local, count, 0);
+    float t6 = MPI_Wtime();
+    printf("%d Time to compute max: %f ms\n", rank, (t6 - t5) * 1000);
+    max.value = k >= 0 ? local[k] : INT_MIN;
+    // an empty portion loses every MPI_MAXLOC comparison
+    max.index = k >= 0 ? cyclic_global_index(k, nb_proc, rank, block) : INT_MAX;
+    free(local);
+
+    // the max of all the processes and its index end up on process 0 (see reduce.h for the algorithms)
+    reduce(&max, 1, MPI_2INT, MPI_MAXLOC, 0, MPI_COMM_WORLD, reduce_algo_from_env());
+
+    return max;
+}
+
+struct max_loc worker_v3(int seed, int N, int rank)
+{
+    /*
+    This worker reads its portion of the array in the shared memory of its node.
+    Process 0 generates the array in a window shared with the processes of its node: nothing is copied for them.
+    */
+    struct max_loc max;
+    int *array = NULL;
+    int *block;
+    int count;
+    struct node_layout layout;
+    MPI_Win array_win = MPI_WIN_NULL;
+    MPI_Win node_win;
+
+    node_layout_init(&layout, MPI_COMM_WORLD);
+    if (layout.node_index == 0)
+    {
+        array = shared_alloc(&layout, N, &array_win);
+    }
+    if (rank == 0)
+    {
+        float t1 = MPI_Wtime();
+        generate_slice(array, seed, 0, 0, N);
+        float t2 = MPI_Wtime();
+        printf("%d Time to generate array: %f ms\n", rank, (t2 - t1) * 1000);
+    }
+    float t3 = MPI_Wtime();
+    block = scatter_shared(&layout, array, array_win, N, &node_win, &count);
+    float t4 = MPI_Wtime();
+    printf("%d Time to distribute array: %f ms\n", rank, (t4 - t3) * 1000);
+
+    float t5 = MPI_Wtime();
+    int k = argmax_array(block, count, 0);
+    float t6 = MPI_Wtime();
+    printf("%d Time to compute max: %f ms\n", rank, (t6 - t5) * 1000);
+    max.value = k >= 0 ? block[k] : INT_MIN;
+    // an empty portion loses every MPI_MAXLOC comparison
+    max.index = k >= 0 ? shared_first(&layout, N) + k : INT_MAX;
+
+    if (node_win != MPI_WIN_NULL)
+    {
+        shared_free(&node_win);
+    }
+    if (array_win != MPI_WIN_NULL)
+    {
+        shared_free(&array_win);
+    }
+    node_layout_free(&layout);
+
+    // the max of all the processes and its index end up on process 0 (see reduce.h for the algorithms)
+    reduce(&max, 1, MPI_2INT, MPI_MAXLOC, 0, MPI_COMM_WORLD, reduce_algo_from_env());
 
     return max;
 }
@@ -165,11 +226,12 @@ int worker_v1(int seed, int N, int rank, int nb_proc)
 int main(int argc, char **argv)
 {
     int N;
-    int max;
+    struct max_loc max;
     int seed;
     float t1, t2;
 
     int TEST_VERSION = 0;
+    int CYCLIC_BLOCK = 1024;
 
     if (argc != 3)
     {
@@ -185,15 +247,13 @@ int main(int argc, char **argv)
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &nb_proc);
 
-    t1 = MPI_Wtime();
-
-    // check if the number of elements is divisible by the number of processes
-    if (N % nb_proc != 0)
+    if (shared_memory_from_env())
     {
-        fprintf(stderr, "Number of elements must be divisible by the number of processes\n");
-        exit(1);
+        TEST_VERSION = 3;
     }
 
+    t1 = MPI_Wtime();
+
     if (TEST_VERSION == 0)
     {
         max = worker_v0(seed, N, rank, nb_proc);
@@ -201,9 +261,14 @@ int main(int argc, char **argv)
     else if (TEST_VERSION == 1)
     {
         max = worker_v1(seed, N, rank, nb_proc);
-        //} else if (TEST_VERSION == 2)
-        //{
-        //    max = worker_v2(seed, N, rank, nb_proc, array);
+    }
+    else if (TEST_VERSION == 2)
+    {
+        max = worker_v2(seed, N, rank, nb_proc, CYCLIC_BLOCK);
+    }
+    else if (TEST_VERSION == 3)
+    {
+        max = worker_v3(seed, N, rank);
     }
     else
     {
@@ -215,7 +280,7 @@ int main(int argc, char **argv)
 
     if (rank == 0)
     {
-        printf("Max value: %d\n", max);
+        printf("Max value: %d at index %d\n", max.value, max.index);
         printf("Time: %f ms\n", (t2 - t1) * 1000);
     }
 
@@ -18,47 +18,27 @@ Implement this mechanism inside a file named max3.c.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <mpi.h>
+#include "max_kernel.h"
+#include "array_gen.h"
+#include "reduce.h"
+#include "distribute.h"
+#include "shared.h"
 
-int *generate_array(int seed, int size)
-{
-    //TODO : use stride and offset to generate a non contiguous array and test the performance
-    /*
-    This function generate an array based on the seed and the size.
-    */
-    int i;
-    int *array;
-
-    
-    if (seed > -1) srand48(seed);
-
-    array = (int *)malloc(size * sizeof(int));
-
-    for (i = 0; i < size; i++)
-    {
-        array[i] = lrand48();
-    }
-
-    return array;
-}
-
-int max_array(int *array, int size, int offset)
+/*
+Maximum of the count elements of block and its index in the whole array, block starting at index first.
+An empty block gets INT_MIN at index INT_MAX, which loses every MPI_MAXLOC comparison.
+*/
+struct max_loc local_max(int *block, int count, int first)
 {
-    /*
-    This function returns the maximum value inside an array.
-    */
-    int i;
-    int max;
-
-    max = array[offset];
-    for (i = offset + 1; i < size; i += 1)
+    struct max_loc max = {INT_MIN, INT_MAX};
+    int k = argmax_array(block, count, 0);
+    if (k >= 0)
     {
-        if (array[i] > max)
-        {
-            max = array[i];
-        }
+        max.value = block[k];
+        max.index = first + k;
     }
-
     return max;
 }
 
@@ -81,25 +61,51 @@ int main(int argc, char **argv)
     M = atoi(argv[3]);
 
     int *array[M];
-    int max[M];
+    int *block[M];
+    int count[M];
+    struct max_loc max[M];
 
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &nb_proc);
-    
-    if (N % nb_proc != 0)
+
+    // N does not need to be divisible by nb_proc: the remainder is spread over the first processes (see distribute.h)
+
+    /*
+    With SHARED_MEMORY=1, the arrays are generated in memory shared by the processes of the node of process 0,
+    which read their portions in place: only the other nodes receive messages (see shared.h).
+    */
+    int use_shared = shared_memory_from_env();
+    struct node_layout layout;
+    int *shared = NULL;
+    MPI_Win shared_win = MPI_WIN_NULL;
+    MPI_Win node_win = MPI_WIN_NULL;
+    if (use_shared)
     {
-        fprintf(stderr, "Number of elements must be divisible by the number of processes\n");
-        exit(1);
+        node_layout_init(&layout, MPI_COMM_WORLD);
+        if (layout.node_index == 0)
+        {
+            shared = shared_alloc(&layout, (long)M * N, &shared_win);
+        }
     }
 
+    // index in the arrays of the first element of the portion of this process
+    int first = use_shared ? shared_first(&layout, N) : block_first(N, nb_proc, rank);
+
     if (rank==0)
     { 
         // generate the arrays
         float t1 = MPI_Wtime();
-        srand48(seed);
         for (int i = 0; i < M; i++)
         {
-            array[i] = generate_array(-1, N);
+            if (use_shared)
+            {
+                array[i] = shared + (long)i * N;
+                generate_slice(array[i], seed, i, 0, N);
+            }
+            else
+            {
+                array[i] = generate_array(seed, N, i);
+            }
         }
         float t2 = MPI_Wtime();
 
@@ -115,15 +121,21 @@ int main(int argc, char **argv)
         // I implemented the difference between the two versions described here in max4v1.c and max4v2.c.
         // See these files for more details.
         float t3 = MPI_Wtime();
-        for (int proc = 1; proc < nb_proc; proc++)
+        if (use_shared)
+        {
+            // the slices of node 0 stay in the shared arrays
+            scatter_shared_arrays(&layout, shared, shared_win, N, M, &node_win, block, &count[0]);
+            for (int arr = 1; arr < M; arr++)
+            {
+                count[arr] = count[0];
+            }
+        }
+        else
         {
             for (int arr = 0; arr < M; arr++)
             {
-                MPI_Send(
-                    array[arr] + proc * N / nb_proc,
-                    N / nb_proc,
-                    MPI_INT, proc, arr, MPI_COMM_WORLD
-                );
+                // the block of process 0 stays in array[arr]
+                block[arr] = scatter_blocks(array[arr], N, 0, MPI_COMM_WORLD, &count[arr]);
             }
         }
         float t4 = MPI_Wtime();
@@ -132,31 +144,23 @@ int main(int argc, char **argv)
         float t5 = MPI_Wtime();
         for (int arr = 0; arr < M; arr++)
         {
-            max[arr] = max_array(array[arr], N / nb_proc, 0);
-            free(array[arr]);
+            max[arr] = local_max(block[arr], count[arr], first);
+            if (!use_shared)
+            {
+                free(array[arr]);
+            }
         }
         float t6 = MPI_Wtime();
 
-        // collect the results
+        // collect the results: one reduction of the M maxima and their indices instead of M messages per process
         float t7 = MPI_Wtime();
-        for (int proc = 1; proc < nb_proc; proc++)
-        {
-            for (int arr = 0; arr < M; arr++)
-            {
-                int tmp;
-                MPI_Recv(&tmp, 1, MPI_INT, proc, arr, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                if (tmp > max[arr])
-                {
-                    max[arr] = tmp;
-                }
-            }
-        }
+        reduce(max, M, MPI_2INT, MPI_MAXLOC, 0, MPI_COMM_WORLD, reduce_algo_from_env());
         float t8 = MPI_Wtime();
 
         // print the results
         for (int arr = 0; arr < M; arr++)
         {
-            printf("Max of array %d: %d\n", arr, max[arr]);
+            printf("Max of array %d: %d at index %d\n", arr, max[arr].value, max[arr].index);
         }
 
         printf("Time to distribute the arrays: %f ms\n", (t4 - t3) * 1000);
@@ -166,24 +170,47 @@ int main(int argc, char **argv)
         printf("Total time: %f ms\n", (t8 - t7 + t6 - t5 + t4 - t3 + t2 - t1) * 1000);
     } else {
         // receive the work
-        for (int arr = 0; arr < M; arr++)
+        if (use_shared)
         {
-            array[arr] = (int *)malloc(N / nb_proc * sizeof(int));
-            MPI_Recv(array[arr], N / nb_proc, MPI_INT, 0, arr, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            scatter_shared_arrays(&layout, shared, shared_win, N, M, &node_win, block, &count[0]);
+            for (int arr = 1; arr < M; arr++)
+            {
+                count[arr] = count[0];
+            }
+        }
+        else
+        {
+            for (int arr = 0; arr < M; arr++)
+            {
+                block[arr] = scatter_blocks(NULL, N, 0, MPI_COMM_WORLD, &count[arr]);
+            }
         }
 
         // do its part of the work
         for (int arr = 0; arr < M; arr++)
         {
-            max[arr] = max_array(array[arr], N / nb_proc, 0);
-            free(array[arr]);
+            max[arr] = local_max(block[arr], count[arr], first);
+            if (!use_shared)
+            {
+                free(block[arr]);
+            }
         }
 
         // send the result
-        for (int arr = 0; arr < M; arr++)
+        reduce(max, M, MPI_2INT, MPI_MAXLOC, 0, MPI_COMM_WORLD, reduce_algo_from_env());
+    }
+
+    if (use_shared)
+    {
+        if (node_win != MPI_WIN_NULL)
+        {
+            shared_free(&node_win);
+        }
+        if (shared_win != MPI_WIN_NULL)
         {
-            MPI_Send(&max[arr], 1, MPI_INT, 0, arr, MPI_COMM_WORLD);
+            shared_free(&shared_win);
         }
+        node_layout_free(&layout);
     }
 
     MPI_Finalize();
@@ -24,49 +24,11 @@ Implement this mechanism inside a file named max4.c.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <mpi.h>
-
-int *generate_array(int seed, int size)
-{
-    //TODO : use stride and offset to generate a non contiguous array and test the performance
-    /*
-    This function generate an array based on the seed and the size.
-    */
-    int i;
-    int *array;
-
-    
-    if (seed > -1) srand48(seed);
-
-    array = (int *)malloc(size * sizeof(int));
-
-    for (i = 0; i < size; i++)
-    {
-        array[i] = lrand48();
-    }
-
-    return array;
-}
-
-int max_array(int *array, int size, int offset)
-{
-    /*
-    This function returns the maximum value inside an array.
-    */
-    int i;
-    int max;
-
-    max = array[offset];
-    for (i = offset + 1; i < size; i += 1)
-    {
-        if (array[i] > max)
-        {
-            max = array[i];
-        }
-    }
-
-    return max;
-}
+#include "max_kernel.h"
+#include "array_gen.h"
+#include "reduce.h"
 
 /*
 There are two versions of this file.
@@ -117,10 +79,9 @@ int main(int argc, char **argv)
     { 
         // generate the arrays
         float t1 = MPI_Wtime();
-        srand48(seed);
         for (int i = 0; i < M; i++)
         {
-            array[i] = generate_array(-1, N);
+            array[i] = generate_array(seed, N, i);
         }
         float t2 = MPI_Wtime();
 
@@ -141,15 +102,15 @@ int main(int argc, char **argv)
 
         // do its part of the work
 
-        // collect the results
+        // collect the results: every array has one owner, the others contribute INT_MIN,
+        // so one max reduction of the M results replaces the M messages
         float t7 = MPI_Wtime();
         for (int arr = 0; arr < M; arr++)
         {
-            int tmp;
-            MPI_Recv(&tmp, 1, MPI_INT, (arr % (nb_proc - 1)) + 1, arr, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            max[arr] = tmp;
+            max[arr] = INT_MIN;
             free(array[arr]);
         }
+        reduce(max, M, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD, reduce_algo_from_env());
         float t8 = MPI_Wtime();
 
         // print the results
@@ -174,6 +135,10 @@ int main(int argc, char **argv)
 
         // do its part of the work
         float t5 = MPI_Wtime();
+        for (int arr = 0; arr < M; arr++)
+        {
+            max[arr] = INT_MIN;
+        }
         for (int arr = rank - 1; arr < M; arr += nb_proc - 1)
         {
             max[arr] = max_array(array[arr], N, 0);
@@ -182,10 +147,7 @@ int main(int argc, char **argv)
         float t6 = MPI_Wtime();
 
         // send the results
-        for (int arr = rank - 1; arr < M; arr += nb_proc - 1)
-        {
-            MPI_Send(&max[arr], 1, MPI_INT, 0, arr, MPI_COMM_WORLD);
-        }
+        reduce(max, M, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD, reduce_algo_from_env());
     }
 
     MPI_Finalize();
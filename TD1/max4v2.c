@@ -25,48 +25,8 @@ Implement this mechanism inside a file named max4.c.
 #include <stdio.h>
 #include <stdlib.h>
 #include <mpi.h>
-
-int *generate_array(int seed, int size)
-{
-    //TODO : use stride and offset to generate a non contiguous array and test the performance
-    /*
-    This function generate an array based on the seed and the size.
-    */
-    int i;
-    int *array;
-
-    
-    if (seed > -1) srand48(seed);
-
-    array = (int *)malloc(size * sizeof(int));
-
-    for (i = 0; i < size; i++)
-    {
-        array[i] = lrand48();
-    }
-
-    return array;
-}
-
-int max_array(int *array, int size, int offset)
-{
-    /*
-    This function returns the maximum value inside an array.
-    */
-    int i;
-    int max;
-
-    max = array[offset];
-    for (i = offset + 1; i < size; i += 1)
-    {
-        if (array[i] > max)
-        {
-            max = array[i];
-        }
-    }
-
-    return max;
-}
+#include "max_kernel.h"
+#include "array_gen.h"
 
 /*
 There are two versions of this file.
@@ -119,10 +79,9 @@ int main(int argc, char **argv)
     {
         // generate the arrays
         float t1 = MPI_Wtime();
-        srand48(seed);
         for (int i = 0; i < M; i++)
         {
-            array[i] = generate_array(-1, N);
+            array[i] = generate_array(seed, N, i);
         }
         float t2 = MPI_Wtime();
 
@@ -26,53 +26,205 @@ d) Dynamic Work Distribution
 Even if the previous work distribution approach is of interest, it might be too static to improve the performance. Indeed, the work is assigned to a predetermined MPI process, without taking into account the load inbalance that might happen during the application execution. To tackle this issue, one solution is to rely on a dynamic scheduling of array distribution. The master MPI task (rank 0 in our code) will be in charge to assign the work to one of the ready other MPI process. Of course, at the very beginning, everyone is ready, but when a task is searching for a max, it is considered as busy until the job is done.
 
 Let's implement this solution inside a file named max5.c and compare it to the previous approach of work decomposition.
+
+The policy is chosen at run time with the SCHEDULE and SCHEDULE_CHUNK environment variables (see schedule.h):
+SCHEDULE=cyclic is the round-robin distribution of max4, SCHEDULE=dynamic SCHEDULE_CHUNK=1 (the default) hands out
+one array per request. Many small arrays: per-task messages dominate, use larger chunks (dynamic with a chunk, guided,
+factoring, or a static policy). Few large arrays: the last tasks dominate, use small chunks at the end (guided, factoring).
+
+With WORK_QUEUE=rma, process 0 does not send anything: the arrays, the index of the next array and the results live
+in MPI windows on process 0, and every process (process 0 included) claims chunks of SCHEDULE_CHUNK arrays with
+MPI_Fetch_and_op, reads them with MPI_Get and writes the maxima with MPI_Put (see rma_work_queue).
 */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
+#include "max_kernel.h"
+#include "array_gen.h"
+#include "schedule.h"
+#include "shared.h"
 
-int *generate_array(int seed, int size, int array_index)
+void generate_task(int *task, int seed, int size, int array_index)
 {
-    //TODO : use stride and offset to generate a non contiguous array and test the performance
     /*
-    This function generate an array based on the seed and the size.
+    This function generates array array_index in task, preceded by its index (size+1 elements).
     */
-    int i;
-    int *array;
+    task[0] = array_index;
+    generate_slice(task + 1, seed, array_index, 0, size);
+}
 
-    
-    if (seed > -1) srand48(seed);
+int pipeline_depth()
+{
+    /*
+    Number of chunks in flight per worker, from the PIPELINE_DEPTH environment variable (2 by default:
+    double buffering). With a depth of 1, a worker waits for a new chunk after each result.
+    */
+    char *env = getenv("PIPELINE_DEPTH");
+    int depth = env ? atoi(env) : 2;
+    return depth < 1 ? 1 : depth;
+}
 
-    array = (int *)malloc((size+1) * sizeof(int));
+void send_chunk(int *tasks, int N, struct chunk *c, int dest, int in_place, MPI_Request *request)
+{
+    /*
+    The tasks are stored one after the other: a chunk is a vector of c->count tasks of N+1 elements,
+    one every c->stride tasks. It is sent without copy (see distribute.h).
+    If dest reads the tasks in place (shared memory, see shared.h), only the chunk itself is sent:
+    c must not change until the send completes.
+    */
+    if (in_place)
+    {
+        MPI_Isend(c, 3, MPI_INT, dest, 0, MPI_COMM_WORLD, request);
+        return;
+    }
+    MPI_Datatype type;
+    MPI_Type_vector(c->count, N+1, c->stride * (N+1), MPI_INT, &type);
+    MPI_Type_commit(&type);
+    MPI_Isend(tasks + (long)c->first * (N+1), 1, type, dest, 0, MPI_COMM_WORLD, request);
+    MPI_Type_free(&type);
+}
 
-    array[0] = array_index;
-    for (i = 1; i < size+1; i++)
+int work_queue_rma()
+{
+    /*
+    WORK_QUEUE=rma selects the one-sided work queue, WORK_QUEUE=messages (the default) the master/worker messages.
+    */
+    char *env = getenv("WORK_QUEUE");
+    if (env && strcmp(env, "rma") == 0)
     {
-        array[i] = lrand48();
+        return 1;
     }
+    if (env && strcmp(env, "messages") != 0)
+    {
+        fprintf(stderr, "Unknown WORK_QUEUE '%s', using messages\n", env);
+    }
+    return 0;
+}
 
-    return array;
+int claim_chunk(MPI_Win next_win, int chunk, int M, int *count)
+{
+    /*
+    Atomically add chunk to the index of the next array: the previous value is the first array of our chunk.
+    */
+    int first;
+    MPI_Fetch_and_op(&chunk, &first, MPI_INT, 0, 0, MPI_SUM, next_win);
+    MPI_Win_flush(0, next_win);
+    *count = first < M ? (M - first < chunk ? M - first : chunk) : 0;
+    return first;
 }
 
-int max_array(int *array, int size, int offset)
+void rma_work_queue(int seed, int N, int M, int chunk, int rank)
 {
     /*
-    This function returns the maximum value inside an array.
+    One-sided work queue: three windows on process 0, the other processes expose nothing.
+    - tasks: the M arrays, each preceded by its index (N+1 elements per array)
+    - next: the index of the first array nobody has claimed yet
+    - results: the M maxima
+    Process 0 only generates the arrays: claiming, reading and writing back are atomic or one-sided
+    operations that do not need it. Each process claims its next chunk and starts reading it (MPI_Rget)
+    before searching the max of the current one, so the transfer is hidden behind the computation.
     */
-    int i;
-    int max;
+    MPI_Aint tasks_size = rank == 0 ? (MPI_Aint)M * (N+1) * sizeof(int) : 0;
+    MPI_Aint results_size = rank == 0 ? (MPI_Aint)M * sizeof(int) : 0;
+    int *tasks, *next, *results;
+    MPI_Win tasks_win, next_win, results_win;
+
+    MPI_Win_allocate(tasks_size, sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &tasks, &tasks_win);
+    MPI_Win_allocate(rank == 0 ? sizeof(int) : 0, sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &next, &next_win);
+    MPI_Win_allocate(results_size, sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &results, &results_win);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, tasks_win);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, next_win);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, results_win);
+
+    float t1 = MPI_Wtime();
+    if (rank == 0)
+    {
+        // generate the arrays
+        for (int i = 0; i < M; i++)
+        {
+            generate_task(tasks + (long)i * (N+1), seed, N, i);
+        }
+        *next = 0;
+        // make the local stores visible to the one-sided operations of the others
+        MPI_Win_sync(tasks_win);
+        MPI_Win_sync(next_win);
+    }
+    float t2 = MPI_Wtime();
+    MPI_Barrier(MPI_COMM_WORLD);
 
-    max = array[offset];
-    for (i = offset + 1; i < size; i += 1)
+    float t3 = MPI_Wtime();
+    int *buffer[2];
+    int *max = (int *)malloc(chunk * sizeof(int));
+    MPI_Request get = MPI_REQUEST_NULL;
+    int b = 0;
+    int count, next_count;
+    int nb_tasks = 0;
+
+    buffer[0] = (int *)malloc((long)chunk * (N+1) * sizeof(int));
+    buffer[1] = (int *)malloc((long)chunk * (N+1) * sizeof(int));
+    int first = claim_chunk(next_win, chunk, M, &count);
+    if (count > 0)
+    {
+        MPI_Rget(buffer[b], count * (N+1), MPI_INT, 0, (MPI_Aint)first * (N+1), count * (N+1), MPI_INT, tasks_win, &get);
+    }
+    while (count > 0)
     {
-        if (array[i] > max)
+        MPI_Wait(&get, MPI_STATUS_IGNORE);
+
+        // prefetch the next chunk into the other buffer
+        int next_first = claim_chunk(next_win, chunk, M, &next_count);
+        if (next_count > 0)
+        {
+            MPI_Rget(buffer[1 - b], next_count * (N+1), MPI_INT, 0, (MPI_Aint)next_first * (N+1),
+                     next_count * (N+1), MPI_INT, tasks_win, &get);
+        }
+
+        for (int i = 0; i < count; i++)
         {
-            max = array[i];
+            // offset is 1 because the first element of the array is the index of the array
+            max[i] = max_array(buffer[b] + (long)i * (N+1), N+1, 1);
         }
+        MPI_Put(max, count, MPI_INT, 0, first, count, MPI_INT, results_win);
+        // max is reused for the next chunk
+        MPI_Win_flush_local(0, results_win);
+        nb_tasks += count;
+
+        first = next_first;
+        count = next_count;
+        b = 1 - b;
     }
+    free(buffer[0]);
+    free(buffer[1]);
+    free(max);
+
+    // unlock_all completes the puts at process 0; the barrier tells it that everyone is done
+    MPI_Win_unlock_all(tasks_win);
+    MPI_Win_unlock_all(next_win);
+    MPI_Win_unlock_all(results_win);
+    MPI_Barrier(MPI_COMM_WORLD);
+    float t4 = MPI_Wtime();
+    printf("%d Processed %d arrays\n", rank, nb_tasks);
 
-    return max;
+    if (rank == 0)
+    {
+        // synchronize the public and private copies of the results before reading them
+        MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, results_win);
+        for (int i = 0; i < M; i++)
+        {
+            printf("Max of array %d is %d\n", i, results[i]);
+        }
+        MPI_Win_unlock(0, results_win);
+        printf("Work queue: rma, chunk %d\n", chunk);
+        printf("Time to generate the arrays: %f ms\n", (t2 - t1) * 1000);
+        printf("Time to get the max: %f ms\n", (t4 - t3) * 1000);
+        printf("Total time: %f ms\n", (t4 - t3 + t2 - t1) * 1000);
+    }
+
+    MPI_Win_free(&tasks_win);
+    MPI_Win_free(&next_win);
+    MPI_Win_free(&results_win);
 }
 
 int main(int argc, char **argv)
@@ -96,65 +248,143 @@ int main(int argc, char **argv)
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &nb_proc);
 
+    if (work_queue_rma())
+    {
+        rma_work_queue(seed, N, M, schedule_chunk_from_env(), rank);
+        MPI_Finalize();
+        return 0;
+    }
+
+    if (nb_proc < 2)
+    {
+        fprintf(stderr, "Needs at least 2 processes: a master and a worker\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    /*
+    Every process builds the same schedule (see schedule.h): the workers only use it to size their buffers.
+    */
+    struct schedule sched;
+    schedule_init(&sched, schedule_policy_from_env(), M, nb_proc - 1, schedule_chunk_from_env());
+    int max_chunk = schedule_max_chunk(&sched);
+
+    /*
+    With SHARED_MEMORY=1, the tasks are generated in memory shared by the processes of the node of process 0:
+    the workers of this node read them in place and only receive the chunk (first, count, stride).
+    The workers of the other nodes receive the tasks as before.
+    */
+    int use_shared = shared_memory_from_env();
+    struct node_layout layout;
+    int *shared_tasks = NULL;
+    MPI_Win tasks_win = MPI_WIN_NULL;
+    int in_place = 0;
+    int in_place_of[nb_proc];
+    if (use_shared)
+    {
+        node_layout_init(&layout, MPI_COMM_WORLD);
+        in_place = layout.node_index == 0;
+        if (in_place)
+        {
+            shared_tasks = shared_alloc(&layout, (long)M * (N+1), &tasks_win);
+        }
+    }
+    MPI_Gather(&in_place, 1, MPI_INT, in_place_of, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
     if (rank==0)
     {
-        int *array[M];
+        int *tasks = use_shared ? shared_tasks : (int *)malloc((long)M * (N+1) * sizeof(int));
         int max[M];
 
         // generate the arrays
         float t1 = MPI_Wtime();
-        srand48(seed);
         for (int i = 0; i < M; i++)
         {
-            array[i] = generate_array(-1, N, i);
+            generate_task(tasks + (long)i * (N+1), seed, N, i);
+        }
+        if (use_shared)
+        {
+            shared_sync(&layout, tasks_win);
         }
         float t2 = MPI_Wtime();
 
         /*
-        Process 0 will be in charge of distributing the work to the other MPI processes dynamically.
+        Process 0 will be in charge of distributing the work to the other MPI processes, in chunks of tasks.
+        With a static policy, every worker gets all its tasks in one chunk.
+        With a dynamic policy, every worker keeps depth chunks in flight: while it searches the max of one
+        chunk, the next ones are already on their way, so it never waits for a round-trip with process 0.
+        The results of a chunk are the request for a new one: on each result, process 0 refills the
+        pipeline of the worker that sent it.
         */
         
         float t3 = MPI_Wtime();
 
-        int initially_idle = 1;
-        int dest = initially_idle;
+        int depth = pipeline_depth();
+        // every chunk has at least one task
+        MPI_Request *sends = (MPI_Request *)malloc(M * sizeof(MPI_Request));
+        // one more: schedule_static and schedule_next fill the chunk before telling it is empty
+        struct chunk *chunks = (struct chunk *)malloc((M + 1) * sizeof(struct chunk));
+        int nb_chunks = 0;
 
-        int nb_received = 0;
-        // send the messages to ready processes
-        for (int i = 0; i < M; i++)
+        if (schedule_is_static(&sched))
         {
-            if (initially_idle < nb_proc)
+            for (int dest = 1; dest < nb_proc; dest++)
             {
-                dest = initially_idle;
-                initially_idle++;
-            } else {
-                int message[3];
-                MPI_Status status;
-                MPI_Recv(message, 2, MPI_INT, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &status);
-                max[message[0]] = message[1];
-                nb_received++;
-                dest = status.MPI_SOURCE;
+                if (schedule_static(&sched, dest - 1, &chunks[nb_chunks]) > 0)
+                {
+                    send_chunk(tasks, N, &chunks[nb_chunks], dest, in_place_of[dest], &sends[nb_chunks]);
+                    nb_chunks++;
+                }
+            }
+        }
+        else
+        {
+            // fill the pipelines one level at a time, so that every worker gets its first chunk early
+            for (int level = 0; level < depth; level++)
+            {
+                for (int dest = 1; dest < nb_proc && schedule_next(&sched, &chunks[nb_chunks]) > 0; dest++)
+                {
+                    send_chunk(tasks, N, &chunks[nb_chunks], dest, in_place_of[dest], &sends[nb_chunks]);
+                    nb_chunks++;
+                }
             }
-            MPI_Send(array[i], N+1, MPI_INT, dest, 0, MPI_COMM_WORLD);
-            free(array[i]);
         }
 
-        // receive the last messages
-        for (int i = nb_received; i < M; i++)
+        // the results come as (array index, max) pairs, one pair per task of the chunk
+        int *message = (int *)malloc(2 * max_chunk * sizeof(int));
+        int nb_received = 0;
+        while (nb_received < M)
         {
-            int message[2];
-            MPI_Recv(message, 2, MPI_INT, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            max[message[0]] = message[1];
+            MPI_Status status;
+            int count;
+            MPI_Recv(message, 2 * max_chunk, MPI_INT, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &status);
+            MPI_Get_count(&status, MPI_INT, &count);
+            for (int i = 0; i < count; i += 2)
+            {
+                max[message[i]] = message[i + 1];
+            }
+            nb_received += count / 2;
+            if (!schedule_is_static(&sched) && schedule_next(&sched, &chunks[nb_chunks]) > 0)
+            {
+                int dest = status.MPI_SOURCE;
+                send_chunk(tasks, N, &chunks[nb_chunks], dest, in_place_of[dest], &sends[nb_chunks]);
+                nb_chunks++;
+            }
+        }
+        MPI_Waitall(nb_chunks, sends, MPI_STATUSES_IGNORE);
+        free(sends);
+        free(chunks);
+        free(message);
+        if (!use_shared)
+        {
+            free(tasks);
         }
 
-        // kill the processes
-        int *kill_array = (int *)malloc((N+1) * sizeof(int));
-        kill_array[0] = -1;
+        // kill the processes: the index -1 is enough, the elements are not needed
+        int kill = -1;
         for (int i = 1; i < nb_proc; i++)
         {
-            MPI_Send(kill_array, N+1, MPI_INT, i, 0, MPI_COMM_WORLD);
+            MPI_Send(&kill, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
         }
-        free(kill_array);
 
         float t4 = MPI_Wtime();
 
@@ -163,26 +393,103 @@ int main(int argc, char **argv)
         {
             printf("Max of array %d is %d\n", i, max[i]);
         }
+        printf("Schedule: %s, chunk %d, %d chunks sent\n", schedule_policy_name(sched.policy), sched.chunk, nb_chunks);
         printf("Time to generate the arrays: %f ms\n", (t2 - t1) * 1000);
         printf("Time to get the max: %f ms\n", (t4 - t3) * 1000);
         printf("Total time: %f ms\n", (t4 - t3 + t2 - t1) * 1000);
     } else {
-        int c = 1;
-        while (c)
+        /*
+        The worker posts depth receives, large enough for the largest chunk. The messages of process 0
+        arrive in order and match the receives in the order they were posted, so the chunks are taken
+        from the buffers in turn. A buffer gets a new receive as soon as its maxima are computed.
+        With a static policy, only one chunk comes: one buffer is enough.
+        A worker that reads the tasks in place only receives the chunks.
+        */
+        int depth = schedule_is_static(&sched) ? 1 : pipeline_depth();
+        int buffer_size = in_place ? 3 : max_chunk * (N+1);
+        int *buffer[depth];
+        int *message[depth];
+        MPI_Request recvs[depth];
+        MPI_Request sends[depth];
+
+        for (int b = 0; b < depth; b++)
+        {
+            buffer[b] = (int *)malloc((long)buffer_size * sizeof(int));
+            message[b] = (int *)malloc(2 * max_chunk * sizeof(int));
+            MPI_Irecv(buffer[b], buffer_size, MPI_INT, 0, 0, MPI_COMM_WORLD, &recvs[b]);
+            sends[b] = MPI_REQUEST_NULL;
+        }
+        if (in_place)
+        {
+            // wait for process 0 to generate the tasks
+            shared_sync(&layout, tasks_win);
+        }
+
+        float idle = 0;
+        int nb_tasks = 0;
+        int b = 0;
+        while (1)
         {
-            int *array = (int *)malloc((N+1) * sizeof(int));
-            MPI_Recv(array, N+1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            if (array[0] == -1)
+            MPI_Status status;
+            int count;
+            float t1 = MPI_Wtime();
+            MPI_Wait(&recvs[b], &status);
+            // the wait for the first chunk is the generation of the arrays, not idle time
+            if (nb_tasks > 0)
+            {
+                idle += MPI_Wtime() - t1;
+            }
+            if (buffer[b][0] == -1)
+            {
+                break;
+            }
+            struct chunk *c = (struct chunk *)buffer[b];
+            if (in_place)
+            {
+                count = c->count;
+            }
+            else
             {
-                c = 0;
-            } else {
+                MPI_Get_count(&status, MPI_INT, &count);
+                count /= N+1;
+            }
+
+            MPI_Wait(&sends[b], MPI_STATUS_IGNORE);
+            for (int i = 0; i < count; i++)
+            {
+                int *task = in_place ? shared_tasks + (long)(c->first + i * c->stride) * (N+1) : buffer[b] + (long)i * (N+1);
+                message[b][2 * i] = task[0];
                 // offset is 1 because the first element of the array is the index of the array
-                int max = max_array(array, N+1, 1);
-                int message[2] = {array[0], max};
-                MPI_Send(message, 2, MPI_INT, 0, 0, MPI_COMM_WORLD);
+                message[b][2 * i + 1] = max_array(task, N+1, 1);
             }
-            free(array);
+            MPI_Irecv(buffer[b], buffer_size, MPI_INT, 0, 0, MPI_COMM_WORLD, &recvs[b]);
+            MPI_Isend(message[b], 2 * count, MPI_INT, 0, 0, MPI_COMM_WORLD, &sends[b]);
+            nb_tasks += count;
+            b = (b + 1) % depth;
+        }
+
+        // nothing comes after the kill message: cancel the other receives
+        MPI_Waitall(depth, sends, MPI_STATUSES_IGNORE);
+        for (int i = 0; i < depth; i++)
+        {
+            if (i != b)
+            {
+                MPI_Cancel(&recvs[i]);
+                MPI_Wait(&recvs[i], MPI_STATUS_IGNORE);
+            }
+            free(buffer[i]);
+            free(message[i]);
+        }
+        printf("%d Processed %d arrays, time waiting between tasks: %f ms\n", rank, nb_tasks, idle * 1000);
+    }
+
+    if (use_shared)
+    {
+        if (tasks_win != MPI_WIN_NULL)
+        {
+            shared_free(&tasks_win);
         }
+        node_layout_free(&layout);
     }
 
     MPI_Finalize();
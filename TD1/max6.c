@@ -0,0 +1,102 @@
+/*
+e) Work Stealing
+In max4 and max5, process 0 generates, sends and collects everything, and does not search any max itself. With a few
+dozen processes, it becomes the bottleneck: the workers wait for it.
+
+Here, there is no master (see steal.h). The arrays are split in blocks between all the processes, and each process
+generates and processes the arrays of its block. A process that runs out of arrays steals half of the remaining arrays
+of a random victim. Since the generator is counter-based (see array_gen.h), a stolen array is only sent as its index:
+the thief regenerates it.
+
+The arguments are the same as max5, plus an optional skew: array i has N * (1 + skew * i / M) elements, so that
+the last blocks cost more than the first ones and the initial distribution is unbalanced.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <mpi.h>
+#include "max_kernel.h"
+#include "array_gen.h"
+#include "reduce.h"
+#include "steal.h"
+
+struct max_tasks
+{
+    int seed;
+    int N;
+    int M;
+    double skew;
+    int *max;
+};
+
+int task_size(struct max_tasks *t, int array_index)
+{
+    return (int)(t->N * (1 + t->skew * array_index / t->M));
+}
+
+void run_task(int array_index, void *arg)
+{
+    struct max_tasks *t = (struct max_tasks *)arg;
+    int size = task_size(t, array_index);
+    int *array = generate_array(t->seed, size, array_index);
+    t->max[array_index] = max_array(array, size, 0);
+    free(array);
+}
+
+int main(int argc, char **argv)
+{
+    MPI_Init(&argc, &argv);
+
+    int rank, nb_proc;
+    struct max_tasks tasks;
+
+    if (argc != 4 && argc != 5)
+    {
+        fprintf(stderr, "Function needs 3 or 4 arguments: seed, number of elements, number of arrays and skew\n");
+        exit(1);
+    }
+
+    tasks.seed = atoi(argv[1]);
+    tasks.N = atoi(argv[2]);
+    tasks.M = atoi(argv[3]);
+    tasks.skew = argc == 5 ? atof(argv[4]) : 0;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &nb_proc);
+
+    int max[tasks.M];
+    tasks.max = max;
+    // every array is processed by one process, the others contribute INT_MIN to the reduction
+    for (int i = 0; i < tasks.M; i++)
+    {
+        max[i] = INT_MIN;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    float t1 = MPI_Wtime();
+    struct steal_stats stats;
+    steal_run(tasks.M, run_task, &tasks, MPI_COMM_WORLD, &stats);
+    float t2 = MPI_Wtime();
+    printf("%d Processed %d arrays, %d stolen in %d of %d requests, time idle: %f ms\n",
+           rank, stats.executed, stats.stolen, stats.steals, stats.requests, stats.idle * 1000);
+
+    float t3 = MPI_Wtime();
+    reduce(max, tasks.M, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD, reduce_algo_from_env());
+    float t4 = MPI_Wtime();
+
+    if (rank == 0)
+    {
+        // print the results
+        for (int i = 0; i < tasks.M; i++)
+        {
+            printf("Max of array %d is %d\n", i, max[i]);
+        }
+        printf("Time to generate the arrays and get the max: %f ms\n", (t2 - t1) * 1000);
+        printf("Time to collect the results: %f ms\n", (t4 - t3) * 1000);
+        printf("Total time: %f ms\n", (t4 - t3 + t2 - t1) * 1000);
+    }
+
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*
+Implementations of max_array (see max_kernel.h).
+
+The vector kernels keep 4 independent accumulators, so that each vpmaxsd
+does not wait for the result of the previous one, and the tail of the array
+is handled with a masked load (AVX-512) or with scalar code (AVX2).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <immintrin.h>
+#include <omp.h>
+#include "max_kernel.h"
+
+typedef int (*max_kernel_t)(const int *array, long size);
+
+static int max_scalar(const int *array, long size)
+{
+    int m0 = INT_MIN, m1 = INT_MIN, m2 = INT_MIN, m3 = INT_MIN;
+    long i;
+
+    for (i = 0; i + 4 <= size; i += 4)
+    {
+        m0 = array[i] > m0 ? array[i] : m0;
+        m1 = array[i + 1] > m1 ? array[i + 1] : m1;
+        m2 = array[i + 2] > m2 ? array[i + 2] : m2;
+        m3 = array[i + 3] > m3 ? array[i + 3] : m3;
+    }
+    for (; i < size; i++)
+    {
+        m0 = array[i] > m0 ? array[i] : m0;
+    }
+    m0 = m1 > m0 ? m1 : m0;
+    m2 = m3 > m2 ? m3 : m2;
+    return m2 > m0 ? m2 : m0;
+}
+
+__attribute__((target("avx2")))
+static int max_avx2(const int *array, long size)
+{
+    __m256i m0 = _mm256_set1_epi32(INT_MIN);
+    __m256i m1 = m0, m2 = m0, m3 = m0;
+    long i;
+
+    for (i = 0; i + 32 <= size; i += 32)
+    {
+        m0 = _mm256_max_epi32(m0, _mm256_loadu_si256((const __m256i *)(array + i)));
+        m1 = _mm256_max_epi32(m1, _mm256_loadu_si256((const __m256i *)(array + i + 8)));
+        m2 = _mm256_max_epi32(m2, _mm256_loadu_si256((const __m256i *)(array + i + 16)));
+        m3 = _mm256_max_epi32(m3, _mm256_loadu_si256((const __m256i *)(array + i + 24)));
+    }
+    for (; i + 8 <= size; i += 8)
+    {
+        m0 = _mm256_max_epi32(m0, _mm256_loadu_si256((const __m256i *)(array + i)));
+    }
+    m0 = _mm256_max_epi32(_mm256_max_epi32(m0, m1), _mm256_max_epi32(m2, m3));
+
+    // reduce the 8 lanes
+    __m128i m = _mm_max_epi32(_mm256_castsi256_si128(m0), _mm256_extracti128_si256(m0, 1));
+    m = _mm_max_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_max_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+    int max = _mm_cvtsi128_si32(m);
+
+    for (; i < size; i++)
+    {
+        max = array[i] > max ? array[i] : max;
+    }
+    return max;
+}
+
+__attribute__((target("avx512f")))
+static int max_avx512(const int *array, long size)
+{
+    __m512i m0 = _mm512_set1_epi32(INT_MIN);
+    __m512i m1 = m0, m2 = m0, m3 = m0;
+    long i;
+
+    for (i = 0; i + 64 <= size; i += 64)
+    {
+        m0 = _mm512_max_epi32(m0, _mm512_loadu_si512(array + i));
+        m1 = _mm512_max_epi32(m1, _mm512_loadu_si512(array + i + 16));
+        m2 = _mm512_max_epi32(m2, _mm512_loadu_si512(array + i + 32));
+        m3 = _mm512_max_epi32(m3, _mm512_loadu_si512(array + i + 48));
+    }
+    for (; i + 16 <= size; i += 16)
+    {
+        m0 = _mm512_max_epi32(m0, _mm512_loadu_si512(array + i));
+    }
+    if (i < size)
+    {
+        // the lanes past the end keep INT_MIN
+        __mmask16 mask = (__mmask16)((1u << (size - i)) - 1);
+        m1 = _mm512_max_epi32(m1, _mm512_mask_loadu_epi32(_mm512_set1_epi32(INT_MIN), mask, array + i));
+    }
+    m0 = _mm512_max_epi32(_mm512_max_epi32(m0, m1), _mm512_max_epi32(m2, m3));
+    return _mm512_reduce_max_epi32(m0);
+}
+
+static max_kernel_t kernel = max_scalar;
+static const char *kernel_name = "scalar";
+
+/*
+Choose the kernel before main, so that max_array never races on it.
+*/
+__attribute__((constructor))
+static void select_kernel(void)
+{
+    const char *forced = getenv("MAX_KERNEL_ISA");
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && (!forced || strcmp(forced, "avx512") == 0))
+    {
+        kernel = max_avx512;
+        kernel_name = "avx512";
+    }
+    else if (__builtin_cpu_supports("avx2") && (!forced || strcmp(forced, "avx512") == 0 || strcmp(forced, "avx2") == 0))
+    {
+        kernel = max_avx2;
+        kernel_name = "avx2";
+    }
+    if (forced && strcmp(forced, kernel_name) != 0)
+    {
+        fprintf(stderr, "max_kernel: %s is not available, using %s\n", forced, kernel_name);
+    }
+}
+
+const char *max_array_isa(void)
+{
+    return kernel_name;
+}
+
+int max_array_serial(const int *array, long size)
+{
+    return kernel(array, size);
+}
+
+int max_array(int *array, int size, int offset)
+{
+    const int *start = array + offset;
+    long n = (long)size - offset;
+    int max = INT_MIN;
+    long i;
+
+    if (n < MAX_OMP_THRESHOLD || omp_get_max_threads() == 1)
+    {
+        return n > 0 ? kernel(start, n) : INT_MIN;
+    }
+
+    // each thread reduces whole blocks, which stay in its cache
+    long block = MAX_OMP_THRESHOLD / 4;
+#pragma omp parallel for schedule(static) reduction(max : max)
+    for (i = 0; i < n; i += block)
+    {
+        int m = kernel(start + i, n - i < block ? n - i : block);
+        max = m > max ? m : max;
+    }
+    return max;
+}
+
+int argmax_array(int *array, int size, int offset)
+{
+    if (size <= offset)
+    {
+        return -1;
+    }
+    int max = max_array(array, size, offset);
+    int i = offset;
+    while (array[i] != max)
+    {
+        i++;
+    }
+    return i;
+}
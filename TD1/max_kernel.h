@@ -0,0 +1,37 @@
+#ifndef MAX_KERNEL_H
+#define MAX_KERNEL_H
+
+/*
+Reduction kernel shared by the max programs.
+
+max_array uses the widest vector instructions of the processor (AVX-512,
+AVX2, or plain C), chosen once at startup with CPUID. Large arrays are also
+split between the OpenMP threads of the process, so that an MPI rank uses
+all the cores it is given (OMP_NUM_THREADS) instead of one scalar lane.
+
+The MAX_KERNEL_ISA environment variable (scalar, avx2 or avx512) forces an
+implementation, to compare them.
+*/
+
+/* arrays with at least this number of elements are split between the threads */
+#define MAX_OMP_THRESHOLD (1 << 18)
+
+/*
+This function returns the maximum value of array[offset] ... array[size - 1],
+or INT_MIN if the range is empty.
+*/
+int max_array(int *array, int size, int offset);
+
+/*
+This function returns the index (in array) of the first maximum of array[offset] ... array[size - 1],
+or -1 if the range is empty. The maximum is found with max_array, then a scan stops at its first occurrence.
+*/
+int argmax_array(int *array, int size, int offset);
+
+/* same as max_array on array[0] ... array[size - 1], on the calling thread only */
+int max_array_serial(const int *array, long size);
+
+/* name of the implementation used by max_array */
+const char *max_array_isa(void);
+
+#endif
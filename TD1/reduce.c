@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reduce.h"
+
+#define REDUCE_TAG 1000
+
+static const char *algo_names[REDUCE_NB_ALGOS] = {"mpi", "binomial", "doubling"};
+
+enum reduce_algo reduce_algo_from_env(void)
+{
+    const char *name = getenv("REDUCE_ALGO");
+
+    if (name)
+    {
+        for (int algo = 0; algo < REDUCE_NB_ALGOS; algo++)
+        {
+            if (strcmp(name, algo_names[algo]) == 0)
+            {
+                return algo;
+            }
+        }
+        fprintf(stderr, "Unknown REDUCE_ALGO '%s', using mpi\n", name);
+    }
+    return REDUCE_MPI;
+}
+
+const char *reduce_algo_name(enum reduce_algo algo)
+{
+    return algo_names[algo];
+}
+
+static void *alloc_like(int count, MPI_Datatype type)
+{
+    MPI_Aint lb, extent;
+
+    MPI_Type_get_extent(type, &lb, &extent);
+    return malloc(count * extent > 0 ? count * extent : 1);
+}
+
+/*
+Binomial tree towards root: at step k, the processes whose relative rank has
+bit k set send their partial result to the process 2^k below and leave.
+*/
+static void binomial_reduce(void *buf, int count, MPI_Datatype type, MPI_Op op, int root, MPI_Comm comm)
+{
+    int rank, nb_proc;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nb_proc);
+
+    int vrank = (rank - root + nb_proc) % nb_proc;
+    void *tmp = alloc_like(count, type);
+
+    for (int mask = 1; mask < nb_proc; mask <<= 1)
+    {
+        if (vrank & mask)
+        {
+            MPI_Send(buf, count, type, (vrank - mask + root) % nb_proc, REDUCE_TAG, comm);
+            break;
+        }
+        if (vrank + mask < nb_proc)
+        {
+            MPI_Recv(tmp, count, type, (vrank + mask + root) % nb_proc, REDUCE_TAG, comm, MPI_STATUS_IGNORE);
+            MPI_Reduce_local(tmp, buf, count, type, op);
+        }
+    }
+    free(tmp);
+}
+
+/* the reverse of binomial_reduce: root sends the result down the same tree */
+static void binomial_bcast(void *buf, int count, MPI_Datatype type, int root, MPI_Comm comm)
+{
+    int rank, nb_proc;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nb_proc);
+
+    int vrank = (rank - root + nb_proc) % nb_proc;
+    int mask = 1;
+
+    // receive from the parent: the process that clears the lowest set bit
+    while (mask < nb_proc)
+    {
+        if (vrank & mask)
+        {
+            MPI_Recv(buf, count, type, (vrank - mask + root) % nb_proc, REDUCE_TAG, comm, MPI_STATUS_IGNORE);
+            break;
+        }
+        mask <<= 1;
+    }
+    // send to the children, largest subtree first
+    for (mask >>= 1; mask > 0; mask >>= 1)
+    {
+        if (vrank + mask < nb_proc)
+        {
+            MPI_Send(buf, count, type, (vrank + mask + root) % nb_proc, REDUCE_TAG, comm);
+        }
+    }
+}
+
+/*
+Recursive doubling: at step k, process r exchanges its partial result with
+process r ^ 2^k, so that after log2(P) steps everyone has the result.
+With a number of processes that is not a power of 2, the first 2 * extra
+processes are paired first, and one of each pair sits out the exchanges.
+*/
+static void doubling_allreduce(void *buf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm)
+{
+    int rank, nb_proc;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nb_proc);
+
+    int pof2 = 1;
+    while (pof2 * 2 <= nb_proc)
+    {
+        pof2 *= 2;
+    }
+    int extra = nb_proc - pof2;
+    void *tmp = alloc_like(count, type);
+
+    int newrank;
+    if (rank < 2 * extra)
+    {
+        if (rank % 2 == 0)
+        {
+            MPI_Send(buf, count, type, rank + 1, REDUCE_TAG, comm);
+            newrank = -1;
+        }
+        else
+        {
+            MPI_Recv(tmp, count, type, rank - 1, REDUCE_TAG, comm, MPI_STATUS_IGNORE);
+            MPI_Reduce_local(tmp, buf, count, type, op);
+            newrank = rank / 2;
+        }
+    }
+    else
+    {
+        newrank = rank - extra;
+    }
+
+    if (newrank >= 0)
+    {
+        for (int mask = 1; mask < pof2; mask <<= 1)
+        {
+            int newpartner = newrank ^ mask;
+            int partner = newpartner < extra ? newpartner * 2 + 1 : newpartner + extra;
+            MPI_Sendrecv(buf, count, type, partner, REDUCE_TAG, tmp, count, type, partner, REDUCE_TAG,
+                         comm, MPI_STATUS_IGNORE);
+            MPI_Reduce_local(tmp, buf, count, type, op);
+        }
+    }
+
+    // give the result to the processes that sat out
+    if (rank < 2 * extra)
+    {
+        if (rank % 2 == 0)
+        {
+            MPI_Recv(buf, count, type, rank + 1, REDUCE_TAG, comm, MPI_STATUS_IGNORE);
+        }
+        else
+        {
+            MPI_Send(buf, count, type, rank - 1, REDUCE_TAG, comm);
+        }
+    }
+    free(tmp);
+}
+
+void reduce(void *buf, int count, MPI_Datatype type, MPI_Op op, int root, MPI_Comm comm, enum reduce_algo algo)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    switch (algo)
+    {
+    case REDUCE_BINOMIAL:
+        binomial_reduce(buf, count, type, op, root, comm);
+        break;
+    case REDUCE_DOUBLING:
+        // everyone gets the result, root included
+        doubling_allreduce(buf, count, type, op, comm);
+        break;
+    default:
+        MPI_Reduce(rank == root ? MPI_IN_PLACE : buf, buf, count, type, op, root, comm);
+        break;
+    }
+}
+
+void reduce_all(void *buf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm, enum reduce_algo algo)
+{
+    switch (algo)
+    {
+    case REDUCE_BINOMIAL:
+        binomial_reduce(buf, count, type, op, 0, comm);
+        binomial_bcast(buf, count, type, 0, comm);
+        break;
+    case REDUCE_DOUBLING:
+        doubling_allreduce(buf, count, type, op, comm);
+        break;
+    default:
+        MPI_Allreduce(MPI_IN_PLACE, buf, count, type, op, comm);
+        break;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+#include <mpi.h>
+
+/*
+Reduction layer of the max programs.
+
+The reductions are done in place: on entry, buf holds the count values of
+the calling process; on return, it holds the values reduced over all the
+processes of comm (on every process for reduce_all, on root only for
+reduce). op can be any commutative MPI operation, predefined (MPI_MAX,
+MPI_MAXLOC...) or created with MPI_Op_create: the values are combined with
+MPI_Reduce_local.
+
+Reducing count values costs the same number of messages as reducing one:
+the programs reduce all their maxima at once.
+*/
+
+enum reduce_algo
+{
+    REDUCE_MPI,      // MPI_Reduce / MPI_Allreduce
+    REDUCE_BINOMIAL, // binomial tree: log2(P) steps towards root (then back for reduce_all)
+    REDUCE_DOUBLING, // recursive doubling: log2(P) pairwise exchanges, everyone gets the result
+    REDUCE_NB_ALGOS
+};
+
+/* algorithm named by the REDUCE_ALGO environment variable (mpi, binomial or doubling), REDUCE_MPI by default */
+enum reduce_algo reduce_algo_from_env(void);
+const char *reduce_algo_name(enum reduce_algo algo);
+
+void reduce(void *buf, int count, MPI_Datatype type, MPI_Op op, int root, MPI_Comm comm, enum reduce_algo algo);
+void reduce_all(void *buf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm, enum reduce_algo algo);
+
+/* argmax: use with MPI_2INT and MPI_MAXLOC. On ties, the smallest index wins */
+struct max_loc
+{
+    int value;
+    int index;
+};
+
+#endif
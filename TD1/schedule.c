@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "schedule.h"
+#include "distribute.h"
+
+static const char *policy_names[SCHEDULE_NB_POLICIES] = {"block", "cyclic", "dynamic", "guided", "factoring"};
+
+enum schedule_policy schedule_policy_from_env(void)
+{
+    const char *name = getenv("SCHEDULE");
+
+    if (name)
+    {
+        for (int policy = 0; policy < SCHEDULE_NB_POLICIES; policy++)
+        {
+            if (strcmp(name, policy_names[policy]) == 0)
+            {
+                return policy;
+            }
+        }
+        fprintf(stderr, "Unknown SCHEDULE '%s', using dynamic\n", name);
+    }
+    return SCHEDULE_DYNAMIC;
+}
+
+int schedule_chunk_from_env(void)
+{
+    const char *env = getenv("SCHEDULE_CHUNK");
+    int chunk = env ? atoi(env) : 1;
+    return chunk < 1 ? 1 : chunk;
+}
+
+const char *schedule_policy_name(enum schedule_policy policy)
+{
+    return policy_names[policy];
+}
+
+static int ceil_div(int a, int b)
+{
+    return (a + b - 1) / b;
+}
+
+void schedule_init(struct schedule *s, enum schedule_policy policy, int nb_tasks, int nb_workers, int chunk)
+{
+    s->policy = policy;
+    s->nb_tasks = nb_tasks;
+    s->nb_workers = nb_workers;
+    s->chunk = chunk < 1 ? 1 : chunk;
+    s->next = 0;
+    s->batch = 0;
+    s->batch_size = 0;
+}
+
+int schedule_is_static(const struct schedule *s)
+{
+    return s->policy == SCHEDULE_BLOCK || s->policy == SCHEDULE_CYCLIC;
+}
+
+int schedule_static(const struct schedule *s, int worker, struct chunk *c)
+{
+    if (s->policy == SCHEDULE_BLOCK)
+    {
+        c->first = block_first(s->nb_tasks, s->nb_workers, worker);
+        c->count = block_count(s->nb_tasks, s->nb_workers, worker);
+        c->stride = 1;
+    }
+    else
+    {
+        c->first = worker;
+        c->count = cyclic_count(s->nb_tasks, s->nb_workers, worker, 1);
+        c->stride = s->nb_workers;
+    }
+    return c->count;
+}
+
+int schedule_next(struct schedule *s, struct chunk *c)
+{
+    int remaining = s->nb_tasks - s->next;
+    int size;
+
+    switch (s->policy)
+    {
+    case SCHEDULE_GUIDED:
+        size = ceil_div(remaining, s->nb_workers);
+        break;
+    case SCHEDULE_FACTORING:
+        if (s->batch == 0)
+        {
+            s->batch = s->nb_workers;
+            s->batch_size = ceil_div(remaining, 2 * s->nb_workers);
+        }
+        s->batch--;
+        size = s->batch_size;
+        break;
+    default:
+        size = s->chunk;
+        break;
+    }
+    if (size < s->chunk)
+    {
+        size = s->chunk;
+    }
+    if (size > remaining)
+    {
+        size = remaining;
+    }
+
+    c->first = s->next;
+    c->count = size;
+    c->stride = 1;
+    s->next += size;
+    return size;
+}
+
+int schedule_max_chunk(const struct schedule *s)
+{
+    int size;
+
+    switch (s->policy)
+    {
+    case SCHEDULE_BLOCK:
+    case SCHEDULE_CYCLIC:
+    case SCHEDULE_GUIDED:
+        // the first chunk is the largest
+        size = ceil_div(s->nb_tasks, s->nb_workers);
+        break;
+    case SCHEDULE_FACTORING:
+        size = ceil_div(s->nb_tasks, 2 * s->nb_workers);
+        break;
+    default:
+        size = s->chunk;
+        break;
+    }
+    if (size < s->chunk && !schedule_is_static(s))
+    {
+        size = s->chunk;
+    }
+    if (size > s->nb_tasks)
+    {
+        size = s->nb_tasks;
+    }
+    return size < 1 ? 1 : size;
+}
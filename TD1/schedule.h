@@ -0,0 +1,78 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+/*
+Scheduling policies of the master/worker programs.
+
+nb_tasks tasks (0 ... nb_tasks - 1) are handed out to nb_workers workers in
+chunks. A chunk is a strided set of tasks: first, first + stride, ...,
+first + (count - 1) * stride.
+
+Static policies decide everything ahead of time: every worker gets one chunk
+(schedule_static), the master sends it in one message and never hears from the
+worker until the results come back. There is one message per worker, but the
+slowest worker sets the end.
+
+Dynamic policies hand out a contiguous chunk to whichever worker asks
+(schedule_next). The first chunks are large to save messages, the last are
+small so that the workers finish together:
+- dynamic: chunks of chunk tasks (chunk = 1: one task per request)
+- guided: remaining / nb_workers tasks, at least chunk. The chunk size decreases
+  with every request
+- factoring: the tasks are handed out in batches of nb_workers chunks of equal
+  size; each batch covers half of the remaining tasks (at least chunk per chunk).
+  The chunk size decreases with every batch, and is the same within a batch, so
+  that the workers of a batch finish at the same time
+*/
+
+enum schedule_policy
+{
+    SCHEDULE_BLOCK,     // static: worker w gets the w-th contiguous block of tasks
+    SCHEDULE_CYCLIC,    // static: worker w gets the tasks w, w + nb_workers, w + 2 * nb_workers...
+    SCHEDULE_DYNAMIC,   // chunks of chunk tasks, on request
+    SCHEDULE_GUIDED,    // decreasing chunks, remaining / nb_workers
+    SCHEDULE_FACTORING, // decreasing batches of equal chunks, half of the remaining tasks per batch
+    SCHEDULE_NB_POLICIES
+};
+
+struct chunk
+{
+    int first;
+    int count;
+    int stride;
+};
+
+struct schedule
+{
+    enum schedule_policy policy;
+    int nb_tasks;
+    int nb_workers;
+    int chunk;      // minimum chunk size of the dynamic policies
+    int next;       // first task not handed out yet
+    int batch;      // factoring: chunks left in the current batch
+    int batch_size; // factoring: chunk size of the current batch
+};
+
+/*
+policy named by the SCHEDULE environment variable (block, cyclic, dynamic, guided
+or factoring), SCHEDULE_DYNAMIC by default, and chunk size given by SCHEDULE_CHUNK (1 by default)
+*/
+enum schedule_policy schedule_policy_from_env(void);
+int schedule_chunk_from_env(void);
+const char *schedule_policy_name(enum schedule_policy policy);
+
+void schedule_init(struct schedule *s, enum schedule_policy policy, int nb_tasks, int nb_workers, int chunk);
+
+/* 1 if the policy is static: use schedule_static, otherwise use schedule_next */
+int schedule_is_static(const struct schedule *s);
+
+/* static policies: the tasks of worker (0 ... nb_workers - 1). Return the number of tasks */
+int schedule_static(const struct schedule *s, int worker, struct chunk *c);
+
+/* dynamic policies: the next chunk to hand out. Return its number of tasks, 0 when all the tasks are handed out */
+int schedule_next(struct schedule *s, struct chunk *c);
+
+/* largest chunk the policy can produce: the workers can size their buffers without knowing the chunks in advance */
+int schedule_max_chunk(const struct schedule *s);
+
+#endif
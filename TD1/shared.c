@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shared.h"
+#include "distribute.h"
+
+int shared_memory_from_env(void)
+{
+    const char *env = getenv("SHARED_MEMORY");
+    return env && strcmp(env, "1") == 0;
+}
+
+void node_layout_init(struct node_layout *layout, MPI_Comm comm)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    // the key keeps the order of comm: the first process of a node is its lowest rank
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &layout->node);
+    MPI_Comm_rank(layout->node, &layout->node_rank);
+    MPI_Comm_size(layout->node, &layout->node_size);
+
+    MPI_Comm_split(comm, layout->node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &layout->leaders);
+    if (layout->leaders != MPI_COMM_NULL)
+    {
+        MPI_Comm_rank(layout->leaders, &layout->node_index);
+        MPI_Comm_size(layout->leaders, &layout->nb_nodes);
+    }
+    MPI_Bcast(&layout->node_index, 1, MPI_INT, 0, layout->node);
+    MPI_Bcast(&layout->nb_nodes, 1, MPI_INT, 0, layout->node);
+}
+
+void node_layout_free(struct node_layout *layout)
+{
+    if (layout->leaders != MPI_COMM_NULL)
+    {
+        MPI_Comm_free(&layout->leaders);
+    }
+    MPI_Comm_free(&layout->node);
+}
+
+int *shared_alloc(struct node_layout *layout, long size, MPI_Win *win)
+{
+    int *base;
+    MPI_Aint bytes = layout->node_rank == 0 ? size * sizeof(int) : 0;
+    MPI_Aint query_size;
+    int disp_unit;
+
+    MPI_Win_allocate_shared(bytes, sizeof(int), MPI_INFO_NULL, layout->node, &base, win);
+    // the other processes allocated nothing: get the address of the memory of the first process
+    MPI_Win_shared_query(*win, 0, &query_size, &disp_unit, &base);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, *win);
+    return base;
+}
+
+void shared_free(MPI_Win *win)
+{
+    MPI_Win_unlock_all(*win);
+    MPI_Win_free(win);
+}
+
+void shared_sync(struct node_layout *layout, MPI_Win win)
+{
+    MPI_Win_sync(win);
+    MPI_Barrier(layout->node);
+    MPI_Win_sync(win);
+}
+
+void scatter_shared_arrays(struct node_layout *layout, int *arrays, MPI_Win array_win, int size, int nb_arrays,
+                           MPI_Win *node_win, int **slices, int *count)
+{
+    int node_first = block_first(size, layout->nb_nodes, layout->node_index);
+    int node_count = block_count(size, layout->nb_nodes, layout->node_index);
+    int *node_blocks;
+    long stride;
+
+    *node_win = MPI_WIN_NULL;
+    if (layout->node_index == 0)
+    {
+        // rank 0 wrote the arrays: make them visible to its node
+        shared_sync(layout, array_win);
+        node_blocks = arrays + node_first;
+        stride = size;
+    }
+    else
+    {
+        // the blocks of all the arrays in one window
+        node_blocks = shared_alloc(layout, (long)nb_arrays * node_count, node_win);
+        stride = node_count;
+    }
+
+    if (layout->nb_nodes > 1 && layout->leaders != MPI_COMM_NULL)
+    {
+        if (layout->node_index == 0)
+        {
+            int *counts = (int *)malloc(layout->nb_nodes * sizeof(int));
+            int *displs = (int *)malloc(layout->nb_nodes * sizeof(int));
+            for (int node = 0; node < layout->nb_nodes; node++)
+            {
+                counts[node] = block_count(size, layout->nb_nodes, node);
+                displs[node] = block_first(size, layout->nb_nodes, node);
+            }
+            for (int a = 0; a < nb_arrays; a++)
+            {
+                MPI_Scatterv(arrays + (long)a * size, counts, displs, MPI_INT, MPI_IN_PLACE, 0, MPI_INT, 0,
+                             layout->leaders);
+            }
+            free(counts);
+            free(displs);
+        }
+        else
+        {
+            for (int a = 0; a < nb_arrays; a++)
+            {
+                MPI_Scatterv(NULL, NULL, NULL, MPI_INT, node_blocks + (long)a * node_count, node_count, MPI_INT, 0,
+                             layout->leaders);
+            }
+        }
+    }
+    if (layout->node_index != 0)
+    {
+        // the first process of the node received the blocks: make them visible to the node
+        shared_sync(layout, *node_win);
+    }
+
+    *count = block_count(node_count, layout->node_size, layout->node_rank);
+    for (int a = 0; a < nb_arrays; a++)
+    {
+        slices[a] = node_blocks + a * stride + block_first(node_count, layout->node_size, layout->node_rank);
+    }
+}
+
+int *scatter_shared(struct node_layout *layout, int *array, MPI_Win array_win, int size, MPI_Win *node_win, int *count)
+{
+    int *slice;
+    scatter_shared_arrays(layout, array, array_win, size, 1, node_win, &slice, count);
+    return slice;
+}
+
+int shared_first(struct node_layout *layout, int size)
+{
+    int node_count = block_count(size, layout->nb_nodes, layout->node_index);
+    return block_first(size, layout->nb_nodes, layout->node_index) +
+           block_first(node_count, layout->node_size, layout->node_rank);
+}
@@ -0,0 +1,70 @@
+#ifndef SHARED_H
+#define SHARED_H
+#include <mpi.h>
+
+/*
+Shared-memory distribution of the arrays between the processes of a node.
+
+The processes that run on the same node (MPI_Comm_split_type) can read each
+other's memory through a shared window (MPI_Win_allocate_shared): an array is
+allocated once per node and every process reads its slice in place, instead
+of receiving a copy. Only the nodes exchange messages: one per node, to the
+first process of the node.
+
+The windows are in a lock_all epoch from their allocation to shared_free:
+shared_sync makes the stores of a process visible to the others of the node.
+*/
+
+/* 1 if the SHARED_MEMORY environment variable is set to 1 */
+int shared_memory_from_env(void);
+
+struct node_layout
+{
+    MPI_Comm node;    // the processes of the node of the calling process
+    MPI_Comm leaders; // the first process of every node, MPI_COMM_NULL on the other processes
+    int node_rank;
+    int node_size;
+    int node_index;   // nodes are numbered by their first process: the node of rank 0 is node 0
+    int nb_nodes;
+};
+
+void node_layout_init(struct node_layout *layout, MPI_Comm comm);
+void node_layout_free(struct node_layout *layout);
+
+/*
+Allocate size ints in a shared window held by the first process of the node
+(size is only significant there). Every process of the node gets a pointer to
+the same memory. Collective over the node.
+*/
+int *shared_alloc(struct node_layout *layout, long size, MPI_Win *win);
+void shared_free(MPI_Win *win);
+
+/* make the stores into win visible to the whole node. Collective over the node */
+void shared_sync(struct node_layout *layout, MPI_Win win);
+
+/*
+Scatter array (size elements, allocated with shared_alloc on node 0 by rank 0
+of comm, array_win is its window) in two levels: the array is split in blocks
+between the nodes, then the block of a node between its processes (see
+distribute.h).
+On node 0, the processes read their slice directly from array. Every other node
+receives its block with one MPI_Scatterv between the first processes of the
+nodes, into a shared window that is returned in node_win and must be freed with
+shared_free (MPI_WIN_NULL on node 0).
+Return the slice of the calling process and store its number of elements in count.
+Collective over comm.
+*/
+int *scatter_shared(struct node_layout *layout, int *array, MPI_Win array_win, int size, MPI_Win *node_win, int *count);
+
+/*
+Same as scatter_shared for nb_arrays arrays of size elements stored one after the other in arrays.
+The blocks of all the arrays share a single window per node (node_win) and a single synchronization.
+slices[a] is the slice of array a of the calling process, count its number of elements (the same for every array).
+*/
+void scatter_shared_arrays(struct node_layout *layout, int *arrays, MPI_Win array_win, int size, int nb_arrays,
+                           MPI_Win *node_win, int **slices, int *count);
+
+/* index, in the array, of the first element of the slice that scatter_shared returns to the calling process */
+int shared_first(struct node_layout *layout, int size);
+
+#endif
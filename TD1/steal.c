@@ -0,0 +1,222 @@
+#include <stdlib.h>
+#include <string.h>
+#include "steal.h"
+#include "distribute.h"
+
+#define STEAL_REQUEST 2001
+#define STEAL_REPLY 2002
+#define STEAL_TOKEN 2003
+#define STEAL_DONE 2004
+
+struct steal_state
+{
+    MPI_Comm comm;
+    int rank;
+    int nb_proc;
+    int nb_tasks;
+
+    // tasks not started: first ... last - 1. The owner takes from first, the thieves from last
+    int first;
+    int last;
+
+    int pending;            // a steal request is waiting for its reply
+    MPI_Request request;
+    int request_buf;
+    unsigned int victim_seed;
+
+    // one reply buffer per thief: a thief has at most one request pending
+    int (*reply_buf)[2];
+    MPI_Request *replies;
+
+    int has_token;
+    int token;              // tasks completed, summed over the ring
+    int reported;           // tasks of this process already in the token
+    int token_buf;          // token being sent: poll may receive the next one into token meanwhile
+    MPI_Request token_req;
+
+    int done;
+    int done_buf;
+    MPI_Request done_req;
+
+    struct steal_stats *stats;
+};
+
+static void send_reply(struct steal_state *st, int thief)
+{
+    // give the upper half of the tasks not started, keep the lower half (and the odd one)
+    int give = (st->last - st->first) / 2;
+
+    MPI_Wait(&st->replies[thief], MPI_STATUS_IGNORE);
+    st->reply_buf[thief][0] = st->last - give;
+    st->reply_buf[thief][1] = st->last;
+    st->last -= give;
+    MPI_Isend(st->reply_buf[thief], 2, MPI_INT, thief, STEAL_REPLY, st->comm, &st->replies[thief]);
+}
+
+static void pass_token(struct steal_state *st)
+{
+    st->token += st->stats->executed - st->reported;
+    st->reported = st->stats->executed;
+    st->has_token = 0;
+
+    int next = (st->rank + 1) % st->nb_proc;
+    if (st->token == st->nb_tasks)
+    {
+        // every task is done: tell the others, the done message stops when it comes back
+        st->done = 1;
+        if (st->nb_proc > 1)
+        {
+            st->done_buf = st->rank;
+            MPI_Isend(&st->done_buf, 1, MPI_INT, next, STEAL_DONE, st->comm, &st->done_req);
+        }
+        return;
+    }
+    MPI_Wait(&st->token_req, MPI_STATUS_IGNORE);
+    st->token_buf = st->token;
+    MPI_Isend(&st->token_buf, 1, MPI_INT, next, STEAL_TOKEN, st->comm, &st->token_req);
+}
+
+/* handle every message that arrived, without blocking */
+static void poll(struct steal_state *st)
+{
+    int flag;
+    MPI_Status status;
+
+    MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, st->comm, &flag, &status);
+    while (flag)
+    {
+        int source = status.MPI_SOURCE;
+        int range[2];
+
+        switch (status.MPI_TAG)
+        {
+        case STEAL_REQUEST:
+            MPI_Recv(range, 1, MPI_INT, source, STEAL_REQUEST, st->comm, MPI_STATUS_IGNORE);
+            send_reply(st, source);
+            break;
+        case STEAL_REPLY:
+            MPI_Recv(range, 2, MPI_INT, source, STEAL_REPLY, st->comm, MPI_STATUS_IGNORE);
+            MPI_Wait(&st->request, MPI_STATUS_IGNORE);
+            st->pending = 0;
+            if (range[1] > range[0])
+            {
+                // only sent to an idle process: the queue is empty
+                st->first = range[0];
+                st->last = range[1];
+                st->stats->stolen += range[1] - range[0];
+                st->stats->steals++;
+            }
+            break;
+        case STEAL_TOKEN:
+            MPI_Recv(&st->token, 1, MPI_INT, source, STEAL_TOKEN, st->comm, MPI_STATUS_IGNORE);
+            st->has_token = 1;
+            break;
+        case STEAL_DONE:
+            MPI_Recv(range, 1, MPI_INT, source, STEAL_DONE, st->comm, MPI_STATUS_IGNORE);
+            st->done = 1;
+            if ((st->rank + 1) % st->nb_proc != range[0])
+            {
+                st->done_buf = range[0];
+                MPI_Isend(&st->done_buf, 1, MPI_INT, (st->rank + 1) % st->nb_proc, STEAL_DONE, st->comm, &st->done_req);
+            }
+            break;
+        }
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, st->comm, &flag, &status);
+    }
+}
+
+static void request_steal(struct steal_state *st)
+{
+    int victim = rand_r(&st->victim_seed) % (st->nb_proc - 1);
+    if (victim >= st->rank)
+    {
+        victim++;
+    }
+    st->pending = 1;
+    st->stats->requests++;
+    MPI_Isend(&st->request_buf, 1, MPI_INT, victim, STEAL_REQUEST, st->comm, &st->request);
+}
+
+void steal_run(int nb_tasks, void (*run_task)(int task, void *arg), void *arg, MPI_Comm comm, struct steal_stats *stats)
+{
+    struct steal_state st;
+
+    memset(&st, 0, sizeof(st));
+    memset(stats, 0, sizeof(*stats));
+    // the messages of the steals are probed with MPI_ANY_TAG: they get their own communicator, so that they
+    // are never mixed with the messages of the caller (a reduction on comm that starts while others still steal)
+    MPI_Comm_dup(comm, &st.comm);
+    MPI_Comm_rank(st.comm, &st.rank);
+    MPI_Comm_size(st.comm, &st.nb_proc);
+    st.nb_tasks = nb_tasks;
+    st.first = block_first(nb_tasks, st.nb_proc, st.rank);
+    st.last = st.first + block_count(nb_tasks, st.nb_proc, st.rank);
+    st.victim_seed = st.rank + 1;
+    st.reply_buf = malloc(st.nb_proc * sizeof(*st.reply_buf));
+    st.replies = malloc(st.nb_proc * sizeof(MPI_Request));
+    for (int proc = 0; proc < st.nb_proc; proc++)
+    {
+        st.replies[proc] = MPI_REQUEST_NULL;
+    }
+    st.request = MPI_REQUEST_NULL;
+    st.token_req = MPI_REQUEST_NULL;
+    st.done_req = MPI_REQUEST_NULL;
+    st.has_token = st.rank == 0;
+    st.stats = stats;
+
+    double idle_start = 0;
+    int idle = 0;
+    while (!st.done)
+    {
+        poll(&st);
+        if (st.first < st.last)
+        {
+            if (idle)
+            {
+                stats->idle += MPI_Wtime() - idle_start;
+                idle = 0;
+            }
+            run_task(st.first++, arg);
+            stats->executed++;
+            continue;
+        }
+
+        if (!idle)
+        {
+            idle_start = MPI_Wtime();
+            idle = 1;
+        }
+        if (st.has_token)
+        {
+            pass_token(&st);
+        }
+        else if (!st.pending && st.nb_proc > 1)
+        {
+            request_steal(&st);
+        }
+    }
+    stats->idle += MPI_Wtime() - idle_start;
+
+    /*
+    Every request is answered: once its own request has its reply, a process
+    enters a barrier and keeps answering the others until they all have theirs.
+    */
+    while (st.pending)
+    {
+        poll(&st);
+    }
+    MPI_Request barrier;
+    int flag = 0;
+    MPI_Ibarrier(st.comm, &barrier);
+    while (!flag)
+    {
+        poll(&st);
+        MPI_Test(&barrier, &flag, MPI_STATUS_IGNORE);
+    }
+    MPI_Waitall(st.nb_proc, st.replies, MPI_STATUSES_IGNORE);
+    MPI_Wait(&st.token_req, MPI_STATUS_IGNORE);
+    MPI_Wait(&st.done_req, MPI_STATUS_IGNORE);
+    free(st.reply_buf);
+    free(st.replies);
+    MPI_Comm_free(&st.comm);
+}
@@ -0,0 +1,42 @@
+#ifndef STEAL_H
+#define STEAL_H
+#include <mpi.h>
+
+/*
+Decentralized work stealing between the processes of a communicator.
+
+The tasks 0 ... nb_tasks - 1 are split in blocks between the processes (see
+distribute.h): there is no master, every process runs the tasks of its block,
+one at a time, from the first. A process whose block is empty sends a steal
+request to a random victim; the victim gives the upper half of the tasks it
+has not started (non-blocking messages on both sides). A process answers the
+requests between two tasks, and while it waits for a reply of its own.
+
+Termination is detected with a token that goes around the ring of processes
+and carries the number of tasks completed: a process adds the tasks it
+completed since the token last came, when it has nothing left to run. The
+tasks are only moved by the steals, never created or lost, so when the count
+reaches nb_tasks, every task is done, even if replies are still in flight.
+The process that sees it sends a done message around the ring.
+
+The steals use a duplicate of the communicator: the caller may send its own
+messages on comm, before or right after steal_run, whatever their tags.
+
+A stolen task is only described by its index: run_task must be able to run
+any task on any process (the max programs regenerate the array from its index,
+see array_gen.h).
+*/
+
+struct steal_stats
+{
+    int executed;       // tasks run by this process
+    int stolen;         // tasks received from victims
+    int steals;         // steal requests that brought tasks
+    int requests;       // steal requests sent
+    double idle;        // seconds spent without a task to run
+};
+
+/* run the tasks with work stealing. Return when all the tasks are done on all the processes */
+void steal_run(int nb_tasks, void (*run_task)(int task, void *arg), void *arg, MPI_Comm comm, struct steal_stats *stats);
+
+#endif
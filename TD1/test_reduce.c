@@ -0,0 +1,158 @@
+/*
+Self-check of the reduction layer (reduce.h) and of argmax_array (max_kernel.h).
+
+usage: mpirun -np P test_reduce
+
+For every algorithm of reduce.h, the processes reduce values whose result every process can compute on
+its own, and compare it with the expected one:
+max      : MPI_MAX on MPI_INT, with reduce_all and with reduce to the last process
+sum      : MPI_SUM on MPI_INT, with reduce_all
+argmax   : MPI_MAXLOC on MPI_2INT (struct max_loc), with ties between the processes: the smallest index must win
+Then argmax_array is compared with a plain loop, on arrays large enough to be split between the threads.
+The program prints the failed checks and exits with 1 if there is any, on every process count.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <mpi.h>
+#include "max_kernel.h"
+#include "array_gen.h"
+#include "reduce.h"
+
+#define COUNT 37
+
+int failures = 0;
+
+void check(int ok, const char *what, const char *algo, int rank, int i)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "%d FAILED: %s (%s), element %d\n", rank, what, algo, i);
+        failures++;
+    }
+}
+
+/* value of element i on process r: different on every process, and with ties between the processes for argmax */
+int value(int r, int i)
+{
+    return (r * 7 + i * 3) % 5 - 2;
+}
+
+/* index of element i on process r: the processes hold different indices for the same element */
+int location(int r, int nb_proc, int i)
+{
+    return (nb_proc - r) * COUNT + i;
+}
+
+void check_algo(enum reduce_algo algo, int rank, int nb_proc)
+{
+    const char *name = reduce_algo_name(algo);
+    int max[COUNT], sum[COUNT];
+    struct max_loc loc[COUNT];
+
+    for (int i = 0; i < COUNT; i++)
+    {
+        max[i] = sum[i] = value(rank, i);
+        loc[i].value = value(rank, i);
+        loc[i].index = location(rank, nb_proc, i);
+    }
+    reduce_all(max, COUNT, MPI_INT, MPI_MAX, MPI_COMM_WORLD, algo);
+    reduce_all(sum, COUNT, MPI_INT, MPI_SUM, MPI_COMM_WORLD, algo);
+    reduce_all(loc, COUNT, MPI_2INT, MPI_MAXLOC, MPI_COMM_WORLD, algo);
+
+    for (int i = 0; i < COUNT; i++)
+    {
+        int expected_max = INT_MIN, expected_sum = 0, expected_index = INT_MAX;
+        for (int r = 0; r < nb_proc; r++)
+        {
+            expected_max = value(r, i) > expected_max ? value(r, i) : expected_max;
+            expected_sum += value(r, i);
+        }
+        for (int r = 0; r < nb_proc; r++)
+        {
+            if (value(r, i) == expected_max && location(r, nb_proc, i) < expected_index)
+            {
+                expected_index = location(r, nb_proc, i);
+            }
+        }
+        check(max[i] == expected_max, "reduce_all max", name, rank, i);
+        check(sum[i] == expected_sum, "reduce_all sum", name, rank, i);
+        check(loc[i].value == expected_max && loc[i].index == expected_index, "reduce_all argmax", name, rank, i);
+    }
+
+    // reduce towards a root other than 0: only the root has the result
+    int root = nb_proc - 1;
+    for (int i = 0; i < COUNT; i++)
+    {
+        loc[i].value = value(rank, i);
+        loc[i].index = location(rank, nb_proc, i);
+    }
+    reduce(loc, COUNT, MPI_2INT, MPI_MAXLOC, root, MPI_COMM_WORLD, algo);
+    if (rank == root)
+    {
+        for (int i = 0; i < COUNT; i++)
+        {
+            int expected_max = INT_MIN, expected_index = INT_MAX;
+            for (int r = 0; r < nb_proc; r++)
+            {
+                if (value(r, i) > expected_max ||
+                    (value(r, i) == expected_max && location(r, nb_proc, i) < expected_index))
+                {
+                    expected_max = value(r, i);
+                    expected_index = location(r, nb_proc, i);
+                }
+            }
+            check(loc[i].value == expected_max && loc[i].index == expected_index, "reduce argmax", name, rank, i);
+        }
+    }
+}
+
+void check_argmax_array(int rank)
+{
+    int sizes[] = {1, 2, 15, 16, 17, 1000, MAX_OMP_THRESHOLD + 999};
+    int nb_sizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    for (int s = 0; s < nb_sizes; s++)
+    {
+        int size = sizes[s];
+        int *array = generate_array(rank + 1, size, s);
+        for (int offset = 0; offset <= 3 && offset < size; offset += 3)
+        {
+            int expected = offset;
+            for (int i = offset; i < size; i++)
+            {
+                expected = array[i] > array[expected] ? i : expected;
+            }
+            check(argmax_array(array, size, offset) == expected, "argmax_array", max_array_isa(), rank, size);
+        }
+        // ties: the first occurrence wins
+        array[size - 1] = array[0] = INT_MAX;
+        check(argmax_array(array, size, 0) == 0, "argmax_array tie", max_array_isa(), rank, size);
+        free(array);
+    }
+    int empty;
+    check(argmax_array(&empty, 0, 0) == -1, "argmax_array empty", max_array_isa(), rank, 0);
+}
+
+int main(int argc, char **argv)
+{
+    int rank, nb_proc;
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &nb_proc);
+
+    for (int algo = 0; algo < REDUCE_NB_ALGOS; algo++)
+    {
+        check_algo(algo, rank, nb_proc);
+    }
+    check_argmax_array(rank);
+
+    MPI_Allreduce(MPI_IN_PLACE, &failures, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+        printf("test_reduce on %d processes: %s\n", nb_proc, failures ? "FAILED" : "OK");
+    }
+    MPI_Finalize();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,535 @@
+/*
+** nbody_mpi.c - hybrid MPI+OpenMP nbody simulation
+**
+** usage: mpirun -np P nbody_mpi [options] [nparticles [T_FINAL [distribution [seed]]]]
+**
+** The particles are distributed among the MPI ranks, and each rank computes
+** the forces on its particles with OpenMP threads. Run one rank per node (or
+** per socket) and one thread per core: what every rank needs to know (the
+** positions of all the particles, and the tree for barnes_hut) is then
+** replicated once per node instead of once per core.
+**
+** Only the main thread of a rank calls MPI (MPI_THREAD_FUNNELED). The
+** transfers are started before the computations that do not depend on them,
+** and the main thread makes them progress while the threads compute:
+**   brute_force: the blocks of particles circulate on a ring; the interactions
+**                with the current block are computed while the next block
+**                is received.
+**   barnes_hut:  every rank gathers the positions of all the particles, and
+**                its threads build the whole tree; the local particles are
+**                copied while the remote ones are received.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <getopt.h>
+#include <mpi.h>
+#include <omp.h>
+
+#include "nbody.h"
+#include "nbody_tools.h"
+#include "nbody_alloc.h"
+#include "nbody_generators.h"
+#include "libnbody.h"
+
+/* number of particles handed out at once to a thread */
+#define FORCE_CHUNK 64
+/* the main thread tests the pending transfers every PROGRESS_INTERVAL insertions */
+#define PROGRESS_INTERVAL 1024
+
+#define TAG_RING 1
+
+/* what the other ranks need to know about a particle */
+struct body {
+  double x_pos, y_pos;
+  double mass;
+};
+
+struct mpi_sim {
+  struct nbody_params params;
+  int rank, nranks;
+  MPI_Datatype body_type;
+
+  int nparticles;		/* total number of particles still in the simulation */
+  int nlocal;			/* number of particles of this rank */
+  particle_t* particles;	/* particles of this rank */
+  int* ids;			/* ids[i] is the original index of particles[i] */
+  int* counts;			/* number of particles of each rank */
+  int* displs;			/* index of the first particle of each rank */
+  int max_count;		/* initial number of particles of the largest rank */
+
+  /* brute_force: the two blocks of the ring. barnes_hut: all the particles */
+  struct body* bodies;
+
+  /* barnes_hut: copy of all the particles, inserted in the tree */
+  particle_t* tree_particles;
+  node_t* root;
+  struct memory_t mem_node;
+
+  double t, dt;
+  int step;
+  double max_acc, max_speed;
+};
+
+static void usage(const char* name) {
+  fprintf(stderr, "usage: %s [options] [nparticles [T_FINAL [distribution [seed]]]]\n"
+	  "  --engine e   brute_force or barnes_hut (default: barnes_hut)\n"
+	  "  --theta t    opening criterion of barnes_hut (default: 2, 0: exact)\n"
+	  "  --threads t  number of threads per rank (default: OpenMP default)\n"
+	  "  --dump file  write the final particles in file\n", name);
+  MPI_Abort(MPI_COMM_WORLD, 1);
+}
+
+/* number of particles of rank r when n particles are distributed among p ranks */
+static int block_count(int n, int p, int r) {
+  return n/p + (r < n%p ? 1 : 0);
+}
+
+static int block_first(int n, int p, int r) {
+  return r*(n/p) + (r < n%p ? r : n%p);
+}
+
+static void init_sim(struct mpi_sim* s) {
+  MPI_Comm_rank(MPI_COMM_WORLD, &s->rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &s->nranks);
+  MPI_Type_contiguous(3, MPI_DOUBLE, &s->body_type);
+  MPI_Type_commit(&s->body_type);
+
+  int n = s->params.nparticles;
+  int p = s->nranks;
+  s->nparticles = n;
+  s->counts = malloc(sizeof(int)*p);
+  s->displs = malloc(sizeof(int)*p);
+  int r;
+  for(r=0; r<p; r++) {
+    s->counts[r] = block_count(n, p, r);
+    s->displs[r] = block_first(n, p, r);
+  }
+  s->max_count = s->counts[0];
+
+  /* each rank generates its own particles */
+  s->nlocal = s->counts[s->rank];
+  s->particles = malloc(sizeof(particle_t)*s->max_count);
+  s->ids = malloc(sizeof(int)*s->max_count);
+  assert(s->particles && s->ids);
+  generate_particles(s->particles, s->displs[s->rank], s->nlocal, n,
+		     s->params.distribution, s->params.seed);
+  int i;
+  for(i=0; i<s->nlocal; i++) {
+    s->ids[i] = s->displs[s->rank] + i;
+  }
+
+  if(s->params.engine == NBODY_BRUTE_FORCE) {
+    s->bodies = malloc(sizeof(struct body)*2*s->max_count);
+  } else {
+    s->bodies = malloc(sizeof(struct body)*n);
+    s->tree_particles = malloc(sizeof(particle_t)*n);
+    s->root = malloc(sizeof(node_t));
+    assert(s->tree_particles && s->root);
+    mem_init(&s->mem_node, NODE_BLOCK_SIZE, 4*n, 0);
+    init_node(s->root, NULL, XMIN, XMAX, YMIN, YMAX);
+  }
+  assert(s->bodies);
+
+  s->t = 0.0;
+  s->dt = 0.01;
+  s->step = 0;
+  s->max_acc = 0;
+  s->max_speed = 0;
+}
+
+static void pack_bodies(struct mpi_sim* s, struct body* bodies) {
+  int i;
+#pragma omp parallel for schedule(static)
+  for(i=0; i<s->nlocal; i++) {
+    bodies[i].x_pos = s->particles[i].x_pos;
+    bodies[i].y_pos = s->particles[i].y_pos;
+    bodies[i].mass = s->particles[i].mass;
+  }
+}
+
+/* called by all the threads of a parallel region: the main thread makes the
+ * pending requests progress (MPI_THREAD_FUNNELED) */
+static void progress(MPI_Request* reqs, int nreqs, int* done) {
+  if(omp_get_thread_num() == 0 && !*done) {
+    MPI_Testall(nreqs, reqs, done, MPI_STATUSES_IGNORE);
+  }
+}
+
+/* compute the force that body b applies to particle p */
+static void compute_force(particle_t*p, const struct body* b) {
+  double x_sep, y_sep, dist_sq, grav_base;
+
+  x_sep = b->x_pos - p->x_pos;
+  y_sep = b->y_pos - p->y_pos;
+  dist_sq = MAX((x_sep*x_sep) + (y_sep*y_sep), MIN_DIST_SQ);
+
+  /* Use the 2-dimensional gravity rule: F = d * (GMm/d^2) */
+  grav_base = GRAV_CONSTANT*(p->mass)*(b->mass)/dist_sq;
+
+  p->x_force += grav_base*x_sep;
+  p->y_force += grav_base*y_sep;
+}
+
+/*
+  brute_force: the blocks of particles are passed around a ring. At each stage,
+  a rank sends the block it holds to its right neighbour and receives the
+  block of its left neighbour while it computes the interactions of its
+  particles with the block it holds.
+*/
+static void brute_force_forces(struct mpi_sim* s) {
+  int p = s->nranks;
+  int left = (s->rank - 1 + p) % p;
+  int right = (s->rank + 1) % p;
+  struct body* current = s->bodies;
+  struct body* next = s->bodies + s->max_count;
+  int owner = s->rank;
+  int i, stage;
+
+  pack_bodies(s, current);
+  for(i=0; i<s->nlocal; i++) {
+    s->particles[i].x_force = 0;
+    s->particles[i].y_force = 0;
+  }
+
+  for(stage=0; stage<p; stage++) {
+    MPI_Request reqs[2];
+    int nreqs = 0;
+    int done = 1;
+    int next_owner = (owner - 1 + p) % p;
+    if(stage < p-1) {
+      MPI_Irecv(next, s->counts[next_owner], s->body_type, left, TAG_RING,
+		MPI_COMM_WORLD, &reqs[0]);
+      MPI_Isend(current, s->counts[owner], s->body_type, right, TAG_RING,
+		MPI_COMM_WORLD, &reqs[1]);
+      nreqs = 2;
+      done = 0;
+    }
+
+    int ncurrent = s->counts[owner];
+#pragma omp parallel for schedule(dynamic, FORCE_CHUNK)
+    for(i=0; i<s->nlocal; i++) {
+      if(i % FORCE_CHUNK == 0) {
+	progress(reqs, nreqs, &done);
+      }
+      int j;
+      for(j=0; j<ncurrent; j++) {
+	compute_force(&s->particles[i], &current[j]);
+      }
+    }
+
+    if(nreqs) {
+      MPI_Waitall(nreqs, reqs, MPI_STATUSES_IGNORE);
+    }
+    struct body* tmp = current;
+    current = next;
+    next = tmp;
+    owner = next_owner;
+  }
+}
+
+/* set tree_particles[i] to a particle at (x_pos, y_pos) with mass 'mass' */
+static void set_tree_particle(struct mpi_sim* s, int i, double x_pos, double y_pos, double mass) {
+  particle_t* p = &s->tree_particles[i];
+  memset(p, 0, sizeof(particle_t));
+  p->x_pos = x_pos;
+  p->y_pos = y_pos;
+  p->mass = mass;
+}
+
+/* copy the local particles in tree_particles while req is pending. They are
+ * read from s->particles: s->bodies belongs to the collective until it completes */
+static void copy_local_particles(struct mpi_sim* s, MPI_Request* req) {
+  int first = s->displs[s->rank];
+  int done = 0;
+  int k;
+  for(k=0; k<s->nlocal; k++) {
+    particle_t* p = &s->particles[k];
+    set_tree_particle(s, first+k, p->x_pos, p->y_pos, p->mass);
+    if(k % PROGRESS_INTERVAL == 0 && !done) {
+      MPI_Test(req, &done, MPI_STATUS_IGNORE);
+    }
+  }
+}
+
+/*
+  barnes_hut: every rank gathers all the particles and builds the whole tree.
+  The local particles are copied while the others are received, then all the
+  threads build the tree (see build_tree). The tree does not depend on the
+  order in which the particles are inserted, so every rank gets the same tree
+  as the sequential engine.
+*/
+static void barnes_hut_forces(struct mpi_sim* s) {
+  int r, k;
+
+  /* the particles that leave the domain change the counts */
+  MPI_Allgather(&s->nlocal, 1, MPI_INT, s->counts, 1, MPI_INT, MPI_COMM_WORLD);
+  s->displs[0] = 0;
+  for(r=1; r<s->nranks; r++) {
+    s->displs[r] = s->displs[r-1] + s->counts[r-1];
+  }
+
+  pack_bodies(s, &s->bodies[s->displs[s->rank]]);
+  MPI_Request req;
+  MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, s->bodies, s->counts, s->displs,
+		  s->body_type, MPI_COMM_WORLD, &req);
+
+  free_node(s->root, &s->mem_node);
+  init_node(s->root, NULL, XMIN, XMAX, YMIN, YMAX);
+  copy_local_particles(s, &req);
+  MPI_Wait(&req, MPI_STATUS_IGNORE);
+  int n = s->displs[s->nranks-1] + s->counts[s->nranks-1];
+  int first = s->displs[s->rank];
+  int last = first + s->nlocal;
+#pragma omp parallel for schedule(static)
+  for(k=0; k<n; k++) {
+    if(k < first || k >= last) {
+      set_tree_particle(s, k, s->bodies[k].x_pos, s->bodies[k].y_pos, s->bodies[k].mass);
+    }
+  }
+  build_tree(s->tree_particles, n, s->root, &s->mem_node);
+
+  particle_t* local = &s->tree_particles[s->displs[s->rank]];
+  double theta = s->params.theta;
+#pragma omp parallel for schedule(dynamic, FORCE_CHUNK)
+  for(k=0; k<s->nlocal; k++) {
+    particle_t* p = &local[k];
+    compute_force_on_particle(s->root, p, theta, NULL);
+    s->particles[k].x_force = p->x_force;
+    s->particles[k].y_force = p->y_force;
+  }
+}
+
+/* compute the new position/velocity of the local particles */
+static void move_particles(struct mpi_sim* s) {
+  double step = s->dt;
+  double stats[2] = {s->max_acc, s->max_speed};
+  double max_acc = s->max_acc;
+  double max_speed = s->max_speed;
+  int i;
+#pragma omp parallel for schedule(static) reduction(max:max_acc, max_speed)
+  for(i=0; i<s->nlocal; i++) {
+    particle_t* p = &s->particles[i];
+    p->x_pos += (p->x_vel)*step;
+    p->y_pos += (p->y_vel)*step;
+    double x_acc = p->x_force/p->mass;
+    double y_acc = p->y_force/p->mass;
+    p->x_vel += x_acc*step;
+    p->y_vel += y_acc*step;
+
+    double cur_acc = sqrt(x_acc*x_acc + y_acc*y_acc);
+    double cur_speed = sqrt((p->x_vel)*(p->x_vel) + (p->y_vel)*(p->y_vel));
+    max_acc = MAX(max_acc, cur_acc);
+    max_speed = MAX(max_speed, cur_speed);
+  }
+  stats[0] = max_acc;
+  stats[1] = max_speed;
+  MPI_Allreduce(MPI_IN_PLACE, stats, 2, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  s->max_acc = stats[0];
+  s->max_speed = stats[1];
+
+  if(s->params.engine == NBODY_BARNES_HUT) {
+    /* remove the particles that left the domain */
+    int n = 0;
+    for(i=0; i<s->nlocal; i++) {
+      particle_t* p = &s->particles[i];
+      if(p->x_pos < XMIN || p->x_pos > XMAX || p->y_pos < YMIN || p->y_pos > YMAX) {
+	continue;
+      }
+      s->particles[n] = *p;
+      s->ids[n] = s->ids[i];
+      n++;
+    }
+    s->nlocal = n;
+    MPI_Allreduce(&n, &s->nparticles, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  }
+}
+
+static void run(struct mpi_sim* s) {
+  while(s->t < s->params.t_final && s->nparticles > 0) {
+    if(s->params.engine == NBODY_BRUTE_FORCE) {
+      brute_force_forces(s);
+    } else {
+      barnes_hut_forces(s);
+    }
+    move_particles(s);
+
+    s->t += s->dt;
+    s->step++;
+    /* same rule as libnbody: no velocity should change by more than 10% */
+    s->dt = 0.1*s->max_speed/s->max_acc;
+  }
+}
+
+/* gather the particles on rank 0 and print them like the sequential engines */
+static void dump_particles(struct mpi_sim* s, const char* filename) {
+  int r;
+  int* counts = malloc(sizeof(int)*s->nranks);
+  int* byte_counts = malloc(sizeof(int)*s->nranks);
+  int* displs = malloc(sizeof(int)*s->nranks);
+  int* byte_displs = malloc(sizeof(int)*s->nranks);
+  MPI_Gather(&s->nlocal, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+  int n = 0;
+  if(s->rank == 0) {
+    for(r=0; r<s->nranks; r++) {
+      displs[r] = n;
+      byte_counts[r] = counts[r]*sizeof(particle_t);
+      byte_displs[r] = n*sizeof(particle_t);
+      n += counts[r];
+    }
+  }
+  particle_t* all = s->rank == 0 ? malloc(sizeof(particle_t)*MAX(n, 1)) : NULL;
+  int* ids = s->rank == 0 ? malloc(sizeof(int)*MAX(n, 1)) : NULL;
+  MPI_Gatherv(s->particles, s->nlocal*sizeof(particle_t), MPI_BYTE,
+	      all, byte_counts, byte_displs, MPI_BYTE, 0, MPI_COMM_WORLD);
+  MPI_Gatherv(s->ids, s->nlocal, MPI_INT, ids, counts, displs, MPI_INT, 0, MPI_COMM_WORLD);
+
+  if(s->rank == 0) {
+    FILE* f = fopen(filename, "w");
+    if(!f) {
+      perror(filename);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    int i;
+    if(s->params.engine == NBODY_BRUTE_FORCE) {
+      /* original order */
+      int* slot = malloc(sizeof(int)*s->params.nparticles);
+      for(i=0; i<n; i++) {
+	slot[ids[i]] = i;
+      }
+      for(i=0; i<n; i++) {
+	particle_t* p = &all[slot[i]];
+	fprintf(f, "particle={pos=(%f,%f), vel=(%f,%f)}\n", p->x_pos, p->y_pos, p->x_vel, p->y_vel);
+      }
+      free(slot);
+    } else {
+      /* tree order */
+      free_node(s->root, &s->mem_node);
+      init_node(s->root, NULL, XMIN, XMAX, YMIN, YMAX);
+      for(i=0; i<n; i++) {
+	all[i].node = NULL;
+	insert_particle(&all[i], s->root, &s->mem_node);
+      }
+      print_particles(f, s->root);
+    }
+    fclose(f);
+  }
+  free(all);
+  free(ids);
+  free(counts);
+  free(byte_counts);
+  free(displs);
+  free(byte_displs);
+}
+
+static void finalize_sim(struct mpi_sim* s) {
+  if(s->root) {
+    free_node(s->root, &s->mem_node);
+    free(s->root);
+    mem_destroy(&s->mem_node);
+  }
+  free(s->tree_particles);
+  free(s->bodies);
+  free(s->particles);
+  free(s->ids);
+  free(s->counts);
+  free(s->displs);
+  MPI_Type_free(&s->body_type);
+}
+
+int main(int argc, char**argv) {
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+  if(provided < MPI_THREAD_FUNNELED) {
+    fprintf(stderr, "The MPI library does not support MPI_THREAD_FUNNELED\n");
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  static struct option options[] = {
+    {"engine", required_argument, NULL, 'e'},
+    {"theta", required_argument, NULL, 'o'},
+    {"threads", required_argument, NULL, 't'},
+    {"dump", required_argument, NULL, 'd'},
+    {NULL, 0, NULL, 0}
+  };
+  struct mpi_sim s;
+  memset(&s, 0, sizeof(s));
+  nbody_default_params(&s.params);
+  const char* dump_file = NULL;
+
+  int opt, value;
+  while((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch(opt) {
+    case 'e':
+      value = nbody_parse_engine(optarg);
+      if(value != NBODY_BRUTE_FORCE && value != NBODY_BARNES_HUT) {
+	fprintf(stderr, "Unsupported engine '%s'\n", optarg);
+	MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+      s.params.engine = value;
+      break;
+    case 'o':
+      s.params.theta = atof(optarg);
+      break;
+    case 't':
+      s.params.nthreads = atoi(optarg);
+      break;
+    case 'd':
+      dump_file = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  /* positional arguments */
+  argc -= optind-1;
+  argv += optind-1;
+  if(argc >= 2) {
+    s.params.nparticles = atoi(argv[1]);
+  }
+  if(argc >= 3) {
+    s.params.t_final = atof(argv[2]);
+  }
+  if(argc >= 4) {
+    s.params.distribution = parse_distribution(argv[3]);
+    if(s.params.distribution < 0) {
+      fprintf(stderr, "Unknown distribution '%s'\n", argv[3]);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+  if(argc >= 5) {
+    s.params.seed = strtoull(argv[4], NULL, 10);
+  }
+  if(s.params.nthreads > 0) {
+    omp_set_num_threads(s.params.nthreads);
+  }
+
+  init_sim(&s);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  double t1 = MPI_Wtime();
+  run(&s);
+  double duration = MPI_Wtime() - t1;
+
+  if(dump_file) {
+    dump_particles(&s, dump_file);
+  }
+
+  if(s.rank == 0) {
+    printf("-----------------------------\n");
+    printf("nparticles: %d\n", s.nparticles);
+    printf("T_FINAL: %f\n", s.params.t_final);
+    printf("distribution: %s (seed %llu)\n", distribution_name(s.params.distribution), s.params.seed);
+    printf("ranks: %d, threads per rank: %d\n", s.nranks, omp_get_max_threads());
+    printf("-----------------------------\n");
+    printf("Simulation took %lf s to complete\n", duration);
+  }
+
+  finalize_sim(&s);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,360 @@
+/*
+** libnbody.c - simulation contexts and main loop, shared by all the engines
+**
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "nbody.h"
+#include "nbody_sim.h"
+#include "nbody_generators.h"
+#include "nbody_diagnostics.h"
+#include "nbody_checkpoint.h"
+#include "libnbody.h"
+
+static const struct nbody_engine_ops* engines[NBODY_NB_ENGINES] = {
+  [NBODY_BRUTE_FORCE] = &brute_force_engine,
+  [NBODY_BARNES_HUT] = &barnes_hut_engine,
+  [NBODY_TREEPM] = &treepm_engine,
+};
+
+static const char* kernel_names[NBODY_NB_KERNELS] = {
+  [NBODY_KERNEL_SCALAR] = "scalar",
+  [NBODY_KERNEL_SIMD] = "simd",
+  [NBODY_KERNEL_FLOAT] = "float",
+};
+
+void nbody_default_params(struct nbody_params* params) {
+  params->engine = NBODY_BARNES_HUT;
+  params->nparticles = 10;
+  params->t_final = 1.0;
+  params->distribution = DIST_LINE;
+  params->seed = 0;
+  params->nthreads = 0;
+  params->reorder_interval = 0;
+  params->diag_interval = 0;
+  params->diag_file = NULL;
+  params->trajectory_file = NULL;
+  params->trajectory_interval = 0;
+  params->checkpoint_file = NULL;
+  params->checkpoint_interval = 0;
+  params->pm_grid = 256;
+  params->theta = 2;
+  params->kernel = NBODY_KERNEL_SCALAR;
+  params->huge_pages = 0;
+  params->chunk = 64;
+}
+
+int nbody_parse_engine(const char* name) {
+  int i;
+  for(i=0; i<NBODY_NB_ENGINES; i++) {
+    if(strcmp(name, engines[i]->name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+const char* nbody_engine_name(enum nbody_engine engine) {
+  return engines[engine]->name;
+}
+
+int nbody_parse_kernel(const char* name) {
+  int i;
+  for(i=0; i<NBODY_NB_KERNELS; i++) {
+    if(strcmp(name, kernel_names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+const char* nbody_kernel_name(enum nbody_kernel kernel) {
+  return kernel_names[kernel];
+}
+
+/*
+  The parallel regions of a simulation use the thread pool of the calling
+  thread, limited to params.nthreads threads. Return the previous limit so
+  that it can be restored.
+*/
+static int enter_thread_pool(nbody_sim_t* sim) {
+  int prev = omp_get_max_threads();
+  if(sim->params.nthreads > 0) {
+    omp_set_num_threads(sim->params.nthreads);
+  }
+  return prev;
+}
+
+static void leave_thread_pool(int prev) {
+  omp_set_num_threads(prev);
+}
+
+static int alloc_flags(const nbody_sim_t* sim) {
+  return sim->params.huge_pages ? MEM_HUGE_PAGES : 0;
+}
+
+/*
+  The particle arrays are mapped without being touched: their pages are
+  placed by the threads that initialize them, in schedule(static) loops,
+  like the loops that move the particles.
+*/
+void alloc_particles(nbody_sim_t* sim) {
+  size_t n = sim->params.nparticles;
+  sim->particles = mem_alloc_pages(sizeof(particle_t)*n, alloc_flags(sim));
+  sim->particle_ids = mem_alloc_pages(sizeof(int)*n, alloc_flags(sim));
+  assert(sim->particles && sim->particle_ids);
+}
+
+void free_particles(nbody_sim_t* sim) {
+  size_t n = sim->params.nparticles;
+  mem_free_pages(sim->particles, sizeof(particle_t)*n, alloc_flags(sim));
+  mem_free_pages(sim->particle_ids, sizeof(int)*n, alloc_flags(sim));
+  sim->particles = NULL;
+  sim->particle_ids = NULL;
+}
+
+/* queue the current state in the trajectory file */
+static void write_trajectory_frame(nbody_sim_t* sim) {
+  sim->engine->mark_alive(sim, sim->alive);
+  trajectory_snapshot(sim->trajectory, sim->step, sim->t,
+		      sim->particles, sim->particle_ids, sim->alive, sim->nslots);
+}
+
+int nbody_valid_params(const struct nbody_params* params) {
+  return (params->engine >= 0 && params->engine < NBODY_NB_ENGINES &&
+	  params->distribution >= 0 && params->distribution < NB_DISTRIBUTIONS &&
+	  params->nparticles > 0 &&
+	  params->kernel >= 0 && params->kernel < NBODY_NB_KERNELS &&
+	  params->theta >= 0 &&
+	  params->chunk > 0 &&
+	  (params->engine != NBODY_TREEPM ||
+	   (params->pm_grid >= 16 && (params->pm_grid & (params->pm_grid-1)) == 0)));
+}
+
+/* build the engine data structures and open the outputs of a context whose
+ * particles are initialized. A restarted simulation continues its trajectory
+ * file instead of truncating it. Return NULL (and destroy sim) on error */
+static nbody_sim_t* start_simulation(nbody_sim_t* sim, int restarted) {
+  int prev = enter_thread_pool(sim);
+  sim->engine = engines[sim->params.engine];
+  sim->engine->init(sim);
+
+  if(!sim->alive) {
+    sim->alive = malloc(sim->params.nparticles);
+    assert(sim->alive);
+  }
+
+  if(sim->params.trajectory_file && sim->params.trajectory_interval > 0) {
+    if(restarted) {
+      sim->trajectory = trajectory_append(sim->params.trajectory_file, sim->params.nparticles, sim->step);
+    } else {
+      sim->trajectory = trajectory_open(sim->params.trajectory_file, sim->params.nparticles);
+    }
+    if(!sim->trajectory) {
+      perror(sim->params.trajectory_file);
+      leave_thread_pool(prev);
+      nbody_destroy(sim);
+      return NULL;
+    }
+    write_trajectory_frame(sim);
+  }
+
+  leave_thread_pool(prev);
+  return sim;
+}
+
+nbody_sim_t* nbody_create(const struct nbody_params* params) {
+  if(!nbody_valid_params(params)) {
+    return NULL;
+  }
+
+  nbody_sim_t* sim = calloc(1, sizeof(nbody_sim_t));
+  assert(sim);
+  sim->params = *params;
+
+  sim->nparticles = params->nparticles;
+  sim->nslots = params->nparticles;
+  sim->t = 0.0;
+  sim->dt = 0.01;
+
+  int prev = enter_thread_pool(sim);
+
+  /* Allocate the arrays for the particles data set. */
+  alloc_particles(sim);
+  int i;
+#pragma omp parallel for schedule(static)
+  for(i=0; i<sim->nparticles; i++) {
+    sim->particle_ids[i] = i;
+  }
+  generate_particles(sim->particles, 0, sim->nparticles, sim->nparticles,
+		     params->distribution, params->seed);
+
+  leave_thread_pool(prev);
+  return start_simulation(sim, 0);
+}
+
+nbody_sim_t* nbody_restart(const char* filename, const struct nbody_params* params) {
+  nbody_sim_t* sim = calloc(1, sizeof(nbody_sim_t));
+  assert(sim);
+  sim->params = *params;
+
+  if(checkpoint_read(sim, filename) || !nbody_valid_params(&sim->params)) {
+    free_particles(sim);
+    free(sim->alive);
+    free(sim);
+    return NULL;
+  }
+  return start_simulation(sim, 1);
+}
+
+int nbody_done(const nbody_sim_t* sim) {
+  return !(sim->t < sim->params.t_final && sim->nparticles>0);
+}
+
+int nbody_step(nbody_sim_t* sim) {
+  if(nbody_done(sim)) {
+    return 0;
+  }
+  int prev = enter_thread_pool(sim);
+
+  sim->compute_diag = (sim->params.diag_interval > 0 &&
+		       sim->step % sim->params.diag_interval == 0);
+
+  /* Move particles with the current and compute rms velocity. */
+  sim->engine->compute_forces(sim);
+  sim->engine->move_particles(sim, sim->dt);
+  if(sim->compute_diag) {
+    sim->has_diag = 1;
+    if(sim->params.diag_file) {
+      print_diagnostics(sim->params.diag_file, sim->step, sim->t, &sim->diag);
+    }
+  }
+  /* Update time. */
+  sim->t += sim->dt;
+  sim->step++;
+
+  /* Adjust dt based on maximum speed and acceleration--this
+     simple rule tries to insure that no velocity will change
+     by more than 10% */
+  sim->dt = 0.1*sim->max_speed/sim->max_acc;
+
+  if(sim->params.reorder_interval > 0 &&
+     sim->step % sim->params.reorder_interval == 0) {
+    sim->engine->reorder(sim);
+  }
+
+  if(sim->trajectory &&
+     sim->step % sim->params.trajectory_interval == 0) {
+    write_trajectory_frame(sim);
+  }
+
+  if(sim->params.checkpoint_file && sim->params.checkpoint_interval > 0 &&
+     sim->step % sim->params.checkpoint_interval == 0) {
+    /* only one checkpoint is written at a time */
+    if(sim->checkpoint_pid > 0 && checkpoint_wait(sim->checkpoint_pid)) {
+      fprintf(stderr, "Failed to write checkpoint %s\n", sim->params.checkpoint_file);
+    }
+    sim->checkpoint_pid = checkpoint_fork(sim, sim->params.checkpoint_file);
+  }
+
+  leave_thread_pool(prev);
+  return 1;
+}
+
+void nbody_compute_forces(nbody_sim_t* sim) {
+  int prev = enter_thread_pool(sim);
+  sim->compute_diag = 0;
+  sim->engine->compute_forces(sim);
+  leave_thread_pool(prev);
+}
+
+void nbody_run(nbody_sim_t* sim) {
+  while(nbody_step(sim)) {
+    ;
+  }
+}
+
+void nbody_destroy(nbody_sim_t* sim) {
+  if(!sim) return;
+  if(sim->checkpoint_pid > 0 && checkpoint_wait(sim->checkpoint_pid)) {
+    fprintf(stderr, "Failed to write checkpoint %s\n", sim->params.checkpoint_file);
+  }
+  if(trajectory_close(sim->trajectory)) {
+    fprintf(stderr, "Failed to write trajectory %s\n", sim->params.trajectory_file);
+  }
+  free(sim->alive);
+  sim->engine->finalize(sim);
+  free_particles(sim);
+  free(sim);
+}
+
+int nbody_nparticles(const nbody_sim_t* sim) {
+  return sim->nparticles;
+}
+
+double nbody_time(const nbody_sim_t* sim) {
+  return sim->t;
+}
+
+int nbody_steps(const nbody_sim_t* sim) {
+  return sim->step;
+}
+
+void nbody_get_params(const nbody_sim_t* sim, struct nbody_params* params) {
+  *params = sim->params;
+}
+
+int nbody_get_diagnostics(const nbody_sim_t* sim, struct diagnostics* d) {
+  if(!sim->has_diag) {
+    return 0;
+  }
+  *d = sim->diag;
+  return 1;
+}
+
+int nbody_get_particles(nbody_sim_t* sim, struct nbody_particle* particles) {
+  sim->engine->mark_alive(sim, sim->alive);
+  int i, n = 0;
+  for(i=0; i<sim->nslots; i++) {
+    if(!sim->alive[i]) {
+      continue;
+    }
+    particle_t* p = &sim->particles[i];
+    particles[n].id = sim->particle_ids[i];
+    particles[n].x_pos = p->x_pos;
+    particles[n].y_pos = p->y_pos;
+    particles[n].x_vel = p->x_vel;
+    particles[n].y_vel = p->y_vel;
+    particles[n].x_force = p->x_force;
+    particles[n].y_force = p->y_force;
+    particles[n].mass = p->mass;
+    n++;
+  }
+  return n;
+}
+
+void nbody_print_placement(nbody_sim_t* sim, FILE* f) {
+  struct mem_placement pl;
+  size_t n = sim->params.nparticles;
+  mem_placement(sim->particles, sizeof(particle_t)*n, &pl);
+  mem_print_placement(f, "particles", &pl);
+  mem_placement(sim->particle_ids, sizeof(int)*n, &pl);
+  mem_print_placement(f, "particle_ids", &pl);
+  if(sim->root) {
+    mem_placement(sim->mem_node.zone, sim->mem_node.zone_size, &pl);
+    mem_print_placement(f, "tree nodes", &pl);
+  }
+}
+
+void nbody_print_particles(nbody_sim_t* sim, FILE* f) {
+  sim->engine->print_particles(sim, f);
+}
+
+void nbody_draw(nbody_sim_t* sim, int draw_boxes) {
+  sim->engine->draw(sim, draw_boxes);
+}
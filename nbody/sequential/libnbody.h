@@ -0,0 +1,152 @@
+#ifndef LIBNBODY_H
+#define LIBNBODY_H
+#include <stdio.h>
+#include "nbody_diagnostics.h"
+
+/*
+  libnbody - reentrant interface to the nbody simulation engines.
+
+  All the state of a simulation is held by a context (nbody_sim_t), so several
+  simulations can live in the same process. The parallel regions of a
+  simulation run on the OpenMP thread pool of the thread that calls
+  nbody_step/nbody_run, limited to params.nthreads threads: simulations driven
+  by different threads run concurrently on separate thread pools.
+  A context must not be used by two threads at the same time.
+*/
+
+typedef struct nbody_sim nbody_sim_t;
+
+enum nbody_engine {
+  NBODY_BRUTE_FORCE,		/* O(n*n) */
+  NBODY_BARNES_HUT,		/* O(n*log(n)) */
+  NBODY_TREEPM,			/* Barnes-Hut for the short-range forces, particle-mesh for the long-range forces */
+  NBODY_NB_ENGINES
+};
+
+/* variant of the force kernel of the brute-force engine */
+enum nbody_kernel {
+  NBODY_KERNEL_SCALAR,		/* reference kernel */
+  NBODY_KERNEL_SIMD,		/* vectorized, double precision */
+  NBODY_KERNEL_FLOAT,		/* vectorized, single precision */
+  NBODY_NB_KERNELS
+};
+
+struct nbody_params {
+  enum nbody_engine engine;
+  int nparticles;		/* number of particles to simulate */
+  double t_final;		/* simulation end time */
+  int distribution;		/* initial distribution (see nbody_generators.h) */
+  unsigned long long seed;	/* seed of the initial distribution */
+  int nthreads;			/* number of threads, 0 for the OpenMP default */
+  int reorder_interval;		/* sort the particles every reorder_interval steps (0: never) */
+  int diag_interval;		/* compute the diagnostics every diag_interval steps (0: never) */
+  FILE* diag_file;		/* where to print the diagnostics (NULL: don't print them) */
+  const char* trajectory_file;	/* where to write the trajectory (NULL: don't write it) */
+  int trajectory_interval;	/* write a frame of the trajectory every trajectory_interval steps */
+  const char* checkpoint_file;	/* where to write the checkpoints (NULL: no checkpoint) */
+  int checkpoint_interval;	/* write a checkpoint every checkpoint_interval steps */
+  int pm_grid;			/* TreePM: size of the mesh (power of 2, at least 16) */
+  double theta;			/* Barnes-Hut/TreePM: a node is approximated by its center of mass
+				 * when size/distance < theta (0: exact) */
+  enum nbody_kernel kernel;	/* brute force: force kernel */
+  int huge_pages;		/* back the particles and the tree with huge pages */
+  int chunk;			/* Barnes-Hut/TreePM: number of particles handed out at once to a thread */
+};
+
+/* a particle, as returned by nbody_get_particles */
+struct nbody_particle {
+  int id;			/* index of the particle in the initial distribution */
+  double x_pos, y_pos;
+  double x_vel, y_vel;
+  double x_force, y_force;	/* forces computed by the last step or by nbody_compute_forces */
+  double mass;
+};
+
+/* fill params with the default values */
+void nbody_default_params(struct nbody_params* params);
+
+/* return the engine named 'name', or -1 if there is no such engine */
+int nbody_parse_engine(const char* name);
+const char* nbody_engine_name(enum nbody_engine engine);
+
+/* return the kernel named 'name', or -1 if there is no such kernel */
+int nbody_parse_kernel(const char* name);
+const char* nbody_kernel_name(enum nbody_kernel kernel);
+
+/* return 1 if params describe a simulation that nbody_create accepts */
+int nbody_valid_params(const struct nbody_params* params);
+
+/* create a simulation and place the particles in their initial positions.
+ * Return NULL if the parameters are invalid or the trajectory file cannot be opened */
+nbody_sim_t* nbody_create(const struct nbody_params* params);
+
+/*
+  Create a simulation from a checkpoint written with params.checkpoint_file.
+  The engine, the particles and the parameters that the trajectory depends on
+  (nparticles, distribution, seed, reorder_interval, pm_grid, theta, kernel)
+  come from the checkpoint;
+  the others (t_final, nthreads, outputs...) come from params.
+  The trajectory file is continued: the frames it has before the checkpoint
+  are kept (see trajectory_append).
+  Return NULL if the checkpoint cannot be read or the trajectory file cannot
+  be continued.
+*/
+nbody_sim_t* nbody_restart(const char* filename, const struct nbody_params* params);
+
+/*
+  Choose theta, chunk and reorder_interval for the Barnes-Hut or TreePM engine
+  described by params: the fastest configuration whose rms relative error on
+  the forces of the initial conditions is below error_bound. The calibration
+  runs the engine for a few steps; its result is cached in cache_file (unless
+  it is NULL) for this machine and problem, so that the next runs reuse it.
+  The progress of the calibration is printed in log (unless it is NULL).
+  Return -1 if the engine cannot be tuned or params are invalid.
+*/
+int nbody_autotune(struct nbody_params* params, double error_bound,
+		   const char* cache_file, FILE* log);
+
+/* return 1 once the simulation is over */
+int nbody_done(const nbody_sim_t* sim);
+
+/* move the particles one time step. Return 0 if the simulation was already over */
+int nbody_step(nbody_sim_t* sim);
+
+/* compute the forces on the particles at their current position, without moving them */
+void nbody_compute_forces(nbody_sim_t* sim);
+
+/* run the simulation until t_final is reached or there is no particle left */
+void nbody_run(nbody_sim_t* sim);
+
+void nbody_destroy(nbody_sim_t* sim);
+
+/* number of particles still in the simulation */
+int nbody_nparticles(const nbody_sim_t* sim);
+/* current simulation time */
+double nbody_time(const nbody_sim_t* sim);
+/* number of steps done so far */
+int nbody_steps(const nbody_sim_t* sim);
+
+/* copy the parameters of sim into params: after nbody_restart, the ones that
+ * come from the checkpoint (distribution, seed...) */
+void nbody_get_params(const nbody_sim_t* sim, struct nbody_params* params);
+
+/* copy the last diagnostics computed into d.
+ * Return 0 if no diagnostics were computed yet */
+int nbody_get_diagnostics(const nbody_sim_t* sim, struct diagnostics* d);
+
+/* copy the particles still in the simulation in particles, which must have
+ * room for nbody_nparticles(sim) entries. Return the number of particles */
+int nbody_get_particles(nbody_sim_t* sim, struct nbody_particle* particles);
+
+/* print where the pages of the particles and of the tree are: number of
+ * pages on each NUMA node, and amount of memory backed by huge pages */
+void nbody_print_placement(nbody_sim_t* sim, FILE* f);
+
+/* print the particles in f */
+void nbody_print_particles(nbody_sim_t* sim, FILE* f);
+
+/* draw the particles in the X window opened with simple_init (see ui.h).
+ * If draw_boxes is set, the nodes of the Barnes-Hut tree are drawn too */
+void nbody_draw(nbody_sim_t* sim, int draw_boxes);
+
+#endif	/* LIBNBODY_H */
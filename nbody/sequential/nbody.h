@@ -32,11 +32,6 @@ typedef struct node {
 } node_t;
 
 
-extern int nparticles;		/* number of particles to simulate */
-
-/* used for debugging the display of the Barnes-Hut application */
-#define DRAW_BOXES 0
-
 #define DISPLAY_SIZE       512      /* pixel size of display window */
 #define SCALE               0.03    /* sets the magnification at the origin */
                                     /* smaller #'s zoom in */
@@ -49,6 +44,8 @@ extern int nparticles;		/* number of particles to simulate */
 #define STEPS_PER_DISPLAY   10      /* time steps between display of fish */
 #define GRAV_CONSTANT       0.01    /* proportionality constant of
                                        gravitational interaction */
+#define MIN_DIST_SQ         0.01    /* the force between two particles is
+                                       softened below this squared distance */
 
 #define POS_TO_SCREEN(pos)   ((int) ((pos/SCALE + DISPLAY_SIZE)/2))
 
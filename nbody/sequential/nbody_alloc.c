@@ -2,44 +2,102 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include "nbody_alloc.h"
 
+/* number of pages whose node is queried at once */
+#define PLACEMENT_BATCH 1024
+
 /**************************************************************************/
 /* Routine d'initialisation de l'allocateur : constitue une liste chainee */
 /* de nbMaxAlloc blocs de taille TAILLEBLOC, le premier bloc etant pointe */
 /* par debutListe et le dernier pointant sur NULL                         */
 /**************************************************************************/
-void mem_init(struct memory_t *mem, size_t block_size, int nb_blocks)
+void mem_init(struct memory_t *mem, size_t block_size, int nb_blocks, int flags)
 {
-  Bloc *ptr;
+  char *ptr;
   int i;
 
-  /* ATTENTION : vous n'avez droit de faire qu'un seul malloc de */
-  /*             nbMaxAlloc*TAILLEBLOC ou bien un calloc !       */
-  /* On alloue un unique bloc avec calloc. On y decoupera nos blocs */
-  ptr = calloc(nb_blocks, block_size);
+  /* On alloue une unique zone de pages. On y decoupera nos blocs */
+  size_t alloc_size = (size_t) nb_blocks*block_size;
+  ptr = mem_alloc_pages(alloc_size, flags);
   assert(ptr != 0);
 
   /* Memorisation du debut de la liste chainee */
-  mem->debutListe = ptr;
+  mem->zone = ptr;
+  mem->debutListe = (Bloc*) ptr;
   mem->block_size = block_size;
   mem->nb_free = nb_blocks;
+  mem->zone_size = alloc_size;
+  mem->flags = flags;
+  mem->shared = NULL;
 
-  /* Decoupage du bloc retourne par malloc en nbMaxBloc constituant une liste*/
-  /* chainee                                                                 */
-  char* block_ptr = (char*)ptr;
-  Bloc*p = (Bloc*)block_ptr;
-  for (i=0 ; i<(nb_blocks-1) ; i++) {
-    p = (Bloc*) block_ptr;
-    block_ptr += block_size;
-    p->suivant = (Bloc*) block_ptr;
+  /* Decoupage de la zone en nbMaxBloc constituant une liste chainee. */
+  /* Chaque thread chaine (et donc touche en premier) sa part des blocs */
+  /* Le dernier bloc a son pointeur a NULL */
+#pragma omp parallel for schedule(static)
+  for (i=0 ; i<nb_blocks ; i++) {
+    Bloc *p = (Bloc*) (ptr + (size_t) i*block_size);
+    p->suivant = (i < nb_blocks-1) ? (Bloc*) (ptr + (size_t) (i+1)*block_size) : NULL;
   }
+}
 
-  size_t alloc_size = nb_blocks*block_size;
-  char* end_addr = (char*) mem->debutListe;
-  end_addr += alloc_size;
-  /* Le dernier bloc a son pointeur a NULL */
-  p->suivant = NULL;
+/* move the first MEM_BATCH_SIZE free blocks of the shared pool to the empty local pool */
+static void mem_borrow(struct memory_t* local)
+{
+  struct memory_t* shared = local->shared;
+#pragma omp critical (mem_shared)
+  {
+    Bloc* first = shared->debutListe;
+    Bloc* last = first;
+    unsigned nb = 0;
+    if(first) {
+      nb = 1;
+      while(nb < MEM_BATCH_SIZE && last->suivant) {
+	last = last->suivant;
+	nb++;
+      }
+      shared->debutListe = last->suivant;
+      last->suivant = NULL;
+    }
+    shared->nb_free -= nb;
+    local->debutListe = first;
+    local->nb_free = nb;
+  }
+}
+
+void mem_init_local(struct memory_t *local, struct memory_t *shared)
+{
+  local->zone = NULL;
+  local->debutListe = NULL;
+  local->block_size = shared->block_size;
+  local->nb_free = 0;
+  local->zone_size = 0;
+  local->flags = 0;
+  local->shared = shared;
+}
+
+void mem_release_local(struct memory_t *local)
+{
+  struct memory_t* shared = local->shared;
+  Bloc* last = local->debutListe;
+  if(!last) {
+    return;
+  }
+  while(last->suivant) {
+    last = last->suivant;
+  }
+#pragma omp critical (mem_shared)
+  {
+    last->suivant = shared->debutListe;
+    shared->debutListe = local->debutListe;
+    shared->nb_free += local->nb_free;
+  }
+  local->debutListe = NULL;
+  local->nb_free = 0;
 }
 
 /**************************************************************************/
@@ -50,6 +108,9 @@ void mem_init(struct memory_t *mem, size_t block_size, int nb_blocks)
 void *mem_alloc(struct memory_t*mem)
 {
   Bloc *ptr;
+  if(mem->debutListe == NULL && mem->shared) {
+    mem_borrow(mem);
+  }
   assert(mem->debutListe != NULL);
 
   ptr = mem->debutListe;
@@ -70,3 +131,171 @@ void mem_free(struct memory_t* mem, void *ptr)
   mem->debutListe = pBloc;
   mem->nb_free++;
 }
+
+/**************************************************************************/
+/* Fonction liberant la zone memoire de l'allocateur                      */
+/**************************************************************************/
+void mem_destroy(struct memory_t* mem)
+{
+  mem_free_pages(mem->zone, mem->zone_size, mem->flags);
+  mem->zone = NULL;
+  mem->debutListe = NULL;
+  mem->nb_free = 0;
+}
+
+/* size of the mapping that holds size bytes */
+static size_t mapping_size(size_t size, int flags) {
+  size_t unit = (flags & MEM_HUGE_PAGES) ? MEM_HUGE_PAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE);
+  if(size == 0) {
+    size = 1;
+  }
+  return (size + unit - 1)/unit*unit;
+}
+
+void* mem_alloc_pages(size_t size, int flags) {
+  size_t len = mapping_size(size, flags);
+  void* ptr;
+
+  if(flags & MEM_HUGE_PAGES) {
+#ifdef MAP_HUGETLB
+    /* fails unless huge pages are reserved (vm.nr_hugepages) */
+    ptr = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if(ptr != MAP_FAILED) {
+      return ptr;
+    }
+#endif
+    /* transparent huge pages: they need a 2MB-aligned area, so map one
+     * more huge page and trim the ends */
+    char* area = mmap(NULL, len + MEM_HUGE_PAGE_SIZE, PROT_READ|PROT_WRITE,
+		      MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(area == MAP_FAILED) {
+      return NULL;
+    }
+    char* start = (char*) (((uintptr_t) area + MEM_HUGE_PAGE_SIZE - 1) & ~(MEM_HUGE_PAGE_SIZE - 1));
+    if(start > area) {
+      munmap(area, start - area);
+    }
+    munmap(start + len, area + MEM_HUGE_PAGE_SIZE - start);
+#ifdef MADV_HUGEPAGE
+    madvise(start, len, MADV_HUGEPAGE);
+#endif
+    return start;
+  }
+
+  ptr = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+void mem_free_pages(void* ptr, size_t size, int flags) {
+  if(ptr) {
+    munmap(ptr, mapping_size(size, flags));
+  }
+}
+
+void mem_first_touch(void* ptr, size_t size) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  char* start = (char*) ((uintptr_t) ptr & ~(page - 1));
+  long nb_pages = ((char*) ptr + size - start + page - 1)/page;
+  long i;
+#pragma omp parallel for schedule(static)
+  for(i=0; i<nb_pages; i++) {
+    /* the first bytes of a page may belong to another array */
+    volatile char* c = start + i*page;
+    *c = *c;
+  }
+}
+
+/* number of bytes of [start, end) backed by huge pages, according to /proc/self/smaps */
+static size_t huge_size(uintptr_t start, uintptr_t end) {
+  FILE* f = fopen("/proc/self/smaps", "r");
+  if(!f) {
+    return 0;
+  }
+  char line[256];
+  int inside = 0;
+  size_t kernel_page = 0, rss = 0, anon_huge = 0, total = 0;
+  unsigned long first, last, value;
+  while(fgets(line, sizeof(line), f)) {
+    if(sscanf(line, "%lx-%lx ", &first, &last) == 2) {
+      /* a new mapping starts */
+      if(inside) {
+	total += kernel_page > (size_t) sysconf(_SC_PAGESIZE) ? rss : anon_huge;
+      }
+      inside = (first < end && last > start);
+      kernel_page = rss = anon_huge = 0;
+    } else if(inside) {
+      if(sscanf(line, "KernelPageSize: %lu kB", &value) == 1) {
+	kernel_page = value*1024;
+      } else if(sscanf(line, "Rss: %lu kB", &value) == 1) {
+	rss = value*1024;
+      } else if(sscanf(line, "AnonHugePages: %lu kB", &value) == 1) {
+	anon_huge = value*1024;
+      }
+    }
+  }
+  if(inside) {
+    total += kernel_page > (size_t) sysconf(_SC_PAGESIZE) ? rss : anon_huge;
+  }
+  fclose(f);
+  return total;
+}
+
+int mem_placement(const void* ptr, size_t size, struct mem_placement* pl) {
+  memset(pl, 0, sizeof(struct mem_placement));
+  if(!ptr) {
+    return 0;
+  }
+  size_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t) ptr & ~(page - 1);
+  uintptr_t end = (uintptr_t) ptr + size;
+  pl->nb_pages = (end - start + page - 1)/page;
+  pl->huge_size = huge_size(start, end);
+
+#ifdef SYS_move_pages
+  void* pages[PLACEMENT_BATCH];
+  int status[PLACEMENT_BATCH];
+  size_t first;
+  for(first=0; first<pl->nb_pages; first+=PLACEMENT_BATCH) {
+    size_t count = pl->nb_pages - first;
+    if(count > PLACEMENT_BATCH) {
+      count = PLACEMENT_BATCH;
+    }
+    size_t k;
+    for(k=0; k<count; k++) {
+      pages[k] = (void*) (start + (first+k)*page);
+    }
+    /* with nodes == NULL, move_pages only reports the node of each page */
+    if(syscall(SYS_move_pages, 0, count, pages, NULL, status, 0) != 0) {
+      pl->nb_nodes = 0;
+      return -1;
+    }
+    for(k=0; k<count; k++) {
+      if(status[k] >= 0 && status[k] < MEM_MAX_NODES) {
+	pl->node_pages[status[k]]++;
+	if(status[k] >= pl->nb_nodes) {
+	  pl->nb_nodes = status[k]+1;
+	}
+      } else {
+	pl->absent_pages++;
+      }
+    }
+  }
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+void mem_print_placement(FILE* f, const char* name, const struct mem_placement* pl) {
+  fprintf(f, "%-12s %8zu pages, %7.1f MB in huge pages", name, pl->nb_pages,
+	  pl->huge_size/(1024.*1024));
+  if(pl->nb_nodes == 0) {
+    fprintf(f, ", NUMA nodes unknown\n");
+    return;
+  }
+  int i;
+  for(i=0; i<pl->nb_nodes; i++) {
+    fprintf(f, ", node %d: %zu", i, pl->node_pages[i]);
+  }
+  fprintf(f, ", not touched: %zu\n", pl->absent_pages);
+}
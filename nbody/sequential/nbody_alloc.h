@@ -1,19 +1,78 @@
 #ifndef NBODY_ALLOC_H
 #define NBODY_ALLOC_H
+#include <stdio.h>
+#include <stddef.h>
 
 typedef struct Bloc {
   struct Bloc* suivant;
 } Bloc;
 
 struct memory_t {
+  void *zone;		/* the memory area cut in blocks */
   Bloc *debutListe;
   size_t block_size;
   unsigned nb_free;
+  size_t zone_size;	/* size of zone */
+  int flags;		/* flags given to mem_init */
+  struct memory_t *shared;	/* local pool: the pool its blocks are borrowed from */
 };
 
+/* flags of mem_init and mem_alloc_pages */
+#define MEM_HUGE_PAGES 1	/* back the memory with huge pages when possible */
 
-void mem_init(struct memory_t *mem, size_t block_size, int nb_blocks);
+/* size of the huge pages the mappings are rounded to */
+#define MEM_HUGE_PAGE_SIZE (2UL*1024*1024)
+/* maximum number of NUMA nodes reported by mem_placement */
+#define MEM_MAX_NODES 64
+
+/*
+  The pages of the block pool are first touched by the threads of the
+  calling thread pool, each thread touching the same share of the blocks as
+  in a schedule(static) loop: the pool is spread over the NUMA nodes of the
+  threads instead of landing on the node of the thread that calls mem_init.
+*/
+void mem_init(struct memory_t *mem, size_t block_size, int nb_blocks, int flags);
 void *mem_alloc(struct memory_t* mem);
 void mem_free(struct memory_t* mem, void *ptr);
+void mem_destroy(struct memory_t* mem);
+
+/*
+  Local pools, to allocate blocks from several threads. A local pool has no
+  memory of its own: when it is empty, it borrows MEM_BATCH_SIZE blocks of the
+  shared pool, in a critical section. The blocks still belong to the shared
+  pool, so they can be freed there. mem_release_local gives the blocks that
+  were not allocated back to the shared pool.
+*/
+#define MEM_BATCH_SIZE 64
+void mem_init_local(struct memory_t *local, struct memory_t *shared);
+void mem_release_local(struct memory_t *local);
+
+/*
+  Page-level allocation for the large arrays. The memory is mapped, but not
+  touched: each page is placed on the NUMA node of the thread that touches
+  it first, so the arrays must be initialized by the threads that use them
+  (see mem_first_touch). With MEM_HUGE_PAGES, the mapping is backed by
+  hugetlbfs pages if some are reserved, and by transparent huge pages
+  otherwise. Return NULL if the memory cannot be mapped.
+*/
+void* mem_alloc_pages(size_t size, int flags);
+void mem_free_pages(void* ptr, size_t size, int flags);
+
+/* touch the pages of [ptr, ptr+size) in a schedule(static) parallel loop */
+void mem_first_touch(void* ptr, size_t size);
+
+/* where the pages of a memory area are */
+struct mem_placement {
+  size_t nb_pages;			/* number of base pages of the area */
+  size_t huge_size;			/* number of bytes backed by huge pages */
+  int nb_nodes;				/* 1 + highest node that holds a page, 0 if unknown */
+  size_t node_pages[MEM_MAX_NODES];	/* number of pages on each node */
+  size_t absent_pages;			/* pages not touched yet, or swapped out */
+};
+
+/* fill pl with the placement of [ptr, ptr+size). Return -1 if the kernel does
+ * not report the NUMA node of the pages (pl->nb_nodes is 0 then) */
+int mem_placement(const void* ptr, size_t size, struct mem_placement* pl);
+void mem_print_placement(FILE* f, const char* name, const struct mem_placement* pl);
 
 #endif
@@ -5,138 +5,181 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <string.h>
 #include <math.h>
-#include <sys/time.h>
 #include <assert.h>
-#include <unistd.h>
-
-#ifdef DISPLAY
-#include <X11/Xlib.h>
-#include <X11/Xutil.h>
-#endif
 
 #include "ui.h"
 #include "nbody.h"
 #include "nbody_tools.h"
-
-FILE* f_out=NULL;
-
-int nparticles=10;      /* number of particles */
-float T_FINAL=1.0;     /* simulation end time */
-
-particle_t*particles;
-
-node_t *root;
-
-
-double sum_speed_sq = 0;
-double max_acc = 0;
-double max_speed = 0;
-
-void init() {
-  init_alloc(4*nparticles);
-  root = malloc(sizeof(node_t));
-  init_node(root, NULL, XMIN, XMAX, YMIN, YMAX);
+#include "nbody_reorder.h"
+#include "nbody_diagnostics.h"
+#include "nbody_pm.h"
+#include "nbody_sim.h"
+
+static void init(nbody_sim_t* sim) {
+  mem_init(&sim->mem_node, NODE_BLOCK_SIZE, 4*sim->nparticles,
+	   sim->params.huge_pages ? MEM_HUGE_PAGES : 0);
+  sim->root = malloc(sizeof(node_t));
+  init_node(sim->root, NULL, XMIN, XMAX, YMIN, YMAX);
+  build_tree(sim->particles, sim->nparticles, sim->root, &sim->mem_node);
 }
 
-#ifdef DISPLAY
-extern Display *theDisplay;  /* These three variables are required to open the */
-extern GC theGC;             /* particle plotting window.  They are externally */
-extern Window theMain;       /* declared in ui.h but are also required here.   */
-#endif
-
-/* compute the force that a particle with position (x_pos, y_pos) and mass 'mass'
- * applies to particle p
+/* compute the short-range part of the force that a particle with position
+ * (x_pos, y_pos) and mass 'mass' applies to particle p (TreePM engine).
+ * If potential is not NULL, the short-range potential energy of the pair is added to it.
  */
-void compute_force(particle_t*p, double x_pos, double y_pos, double mass) {
+static void compute_short_range_force(particle_t*p, double x_pos, double y_pos, double mass,
+				      double r_split, double *potential) {
   double x_sep, y_sep, dist_sq, grav_base;
 
   x_sep = x_pos - p->x_pos;
   y_sep = y_pos - p->y_pos;
-  dist_sq = MAX((x_sep*x_sep) + (y_sep*y_sep), 0.01);
+  dist_sq = (x_sep*x_sep) + (y_sep*y_sep);
+  if(potential) {
+    *potential += pair_potential(dist_sq, p->mass, mass)
+      - GRAV_CONSTANT*(p->mass)*(mass)*pm_long_range_potential(dist_sq, r_split);
+  }
+  if(dist_sq == 0) {
+    return;
+  }
 
-  /* Use the 2-dimensional gravity rule: F = d * (GMm/d^2) */
-  grav_base = GRAV_CONSTANT*(p->mass)*(mass)/dist_sq;
+  /* remove the long-range part GMm/d*(1-exp(-d^2/(4*r_split^2))) from F */
+  double damping = exp(-dist_sq/(4*r_split*r_split));
+  if(dist_sq >= MIN_DIST_SQ) {
+    grav_base = GRAV_CONSTANT*(p->mass)*(mass)*damping/dist_sq;
+  } else {
+    grav_base = GRAV_CONSTANT*(p->mass)*(mass)*(1/MIN_DIST_SQ - (1-damping)/dist_sq);
+  }
 
   p->x_force += grav_base*x_sep;
   p->y_force += grav_base*y_sep;
 }
 
-/* compute the force that node n acts on particle p */
-void compute_force_on_particle(node_t* n, particle_t *p) {
-  if(! n || n->n_particles==0) {
+/* compute the short-range force that node n acts on particle p. The nodes
+ * farther than PM_CUTOFF*r_split are skipped.
+ * If potential is not NULL, the short-range potential energy between n and p is added to it.
+ */
+static void compute_short_range_force_on_particle(node_t* n, particle_t *p, double r_split,
+						  double theta, double *potential) {
+  if(! n) {
     return;
   }
-  if(n->particle) {
-    /* only one particle */
-    assert(n->children == NULL);
-
-    /*
-      If the current node is an external node (and it is not body b),
-      calculate the force exerted by the current node on b, and add
-      this amount to b's net force.
-    */
-    compute_force(p, n->x_center, n->y_center, n->mass);
-  } else {
-    /* There are multiple particles */
+  /* the softening also makes the short-range force differ from F*exp(-d^2/(4*r_split^2)) */
+  double cutoff = MAX(PM_CUTOFF*r_split, sqrt(MIN_DIST_SQ));
+  node_t* stack[WALK_STACK_SIZE(n)];
+  int top = 0;
+  stack[top++] = n;
+
+  while(top > 0) {
+    n = stack[--top];
+    if(n->n_particles==0) {
+      continue;
+    }
 
-    #define THRESHOLD 2
+    /* distance between p and the box of n */
+    double box_x = MAX(MAX(n->x_min - p->x_pos, p->x_pos - n->x_max), 0);
+    double box_y = MAX(MAX(n->y_min - p->y_pos, p->y_pos - n->y_max), 0);
+    if(box_x*box_x + box_y*box_y > cutoff*cutoff) {
+      continue;
+    }
+
+    if(n->particle) {
+      /* only one particle */
+      compute_short_range_force(p, n->x_center, n->y_center, n->mass, r_split,
+				n->particle == p ? NULL : potential);
+      continue;
+    }
     double size = n->x_max - n->x_min; // width of n
     double diff_x = n->x_center - p->x_pos;
     double diff_y = n->y_center - p->y_pos;
     double distance = sqrt(diff_x*diff_x + diff_y*diff_y);
 
-#if BRUTE_FORCE
-    /*
-      Run the procedure recursively on each of the current
-      node's children.
-      --> This result in a brute-force computation (complexity: O(n*n))
-    */
-    int i;
-    for(i=0; i<4; i++) {
-      compute_force_on_particle(&n->children[i], p);
-    }
-#else
-    /* Use the Barnes-Hut algorithm to get an approximation */
-    if(size / distance < THRESHOLD) {
-      /*
-	The particle is far away. Use an approximation of the force
-      */
-      compute_force(p, n->x_center, n->y_center, n->mass);
+    if(size / distance < theta) {
+      compute_short_range_force(p, n->x_center, n->y_center, n->mass, r_split, potential);
     } else {
-      /*
-        Otherwise, run the procedure recursively on each of the current
-	node's children.
-      */
+      prefetch_children(n);
       int i;
-      for(i=0; i<4; i++) {
-	compute_force_on_particle(&n->children[i], p);
+      for(i=3; i>=0; i--) {
+	stack[top++] = &n->children[i];
       }
     }
-#endif
   }
 }
 
-void compute_force_in_node(node_t *n) {
-  if(!n) return;
+/*
+  Compute the force on every particle.
+  The particles are taken directly from the particles array: when it is
+  sorted along a space-filling curve, consecutive particles walk almost the
+  same part of the tree.
+  With the TreePM engine, the mesh gives the long-range forces and the tree
+  walk only adds the short-range forces.
+*/
+static void compute_all_forces(nbody_sim_t* sim) {
+  particle_t* particles = sim->particles;
+  int n = sim->nslots;
+  double theta = sim->params.theta;
+  int chunk = sim->params.chunk;
+  int i;
+
+  if(sim->compute_diag) {
+    init_diagnostics(&sim->diag);
+  }
 
-  if(n->particle) {
-    particle_t*p = n->particle;
-    p->x_force = 0;
-    p->y_force = 0;
-    compute_force_on_particle(root, p);
+  double r_split = 0;
+  double* long_range_potential = NULL;
+  if(sim->pm) {
+    if(sim->compute_diag) {
+      long_range_potential = malloc(sizeof(double)*n);
+      assert(long_range_potential);
+    }
+    r_split = pm_compute_forces(sim->pm, particles, n, long_range_potential);
   }
-  if(n->children) {
-    int i;
-    for(i=0; i<4; i++) {
-      compute_force_in_node(&n->children[i]);
+
+#pragma omp parallel
+  {
+    struct diagnostics diag;
+    init_diagnostics(&diag);
+
+#pragma omp for schedule(dynamic, chunk)
+    for(i=0; i<n; i++) {
+      particle_t*p = &particles[i];
+      if(sim->pm) {
+	if(sim->compute_diag) {
+	  double potential = long_range_potential[i];
+	  compute_short_range_force_on_particle(sim->root, p, r_split, theta, &potential);
+	  add_particle_diagnostics(&diag, p, potential);
+	} else {
+	  compute_short_range_force_on_particle(sim->root, p, r_split, theta, NULL);
+	}
+	continue;
+      }
+      p->x_force = 0;
+      p->y_force = 0;
+      if(sim->compute_diag) {
+	double potential = 0;
+	compute_force_on_particle(sim->root, p, theta, &potential);
+	add_particle_diagnostics(&diag, p, potential);
+      } else {
+	compute_force_on_particle(sim->root, p, theta, NULL);
+      }
+    }
+
+    if(sim->compute_diag) {
+#pragma omp critical (diagnostics)
+      merge_diagnostics(&sim->diag, &diag);
     }
   }
+
+  if(sim->compute_diag) {
+    finalize_diagnostics(&sim->diag);
+  }
+  free(long_range_potential);
 }
 
 /* compute the new position/velocity */
-void move_particle(particle_t*p, double step, node_t* new_root) {
+static void move_particle(particle_t*p, double step,
+			  double* sum_speed_sq, double* max_acc, double* max_speed) {
 
   p->x_pos += (p->x_vel)*step;
   p->y_pos += (p->y_vel)*step;
@@ -151,36 +194,45 @@ void move_particle(particle_t*p, double step, node_t* new_root) {
   double speed_sq = (p->x_vel)*(p->x_vel) + (p->y_vel)*(p->y_vel);
   double cur_speed = sqrt(speed_sq);
 
-  sum_speed_sq += speed_sq;
-  max_acc = MAX(max_acc, cur_acc);
-  max_speed = MAX(max_speed, cur_speed);
-
-  p->node = NULL;
-  if(p->x_pos < new_root->x_min ||
-     p->x_pos > new_root->x_max ||
-     p->y_pos < new_root->y_min ||
-     p->y_pos > new_root->y_max) {
-    free(p);
-    nparticles--;
-  } else {
-    insert_particle(p, new_root);
-  }
+  *sum_speed_sq += speed_sq;
+  *max_acc = MAX(*max_acc, cur_acc);
+  *max_speed = MAX(*max_speed, cur_speed);
 }
 
-/* compute the new position of the particles in a node */
-void move_particles_in_node(node_t*n, double step, node_t *new_root) {
-  if(!n) return;
+/*
+  Build the tree of the particles at their new position. The particles that
+  left the domain are removed from the array; the others keep their order
+  and are inserted by all the threads (see build_tree).
+*/
+static void rebuild_tree(nbody_sim_t* sim) {
+  node_t* root = sim->root;
+  particle_t* particles = sim->particles;
+  int n = sim->nslots;
+  int nalive = 0;
+  int i;
 
-  if(n->particle) {
-    particle_t*p = n->particle;
-    move_particle(p, step, new_root);
-  }
-  if(n->children) {
-    int i;
-    for(i=0; i<4; i++) {
-      move_particles_in_node(&n->children[i], step, new_root);
+  free_node(root, &sim->mem_node);
+  init_node(root, NULL, XMIN, XMAX, YMIN, YMAX);
+
+  for(i=0; i<n; i++) {
+    particle_t*p = &particles[i];
+    if(p->x_pos < root->x_min ||
+       p->x_pos > root->x_max ||
+       p->y_pos < root->y_min ||
+       p->y_pos > root->y_max) {
+      /* the particle left the domain */
+      continue;
+    }
+    if(nalive != i) {
+      particles[nalive] = *p;
+      sim->particle_ids[nalive] = sim->particle_ids[i];
     }
+    particles[nalive].node = NULL;
+    nalive++;
   }
+  build_tree(particles, nalive, root, &sim->mem_node);
+  sim->nparticles = nalive;
+  sim->nslots = nalive;
 }
 
 /*
@@ -189,115 +241,88 @@ void move_particles_in_node(node_t*n, double step, node_t *new_root) {
   Update positions, velocity, and acceleration.
   Return local computations.
 */
-void all_move_particles(double step)
+static void all_move_particles(nbody_sim_t* sim, double step)
 {
-  /* First calculate force for particles. */
-  compute_force_in_node(root);
-
-  node_t* new_root = malloc(sizeof(node_t));
-  init_node(new_root, NULL, XMIN, XMAX, YMIN, YMAX);
-
-  /* then move all particles and return statistics */
-  move_particles_in_node(root, step, new_root);
-
-  free_node(root);
-  free(root);
-  root = new_root;
-}
-
-void run_simulation() {
-  double t = 0.0, dt = 0.01;
-
-  while (t < T_FINAL && nparticles>0) {
-    /* Update time. */
-    t += dt;
-    /* Move particles with the current and compute rms velocity. */
-    all_move_particles(dt);
-
-    /* Adjust dt based on maximum speed and acceleration--this
-       simple rule tries to insure that no velocity will change
-       by more than 10% */
-
-    dt = 0.1*max_speed/max_acc;
-
-    /* Plot the movement of the particle */
-#if DISPLAY
-    node_t *n = root;
-    clear_display();
-    draw_node(n);
-    flush_display();
-#endif
-  }
-}
-
-/* create a quad-tree from an array of particles */
-void insert_all_particles(int nparticles, particle_t*particles, node_t*root) {
+  particle_t* particles = sim->particles;
+  int n = sim->nslots;
+  double sum_speed_sq = 0;
+  double max_acc = sim->max_acc;
+  double max_speed = sim->max_speed;
   int i;
-  for(i=0; i<nparticles; i++) {
-    insert_particle(&particles[i], root);
+#pragma omp parallel for schedule(static) reduction(+:sum_speed_sq) reduction(max:max_acc, max_speed)
+  for(i=0; i<n; i++) {
+    move_particle(&particles[i], step, &sum_speed_sq, &max_acc, &max_speed);
   }
+  sim->sum_speed_sq += sum_speed_sq;
+  sim->max_acc = max_acc;
+  sim->max_speed = max_speed;
+
+  rebuild_tree(sim);
 }
 
 /*
-  Simulate the movement of nparticles particles.
+  Sort the particles array along a space-filling curve so that the
+  particles of a subtree are close in memory, and rebuild the tree.
 */
-int main(int argc, char**argv)
-{
-  if(argc >= 2) {
-    nparticles = atoi(argv[1]);
-  }
-  if(argc == 3) {
-    T_FINAL = atof(argv[2]);
-  }
-
-  init();
-
-  /* Allocate global shared arrays for the particles data set. */
-  particles = malloc(sizeof(particle_t)*nparticles);
-  all_init_particles(nparticles, particles);
-  insert_all_particles(nparticles, particles, root);
-
-  /* Initialize thread data structures */
-#ifdef DISPLAY
-  /* Open an X window to display the particles */
-  simple_init (100,100,DISPLAY_SIZE, DISPLAY_SIZE);
-#endif
-
-  struct timeval t1, t2;
-  gettimeofday(&t1, NULL);
+static void reorder_all_particles(nbody_sim_t* sim) {
+  reorder_particles(sim->particles, sim->particle_ids, sim->nslots,
+		    XMIN, XMAX, YMIN, YMAX);
 
-  /* Main thread starts simulation ... */
-  run_simulation();
-
-  gettimeofday(&t2, NULL);
-
-  double duration = (t2.tv_sec -t1.tv_sec)+((t2.tv_usec-t1.tv_usec)/1e6);
+  /* the particles moved in memory: the tree has to point to their new location */
+  rebuild_tree(sim);
+}
 
-#ifdef DUMP_RESULT
-  FILE* f_out = fopen("particles.log", "w");
-  assert(f_out);
-  print_particles(f_out, root);
-  fclose(f_out);
-#endif
+static void mark_alive(nbody_sim_t* sim, char* alive) {
+  /* the particles that left the domain are removed from the array
+   * when the tree is rebuilt */
+  memset(alive, 1, sim->nslots);
+}
 
-  printf("-----------------------------\n");
-  printf("nparticles: %d\n", nparticles);
-  printf("T_FINAL: %f\n", T_FINAL);
-  printf("-----------------------------\n");
-  printf("Simulation took %lf s to complete\n", duration);
+static void print_all_particles(nbody_sim_t* sim, FILE* f) {
+  print_particles(f, sim->root);
+}
 
-#ifdef DISPLAY
-  node_t *n = root;
-  clear_display();
-  draw_node(n);
-  flush_display();
+static void draw_all_particles(nbody_sim_t* sim, int draw_boxes) {
+  draw_node(sim->root, draw_boxes);
+}
 
-  printf("Hit return to close the window.");
+static void finalize(nbody_sim_t* sim) {
+  free_node(sim->root, &sim->mem_node);
+  free(sim->root);
+  mem_destroy(&sim->mem_node);
+}
 
-  getchar();
-  /* Close the X window used to display the particles */
-  XCloseDisplay(theDisplay);
-#endif
+/* TreePM: the Barnes-Hut tree, plus a mesh for the long-range forces */
+static void treepm_init(nbody_sim_t* sim) {
+  init(sim);
+  sim->pm = pm_create(sim->params.pm_grid);
+}
 
-  return 0;
+static void treepm_finalize(nbody_sim_t* sim) {
+  finalize(sim);
+  pm_destroy(sim->pm);
 }
+
+const struct nbody_engine_ops barnes_hut_engine = {
+  .name = "barnes_hut",
+  .init = init,
+  .compute_forces = compute_all_forces,
+  .move_particles = all_move_particles,
+  .reorder = reorder_all_particles,
+  .mark_alive = mark_alive,
+  .print_particles = print_all_particles,
+  .draw = draw_all_particles,
+  .finalize = finalize,
+};
+
+const struct nbody_engine_ops treepm_engine = {
+  .name = "treepm",
+  .init = treepm_init,
+  .compute_forces = compute_all_forces,
+  .move_particles = all_move_particles,
+  .reorder = reorder_all_particles,
+  .mark_alive = mark_alive,
+  .print_particles = print_all_particles,
+  .draw = draw_all_particles,
+  .finalize = treepm_finalize,
+};
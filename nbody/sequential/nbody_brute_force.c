@@ -5,50 +5,41 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <string.h>
 #include <math.h>
-#include <sys/time.h>
 #include <assert.h>
-#include <unistd.h>
-
-#ifdef DISPLAY
-#include <X11/Xlib.h>
-#include <X11/Xutil.h>
-#endif
 
 #include "ui.h"
 #include "nbody.h"
 #include "nbody_tools.h"
+#include "nbody_reorder.h"
+#include "nbody_diagnostics.h"
+#include "nbody_sim.h"
 
-FILE* f_out=NULL;
-
-int nparticles=10;      /* number of particles */
-float T_FINAL=1.0;     /* simulation end time */
-particle_t*particles;
-
-double sum_speed_sq = 0;
-double max_acc = 0;
-double max_speed = 0;
-
-void init() {
-  /* Nothing to do */
-}
-
-#ifdef DISPLAY
-extern Display *theDisplay;  /* These three variables are required to open the */
-extern GC theGC;             /* particle plotting window.  They are externally */
-extern Window theMain;       /* declared in ui.h but are also required here.   */
+/*
+  The vectorized kernels are compiled once per instruction set. The version
+  that matches the processor is selected once, when the program is loaded.
+*/
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define SIMD_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define SIMD_CLONES
 #endif
 
 /* compute the force that a particle with position (x_pos, y_pos) and mass 'mass'
- * applies to particle p
+ * applies to particle p. If potential is not NULL, the potential energy of the
+ * pair is added to it.
  */
-void compute_force(particle_t*p, double x_pos, double y_pos, double mass) {
+static void compute_force(particle_t*p, double x_pos, double y_pos, double mass, double *potential) {
   double x_sep, y_sep, dist_sq, grav_base;
 
   x_sep = x_pos - p->x_pos;
   y_sep = y_pos - p->y_pos;
-  dist_sq = MAX((x_sep*x_sep) + (y_sep*y_sep), 0.01);
+  dist_sq = (x_sep*x_sep) + (y_sep*y_sep);
+  if(potential) {
+    *potential += pair_potential(dist_sq, p->mass, mass);
+  }
+  dist_sq = MAX(dist_sq, MIN_DIST_SQ);
 
   /* Use the 2-dimensional gravity rule: F = d * (GMm/d^2) */
   grav_base = GRAV_CONSTANT*(p->mass)*(mass)/dist_sq;
@@ -57,8 +48,202 @@ void compute_force(particle_t*p, double x_pos, double y_pos, double mass) {
   p->y_force += grav_base*y_sep;
 }
 
+/*
+  Force kernels: compute the forces on all the particles. If sim->compute_diag
+  is set, each thread also sums the diagnostics of its particles, and the sums
+  are merged into sim->diag.
+*/
+
+static void scalar_kernel(nbody_sim_t* sim) {
+  particle_t* particles = sim->particles;
+  int nparticles = sim->nparticles;
+  int i;
+#pragma omp parallel
+  {
+    struct diagnostics diag;
+    init_diagnostics(&diag);
+#pragma omp for schedule(static)
+    for(i=0; i<nparticles; i++) {
+      int j;
+      double potential = 0;
+      double* pair_potentials = sim->compute_diag ? &potential : NULL;
+      particles[i].x_force = 0;
+      particles[i].y_force = 0;
+      for(j=0; j<nparticles; j++) {
+	particle_t*p = &particles[j];
+	/* compute the force of particle j on particle i */
+	compute_force(&particles[i], p->x_pos, p->y_pos, p->mass, j == i ? NULL : pair_potentials);
+      }
+      if(sim->compute_diag) {
+	add_particle_diagnostics(&diag, &particles[i], potential);
+      }
+    }
+    if(sim->compute_diag) {
+#pragma omp critical (diagnostics)
+      merge_diagnostics(&sim->diag, &diag);
+    }
+  }
+}
+
+/* sum of mass[j]*sep/max(d^2, MIN_DIST_SQ) over the n particles of the
+ * arrays, for a particle at (x_pos, y_pos) */
+SIMD_CLONES
+static void sum_forces(const double* x, const double* y, const double* mass, int n,
+		       double x_pos, double y_pos, double* x_sum, double* y_sum) {
+  double fx = 0, fy = 0;
+  int j;
+#pragma omp simd reduction(+:fx, fy)
+  for(j=0; j<n; j++) {
+    double x_sep = x[j] - x_pos;
+    double y_sep = y[j] - y_pos;
+    double dist_sq = MAX(x_sep*x_sep + y_sep*y_sep, MIN_DIST_SQ);
+    double grav_base = mass[j]/dist_sq;
+    fx += grav_base*x_sep;
+    fy += grav_base*y_sep;
+  }
+  *x_sum = fx;
+  *y_sum = fy;
+}
+
+/* sum of the pair potentials of a particle at (x_pos, y_pos) with unit mass
+ * and the particles of the arrays other than 'self' */
+SIMD_CLONES
+static double sum_potential(const double* x, const double* y, const double* mass, int n,
+			    int self, double x_pos, double y_pos) {
+  double u = 0;
+  int j;
+#pragma omp simd reduction(+:u)
+  for(j=0; j<n; j++) {
+    double x_sep = x[j] - x_pos;
+    double y_sep = y[j] - y_pos;
+    u += j == self ? 0 : pair_potential(x_sep*x_sep + y_sep*y_sep, 1, mass[j]);
+  }
+  return u;
+}
+
+SIMD_CLONES
+static void sum_forces_float(const float* x, const float* y, const float* mass, int n,
+			     float x_pos, float y_pos, float* x_sum, float* y_sum) {
+  float fx = 0, fy = 0;
+  int j;
+#pragma omp simd reduction(+:fx, fy)
+  for(j=0; j<n; j++) {
+    float x_sep = x[j] - x_pos;
+    float y_sep = y[j] - y_pos;
+    float dist_sq = MAX(x_sep*x_sep + y_sep*y_sep, (float) MIN_DIST_SQ);
+    float grav_base = mass[j]/dist_sq;
+    fx += grav_base*x_sep;
+    fy += grav_base*y_sep;
+  }
+  *x_sum = fx;
+  *y_sum = fy;
+}
+
+/* same as sum_potential, with the separations in single precision */
+SIMD_CLONES
+static double sum_potential_float(const float* x, const float* y, const float* mass, int n,
+				  int self, float x_pos, float y_pos) {
+  double u = 0;
+  int j;
+#pragma omp simd reduction(+:u)
+  for(j=0; j<n; j++) {
+    float x_sep = x[j] - x_pos;
+    float y_sep = y[j] - y_pos;
+    u += j == self ? 0 : pair_potential(x_sep*x_sep + y_sep*y_sep, 1, mass[j]);
+  }
+  return u;
+}
+
+static void simd_kernel(nbody_sim_t* sim) {
+  particle_t* particles = sim->particles;
+  int n = sim->nparticles;
+  double* x = sim->soa;
+  double* y = x + n;
+  double* mass = y + n;
+  int i;
+#pragma omp parallel for schedule(static)
+  for(i=0; i<n; i++) {
+    x[i] = particles[i].x_pos;
+    y[i] = particles[i].y_pos;
+    mass[i] = particles[i].mass;
+  }
+#pragma omp parallel
+  {
+    struct diagnostics diag;
+    init_diagnostics(&diag);
+#pragma omp for schedule(static)
+    for(i=0; i<n; i++) {
+      double x_sum, y_sum;
+      sum_forces(x, y, mass, n, x[i], y[i], &x_sum, &y_sum);
+      particles[i].x_force = GRAV_CONSTANT*mass[i]*x_sum;
+      particles[i].y_force = GRAV_CONSTANT*mass[i]*y_sum;
+      if(sim->compute_diag) {
+	double potential = mass[i]*sum_potential(x, y, mass, n, i, x[i], y[i]);
+	add_particle_diagnostics(&diag, &particles[i], potential);
+      }
+    }
+    if(sim->compute_diag) {
+#pragma omp critical (diagnostics)
+      merge_diagnostics(&sim->diag, &diag);
+    }
+  }
+}
+
+static void float_kernel(nbody_sim_t* sim) {
+  particle_t* particles = sim->particles;
+  int n = sim->nparticles;
+  float* x = sim->soa_float;
+  float* y = x + n;
+  float* mass = y + n;
+  int i;
+#pragma omp parallel for schedule(static)
+  for(i=0; i<n; i++) {
+    x[i] = particles[i].x_pos;
+    y[i] = particles[i].y_pos;
+    mass[i] = particles[i].mass;
+  }
+#pragma omp parallel
+  {
+    struct diagnostics diag;
+    init_diagnostics(&diag);
+#pragma omp for schedule(static)
+    for(i=0; i<n; i++) {
+      float x_sum, y_sum;
+      sum_forces_float(x, y, mass, n, x[i], y[i], &x_sum, &y_sum);
+      particles[i].x_force = GRAV_CONSTANT*particles[i].mass*x_sum;
+      particles[i].y_force = GRAV_CONSTANT*particles[i].mass*y_sum;
+      if(sim->compute_diag) {
+	double potential = particles[i].mass*sum_potential_float(x, y, mass, n, i, x[i], y[i]);
+	add_particle_diagnostics(&diag, &particles[i], potential);
+      }
+    }
+    if(sim->compute_diag) {
+#pragma omp critical (diagnostics)
+      merge_diagnostics(&sim->diag, &diag);
+    }
+  }
+}
+
+static void (*const kernels[NBODY_NB_KERNELS])(nbody_sim_t* sim) = {
+  [NBODY_KERNEL_SCALAR] = scalar_kernel,
+  [NBODY_KERNEL_SIMD] = simd_kernel,
+  [NBODY_KERNEL_FLOAT] = float_kernel,
+};
+
+static void init(nbody_sim_t* sim) {
+  sim->force_kernel = kernels[sim->params.kernel];
+  if(sim->params.kernel == NBODY_KERNEL_SIMD) {
+    sim->soa = malloc(sizeof(double)*3*sim->nparticles);
+    assert(sim->soa);
+  } else if(sim->params.kernel == NBODY_KERNEL_FLOAT) {
+    sim->soa_float = malloc(sizeof(float)*3*sim->nparticles);
+    assert(sim->soa_float);
+  }
+}
+
 /* compute the new position/velocity */
-void move_particle(particle_t*p, double step) {
+static void move_particle(particle_t*p, double step,
+			  double* sum_speed_sq, double* max_acc, double* max_speed) {
 
   p->x_pos += (p->x_vel)*step;
   p->y_pos += (p->y_vel)*step;
@@ -73,137 +258,100 @@ void move_particle(particle_t*p, double step) {
   double speed_sq = (p->x_vel)*(p->x_vel) + (p->y_vel)*(p->y_vel);
   double cur_speed = sqrt(speed_sq);
 
-  sum_speed_sq += speed_sq;
-  max_acc = MAX(max_acc, cur_acc);
-  max_speed = MAX(max_speed, cur_speed);
+  *sum_speed_sq += speed_sq;
+  *max_acc = MAX(*max_acc, cur_acc);
+  *max_speed = MAX(*max_speed, cur_speed);
 }
 
 
+/* compute the force on every particle, and the diagnostics if sim->compute_diag is set */
+static void compute_all_forces(nbody_sim_t* sim)
+{
+  if(sim->compute_diag) {
+    init_diagnostics(&sim->diag);
+  }
+  sim->force_kernel(sim);
+  if(sim->compute_diag) {
+    finalize_diagnostics(&sim->diag);
+  }
+}
+
 /*
   Move particles one time step.
 
   Update positions, velocity, and acceleration.
   Return local computations.
 */
-void all_move_particles(double step)
+static void all_move_particles(nbody_sim_t* sim, double step)
 {
-  /* First calculate force for particles. */
+  particle_t* particles = sim->particles;
+  int nparticles = sim->nparticles;
+  double sum_speed_sq = 0;
+  double max_acc = sim->max_acc;
+  double max_speed = sim->max_speed;
   int i;
+#pragma omp parallel for schedule(static) reduction(+:sum_speed_sq) reduction(max:max_acc, max_speed)
   for(i=0; i<nparticles; i++) {
-    int j;
-    particles[i].x_force = 0;
-    particles[i].y_force = 0;
-    for(j=0; j<nparticles; j++) {
-      particle_t*p = &particles[j];
-      /* compute the force of particle j on particle i */
-      compute_force(&particles[i], p->x_pos, p->y_pos, p->mass);
-    }
-  }
-
-  /* then move all particles and return statistics */
-  for(i=0; i<nparticles; i++) {
-    move_particle(&particles[i], step);
+    move_particle(&particles[i], step, &sum_speed_sq, &max_acc, &max_speed);
   }
+  sim->sum_speed_sq += sum_speed_sq;
+  sim->max_acc = max_acc;
+  sim->max_speed = max_speed;
 }
 
 /* display all the particles */
-void draw_all_particles() {
+static void draw_all_particles(nbody_sim_t* sim, int draw_boxes) {
   int i;
-  for(i=0; i<nparticles; i++) {
-    int x = POS_TO_SCREEN(particles[i].x_pos);
-    int y = POS_TO_SCREEN(particles[i].y_pos);
+  for(i=0; i<sim->nparticles; i++) {
+    int x = POS_TO_SCREEN(sim->particles[i].x_pos);
+    int y = POS_TO_SCREEN(sim->particles[i].y_pos);
     draw_point (x,y);
   }
 }
 
-void print_all_particles(FILE* f) {
+/* print the particles in their original order */
+static void print_all_particles(nbody_sim_t* sim, FILE* f) {
+  int nparticles = sim->nparticles;
+  int* slot = malloc(sizeof(int)*nparticles);
   int i;
   for(i=0; i<nparticles; i++) {
-    particle_t*p = &particles[i];
-    fprintf(f, "particle={pos=(%f,%f), vel=(%f,%f)}\n", p->x_pos, p->y_pos, p->x_vel, p->y_vel);
+    slot[sim->particle_ids[i]] = i;
   }
-}
-
-void run_simulation() {
-  double t = 0.0, dt = 0.01;
-  while (t < T_FINAL && nparticles>0) {
-    /* Update time. */
-    t += dt;
-    /* Move particles with the current and compute rms velocity. */
-    all_move_particles(dt);
-
-    /* Adjust dt based on maximum speed and acceleration--this
-       simple rule tries to insure that no velocity will change
-       by more than 10% */
-
-    dt = 0.1*max_speed/max_acc;
-
-    /* Plot the movement of the particle */
-#if DISPLAY
-    clear_display();
-    draw_all_particles();
-    flush_display();
-#endif
+  for(i=0; i<nparticles; i++) {
+    particle_t*p = &sim->particles[slot[i]];
+    fprintf(f, "particle={pos=(%f,%f), vel=(%f,%f)}\n", p->x_pos, p->y_pos, p->x_vel, p->y_vel);
   }
+  free(slot);
 }
 
 /*
-  Simulate the movement of nparticles particles.
+  Sort the particles array along a space-filling curve so that the
+  particles that are close in space are close in memory.
 */
-int main(int argc, char**argv)
-{
-  if(argc >= 2) {
-    nparticles = atoi(argv[1]);
-  }
-  if(argc == 3) {
-    T_FINAL = atof(argv[2]);
-  }
-
-  init();
-
-  /* Allocate global shared arrays for the particles data set. */
-  particles = malloc(sizeof(particle_t)*nparticles);
-  all_init_particles(nparticles, particles);
-
-  /* Initialize thread data structures */
-#ifdef DISPLAY
-  /* Open an X window to display the particles */
-  simple_init (100,100,DISPLAY_SIZE, DISPLAY_SIZE);
-#endif
-
-  struct timeval t1, t2;
-  gettimeofday(&t1, NULL);
-
-  /* Main thread starts simulation ... */
-  run_simulation();
-
-  gettimeofday(&t2, NULL);
-
-  double duration = (t2.tv_sec -t1.tv_sec)+((t2.tv_usec-t1.tv_usec)/1e6);
-
-#ifdef DUMP_RESULT
-  FILE* f_out = fopen("particles.log", "w");
-  assert(f_out);
-  print_all_particles(f_out);
-  fclose(f_out);
-#endif
-
-  printf("-----------------------------\n");
-  printf("nparticles: %d\n", nparticles);
-  printf("T_FINAL: %f\n", T_FINAL);
-  printf("-----------------------------\n");
-  printf("Simulation took %lf s to complete\n", duration);
-
-#ifdef DISPLAY
-  clear_display();
-  draw_all_particles();
-  flush_display();
+static void reorder_all_particles(nbody_sim_t* sim) {
+  double x_min, x_max, y_min, y_max;
+  get_bounding_box(sim->particles, sim->nparticles, &x_min, &x_max, &y_min, &y_max);
+  reorder_particles(sim->particles, sim->particle_ids, sim->nparticles, x_min, x_max, y_min, y_max);
+}
 
-  printf("Hit return to close the window.");
+static void mark_alive(nbody_sim_t* sim, char* alive) {
+  /* particles never leave the simulation */
+  memset(alive, 1, sim->nslots);
+}
 
-  getchar();
-  /* Close the X window used to display the particles */
-  XCloseDisplay(theDisplay);
-#endif
-  return 0;
+static void finalize(nbody_sim_t* sim) {
+  free(sim->soa);
+  free(sim->soa_float);
 }
+
+const struct nbody_engine_ops brute_force_engine = {
+  .name = "brute_force",
+  .init = init,
+  .compute_forces = compute_all_forces,
+  .move_particles = all_move_particles,
+  .reorder = reorder_all_particles,
+  .mark_alive = mark_alive,
+  .print_particles = print_all_particles,
+  .draw = draw_all_particles,
+  .finalize = finalize,
+};
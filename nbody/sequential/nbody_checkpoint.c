@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "nbody.h"
+#include "nbody_sim.h"
+#include "nbody_checkpoint.h"
+
+#define CHECKPOINT_MAGIC "NBCKPT2"
+#define MAX_FILENAME 4096
+
+/* the scalar part of the state of a simulation */
+struct checkpoint_header {
+  char magic[8];
+  /* parameters that the trajectory depends on */
+  int engine;
+  int distribution;
+  unsigned long long seed;
+  int initial_nparticles;
+  int reorder_interval;
+  int pm_grid;
+  int kernel;
+  double theta;
+  double t_final;
+  /* state */
+  int nparticles;
+  int nslots;
+  int step;
+  double t, dt;
+  double sum_speed_sq;
+  double max_acc;
+  double max_speed;
+};
+
+/* write size bytes to fd. Only uses system calls, so that it can run in a forked child */
+static int write_all(int fd, const void* buffer, size_t size) {
+  const char* ptr = buffer;
+  while(size > 0) {
+    ssize_t ret = write(fd, ptr, size);
+    if(ret <= 0) {
+      return -1;
+    }
+    ptr += ret;
+    size -= ret;
+  }
+  return 0;
+}
+
+/*
+  Write the state of sim in tmp_filename, then rename it to filename.
+  sim->alive must be up to date. This function does not allocate memory,
+  so it can be called by the child of a multithreaded process.
+*/
+static int write_state(nbody_sim_t* sim, const char* filename, const char* tmp_filename) {
+  struct checkpoint_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+  h.engine = sim->params.engine;
+  h.distribution = sim->params.distribution;
+  h.seed = sim->params.seed;
+  h.initial_nparticles = sim->params.nparticles;
+  h.reorder_interval = sim->params.reorder_interval;
+  h.pm_grid = sim->params.pm_grid;
+  h.kernel = sim->params.kernel;
+  h.theta = sim->params.theta;
+  h.t_final = sim->params.t_final;
+  h.nparticles = sim->nparticles;
+  h.nslots = sim->nslots;
+  h.step = sim->step;
+  h.t = sim->t;
+  h.dt = sim->dt;
+  h.sum_speed_sq = sim->sum_speed_sq;
+  h.max_acc = sim->max_acc;
+  h.max_speed = sim->max_speed;
+
+  int fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) {
+    return -1;
+  }
+  if(write_all(fd, &h, sizeof(h)) ||
+     write_all(fd, sim->particles, sizeof(particle_t)*sim->nslots) ||
+     write_all(fd, sim->particle_ids, sizeof(int)*sim->nslots) ||
+     write_all(fd, sim->alive, sim->nslots) ||
+     fsync(fd)) {
+    close(fd);
+    unlink(tmp_filename);
+    return -1;
+  }
+  close(fd);
+  return rename(tmp_filename, filename);
+}
+
+pid_t checkpoint_fork(nbody_sim_t* sim, const char* filename) {
+  char tmp_filename[MAX_FILENAME];
+  snprintf(tmp_filename, MAX_FILENAME, "%s.tmp", filename);
+  sim->engine->mark_alive(sim, sim->alive);
+
+  /* the buffered output would be written by both processes otherwise */
+  fflush(NULL);
+
+  pid_t pid = fork();
+  if(pid == 0) {
+    /* child: the state is frozen as it was at the time of the fork */
+    _exit(write_state(sim, filename, tmp_filename) ? 1 : 0);
+  }
+  return pid;
+}
+
+int checkpoint_wait(pid_t pid) {
+  int status;
+  if(pid <= 0 || waitpid(pid, &status, 0) != pid) {
+    return -1;
+  }
+  return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+int checkpoint_write(nbody_sim_t* sim, const char* filename) {
+  char tmp_filename[MAX_FILENAME];
+  snprintf(tmp_filename, MAX_FILENAME, "%s.tmp", filename);
+  sim->engine->mark_alive(sim, sim->alive);
+  return write_state(sim, filename, tmp_filename);
+}
+
+int checkpoint_read(nbody_sim_t* sim, const char* filename) {
+  FILE* f = fopen(filename, "rb");
+  if(!f) {
+    return -1;
+  }
+
+  struct checkpoint_header h;
+  if(fread(&h, sizeof(h), 1, f) != 1 ||
+     memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) != 0 ||
+     h.engine < 0 || h.engine >= NBODY_NB_ENGINES ||
+     h.nslots < h.nparticles || h.nslots > h.initial_nparticles) {
+    fclose(f);
+    return -1;
+  }
+
+  sim->params.engine = h.engine;
+  sim->params.distribution = h.distribution;
+  sim->params.seed = h.seed;
+  sim->params.nparticles = h.initial_nparticles;
+  sim->params.reorder_interval = h.reorder_interval;
+  sim->params.pm_grid = h.pm_grid;
+  sim->params.kernel = h.kernel;
+  sim->params.theta = h.theta;
+  sim->nparticles = h.nparticles;
+  sim->step = h.step;
+  sim->t = h.t;
+  sim->dt = h.dt;
+  sim->sum_speed_sq = h.sum_speed_sq;
+  sim->max_acc = h.max_acc;
+  sim->max_speed = h.max_speed;
+
+  /* the arrays keep their initial size */
+  alloc_particles(sim);
+  mem_first_touch(sim->particles, sizeof(particle_t)*h.initial_nparticles);
+  mem_first_touch(sim->particle_ids, sizeof(int)*h.initial_nparticles);
+  sim->alive = malloc(h.initial_nparticles);
+  assert(sim->alive);
+  if(fread(sim->particles, sizeof(particle_t), h.nslots, f) != (size_t) h.nslots ||
+     fread(sim->particle_ids, sizeof(int), h.nslots, f) != (size_t) h.nslots ||
+     fread(sim->alive, 1, h.nslots, f) != (size_t) h.nslots) {
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  /*
+    Drop the particles that left the simulation. The others keep their
+    relative order, which is all the next steps depend on.
+  */
+  int i, n = 0;
+  for(i=0; i<h.nslots; i++) {
+    if(sim->alive[i]) {
+      sim->particles[n] = sim->particles[i];
+      sim->particles[n].node = NULL;
+      sim->particle_ids[n] = sim->particle_ids[i];
+      n++;
+    }
+  }
+  if(n != h.nparticles) {
+    return -1;
+  }
+  sim->nslots = n;
+  return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef NBODY_CHECKPOINT_H
+#define NBODY_CHECKPOINT_H
+#include <sys/types.h>
+#include "nbody_sim.h"
+
+/*
+  Checkpoint/restart of a simulation context.
+
+  checkpoint_fork forks the process: the child writes the state of the
+  simulation, which it sees through copy-on-write pages, and exits while the
+  parent goes on with the simulation. The file is written under a temporary
+  name and renamed once complete, so an interrupted checkpoint never replaces
+  the previous one.
+
+  A checkpoint holds everything the next steps depend on, so a restarted run
+  continues bit for bit like the original one. It can only be read by the
+  same build on the same kind of machine.
+*/
+
+/* write a checkpoint of sim in filename from a child process.
+ * Return the pid of the child, or -1 if the fork failed */
+pid_t checkpoint_fork(nbody_sim_t* sim, const char* filename);
+
+/* wait for the child process started by checkpoint_fork. Return 0 if the checkpoint was written */
+int checkpoint_wait(pid_t pid);
+
+/* write a checkpoint of sim in filename. Return 0 on success */
+int checkpoint_write(nbody_sim_t* sim, const char* filename);
+
+/* read a checkpoint into a context allocated by the caller (zeroed). The
+ * particles are compacted and the engine is not initialized. Return 0 on success */
+int checkpoint_read(nbody_sim_t* sim, const char* filename);
+
+#endif	/* NBODY_CHECKPOINT_H */
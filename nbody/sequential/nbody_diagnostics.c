@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "nbody.h"
+#include "nbody_diagnostics.h"
+
+void init_diagnostics(struct diagnostics* d) {
+  memset(d, 0, sizeof(struct diagnostics));
+}
+
+void add_particle_diagnostics(struct diagnostics* d, particle_t* p, double potential) {
+  double speed_sq = (p->x_vel)*(p->x_vel) + (p->y_vel)*(p->y_vel);
+
+  d->kinetic += 0.5*p->mass*speed_sq;
+  /* each pair is seen by both of its particles */
+  d->potential += 0.5*potential;
+  d->x_momentum += p->mass*p->x_vel;
+  d->y_momentum += p->mass*p->y_vel;
+  d->angular_momentum += p->mass*(p->x_pos*p->y_vel - p->y_pos*p->x_vel);
+  d->virial += p->x_pos*p->x_force + p->y_pos*p->y_force;
+  d->n_particles++;
+}
+
+void merge_diagnostics(struct diagnostics* d, const struct diagnostics* other) {
+  d->kinetic += other->kinetic;
+  d->potential += other->potential;
+  d->x_momentum += other->x_momentum;
+  d->y_momentum += other->y_momentum;
+  d->angular_momentum += other->angular_momentum;
+  d->virial += other->virial;
+  d->n_particles += other->n_particles;
+}
+
+void finalize_diagnostics(struct diagnostics* d) {
+  d->total = d->kinetic + d->potential;
+  d->virial_ratio = d->virial != 0 ? 2*d->kinetic/fabs(d->virial) : 0;
+}
+
+void print_diagnostics(FILE* f, int step, double t, struct diagnostics* d) {
+  fprintf(f, "step %d t=%f n=%d: E=%g (K=%g U=%g) P=(%g,%g) L=%g virial ratio=%f\n",
+	  step, t, d->n_particles, d->total, d->kinetic, d->potential,
+	  d->x_momentum, d->y_momentum, d->angular_momentum, d->virial_ratio);
+}
@@ -0,0 +1,49 @@
+#ifndef NBODY_DIAGNOSTICS_H
+#define NBODY_DIAGNOSTICS_H
+#include <stdio.h>
+#include <math.h>
+#include "nbody.h"
+
+/* physical quantities used to monitor the quality of a run */
+struct diagnostics {
+  double kinetic;		/* kinetic energy */
+  double potential;		/* potential energy */
+  double total;			/* kinetic + potential */
+  double x_momentum, y_momentum; /* linear momentum */
+  double angular_momentum;	/* angular momentum around the origin */
+  double virial;		/* sum of r.F over the particles */
+  double virial_ratio;		/* 2*kinetic/|virial|, 1 for a system in equilibrium */
+  int n_particles;
+};
+
+/*
+  Potential energy of two particles of mass m1 and m2 whose distance is sqrt(dist_sq).
+  This is the potential of the force used in compute_force: F = GMm/d, and
+  F = GMm.d/MIN_DIST_SQ when the particles are closer than sqrt(MIN_DIST_SQ).
+*/
+static inline double pair_potential(double dist_sq, double m1, double m2) {
+  double u;
+  if(dist_sq >= MIN_DIST_SQ) {
+    u = 0.5*log(dist_sq);
+  } else {
+    u = dist_sq/(2*MIN_DIST_SQ) + 0.5*log(MIN_DIST_SQ) - 0.5;
+  }
+  return GRAV_CONSTANT*m1*m2*u;
+}
+
+void init_diagnostics(struct diagnostics* d);
+
+/* add the contribution of particle p. The forces of p must be up to date, and
+ * 'potential' is the sum of the pair potentials between p and the other particles.
+ */
+void add_particle_diagnostics(struct diagnostics* d, particle_t* p, double potential);
+
+/* add the sums of 'other' to d (to combine the results of several threads) */
+void merge_diagnostics(struct diagnostics* d, const struct diagnostics* other);
+
+/* compute the quantities that depend on the sums */
+void finalize_diagnostics(struct diagnostics* d);
+
+void print_diagnostics(FILE* f, int step, double t, struct diagnostics* d);
+
+#endif	/* NBODY_DIAGNOSTICS_H */
@@ -0,0 +1,170 @@
+/*
+** nbody_ensemble.c - run many small simulations concurrently in one process
+**
+** usage: nbody_ensemble job_file output_file [nthreads]
+**
+** Each line of job_file describes one simulation:
+**     engine nparticles T_FINAL [distribution [seed]]
+** Empty lines and lines starting with '#' are ignored.
+**
+** The simulations run concurrently, one per thread, and write their results
+** (a summary line followed by the final particles) in output_file as soon as
+** they complete. Each block starts with the number of its job.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <omp.h>
+
+#include "nbody.h"
+#include "nbody_generators.h"
+#include "libnbody.h"
+
+#define MAX_LINE 256
+
+struct job {
+  int line;			/* line number in the job file */
+  struct nbody_params params;
+};
+
+/* parse a job description. Return 0 if the line is invalid */
+static int parse_job(const char* line, struct job* job) {
+  char engine[64] = "", dist[64] = "line";
+  int nparticles;
+  double t_final;
+  unsigned long long seed = 0;
+
+  int n = sscanf(line, "%63s %d %lf %63s %llu", engine, &nparticles, &t_final, dist, &seed);
+  if(n < 3) {
+    return 0;
+  }
+
+  nbody_default_params(&job->params);
+  int e = nbody_parse_engine(engine);
+  int d = parse_distribution(dist);
+  if(e < 0 || d < 0 || nparticles <= 0) {
+    return 0;
+  }
+  job->params.engine = e;
+  job->params.nparticles = nparticles;
+  job->params.t_final = t_final;
+  job->params.distribution = d;
+  job->params.seed = seed;
+  /* one thread per simulation: the parallelism comes from the ensemble */
+  job->params.nthreads = 1;
+  return 1;
+}
+
+/* read the jobs of a file. Return the number of jobs, or -1 on error */
+static int read_jobs(const char* filename, struct job** jobs) {
+  FILE* f = fopen(filename, "r");
+  if(!f) {
+    perror(filename);
+    return -1;
+  }
+
+  int njobs = 0, capacity = 16;
+  int line_number = 0;
+  char line[MAX_LINE];
+  *jobs = malloc(sizeof(struct job)*capacity);
+
+  while(fgets(line, MAX_LINE, f)) {
+    line_number++;
+    char* c = line;
+    while(*c == ' ' || *c == '\t') c++;
+    if(*c == '#' || *c == '\n' || *c == '\0') {
+      continue;
+    }
+    if(njobs == capacity) {
+      capacity *= 2;
+      *jobs = realloc(*jobs, sizeof(struct job)*capacity);
+    }
+    struct job* job = &(*jobs)[njobs];
+    job->line = line_number;
+    if(!parse_job(c, job)) {
+      fprintf(stderr, "%s:%d: invalid job '%s'\n", filename, line_number, strtok(c, "\n"));
+      fclose(f);
+      free(*jobs);
+      return -1;
+    }
+    njobs++;
+  }
+  fclose(f);
+  return njobs;
+}
+
+/* run one job and return its results in a buffer */
+static char* run_job(int id, struct job* job, size_t* size) {
+  char* buffer = NULL;
+  FILE* f = open_memstream(&buffer, size);
+
+  nbody_sim_t* sim = nbody_create(&job->params);
+  double start = omp_get_wtime();
+  nbody_run(sim);
+  double duration = omp_get_wtime() - start;
+
+  fprintf(f, "job %d (line %d): engine=%s nparticles=%d T_FINAL=%f distribution=%s seed=%llu"
+	  " steps=%d t=%f remaining=%d duration=%lf\n",
+	  id, job->line, nbody_engine_name(job->params.engine), job->params.nparticles,
+	  job->params.t_final, distribution_name(job->params.distribution), job->params.seed,
+	  nbody_steps(sim), nbody_time(sim), nbody_nparticles(sim), duration);
+  nbody_print_particles(sim, f);
+
+  nbody_destroy(sim);
+  fclose(f);
+  return buffer;
+}
+
+int main(int argc, char**argv)
+{
+  if(argc < 3) {
+    fprintf(stderr, "usage: %s job_file output_file [nthreads]\n", argv[0]);
+    exit(1);
+  }
+  if(argc >= 4) {
+    omp_set_num_threads(atoi(argv[3]));
+  }
+
+  struct job* jobs;
+  int njobs = read_jobs(argv[1], &jobs);
+  if(njobs < 0) {
+    exit(1);
+  }
+
+  FILE* f_out = fopen(argv[2], "w");
+  if(!f_out) {
+    perror(argv[2]);
+    exit(1);
+  }
+
+  struct timeval t1, t2;
+  gettimeofday(&t1, NULL);
+
+  int i;
+  /* the jobs may have very different costs: hand them out one by one */
+#pragma omp parallel for schedule(dynamic, 1)
+  for(i=0; i<njobs; i++) {
+    size_t size;
+    char* result = run_job(i, &jobs[i], &size);
+#pragma omp critical (output)
+    {
+      fwrite(result, 1, size, f_out);
+    }
+    free(result);
+  }
+
+  gettimeofday(&t2, NULL);
+  double duration = (t2.tv_sec -t1.tv_sec)+((t2.tv_usec-t1.tv_usec)/1e6);
+
+  fclose(f_out);
+  free(jobs);
+
+  printf("-----------------------------\n");
+  printf("jobs: %d\n", njobs);
+  printf("threads: %d\n", omp_get_max_threads());
+  printf("-----------------------------\n");
+  printf("Ensemble took %lf s to complete (%lf jobs/s)\n", duration, njobs/duration);
+  return 0;
+}
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "nbody.h"
+#include "nbody_rng.h"
+#include "nbody_generators.h"
+
+#define PLUMMER_RADIUS    0.2	/* scale radius of the Plummer profile */
+#define DISK_SCALE        0.2	/* scale length of the exponential disk */
+#define MAX_MASS_FRACTION 0.999	/* truncate the profiles to keep the particles in the domain */
+#define NB_CLUSTERS       8	/* number of clusters of the clustered distribution */
+#define CLUSTER_RADIUS    0.05	/* standard deviation of a cluster */
+
+/* number of random numbers drawn for each particle */
+#define DRAWS_PER_PARTICLE 3
+
+static const char* distribution_names[NB_DISTRIBUTIONS] = {
+  [DIST_LINE] = "line",
+  [DIST_UNIFORM] = "uniform",
+  [DIST_PLUMMER] = "plummer",
+  [DIST_DISK] = "disk",
+  [DIST_CLUSTERED] = "clustered",
+};
+
+int parse_distribution(const char* name) {
+  int i;
+  for(i=0; i<NB_DISTRIBUTIONS; i++) {
+    if(strcmp(name, distribution_names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+const char* distribution_name(enum distribution dist) {
+  return distribution_names[dist];
+}
+
+/* return the k-th random number of particle i */
+static double draw(uint64_t seed, int i, int k) {
+  return rng_double(seed, (uint64_t) i*DRAWS_PER_PARTICLE + k);
+}
+
+/* radius that contains a fraction 'frac' of the mass of a Plummer profile */
+static double plummer_radius(double frac) {
+  return PLUMMER_RADIUS / sqrt(pow(frac, -2.0/3) - 1);
+}
+
+/* radius (in scale lengths) that contains a fraction 'frac' of the mass of an
+ * exponential disk, ie. the solution of 1 - (1+x)exp(-x) = frac
+ */
+static double disk_radius(double frac) {
+  double x = 1;
+  int i;
+  /* Newton's method with a fixed number of iterations so that the result
+   * does not depend on anything else than frac */
+  for(i=0; i<30; i++) {
+    double f = 1 - (1+x)*exp(-x) - frac;
+    double df = x*exp(-x);
+    x -= f/df;
+    if(x < 1e-6) x = 1e-6;
+  }
+  return x*DISK_SCALE;
+}
+
+/* place particle p at radius r on a circular orbit around the origin.
+ * With the 2-dimensional gravity rule (F = GMm/d), the circular velocity
+ * only depends on the enclosed mass.
+ */
+static void circular_orbit(particle_t* p, double r, double angle, double enclosed_mass) {
+  double v = sqrt(GRAV_CONSTANT*enclosed_mass);
+  p->x_pos = r*cos(angle);
+  p->y_pos = r*sin(angle);
+  p->x_vel = -v*sin(angle);
+  p->y_vel = v*cos(angle);
+}
+
+void generate_particles(particle_t* particles, int first, int count, int total,
+			enum distribution dist, uint64_t seed) {
+  double total_particle = total;
+  /* sum of the masses of all the particles (see below) */
+  double total_mass = (5.0*total_particle - 1)/2;
+  int i;
+
+#pragma omp parallel for schedule(static)
+  for(i=0; i<count; i++) {
+    int id = first + i;
+    particle_t *particle = &particles[i];
+    double u0 = draw(seed, id, 0);
+    double u1 = draw(seed, id, 1);
+
+    switch(dist) {
+    case DIST_LINE:
+      particle->x_pos = id*2.0/total_particle - 1.0;
+      particle->y_pos = 0.0;
+      particle->x_vel = 0.0;
+      particle->y_vel = particle->x_pos;
+      break;
+    case DIST_UNIFORM:
+      particle->x_pos = 2*u0 - 1;
+      particle->y_pos = 2*u1 - 1;
+      particle->x_vel = particle->y_pos;
+      particle->y_vel = particle->x_pos;
+      break;
+    case DIST_PLUMMER: {
+      double frac = u0*MAX_MASS_FRACTION;
+      circular_orbit(particle, plummer_radius(frac), 2*M_PI*u1, frac*total_mass);
+      break;
+    }
+    case DIST_DISK: {
+      double frac = u0*MAX_MASS_FRACTION;
+      circular_orbit(particle, disk_radius(frac), 2*M_PI*u1, frac*total_mass);
+      break;
+    }
+    case DIST_CLUSTERED: {
+      /* the centers of the clusters are drawn after the draws of the particles */
+      int cluster = (int) (u0*NB_CLUSTERS);
+      double x_center = 2*draw(seed, total + cluster, 0) - 1;
+      double y_center = 2*draw(seed, total + cluster, 1) - 1;
+      /* gaussian offset (Box-Muller transform) */
+      double u2 = draw(seed, id, 2);
+      double r = CLUSTER_RADIUS*sqrt(-2*log(1-u1));
+      particle->x_pos = x_center + r*cos(2*M_PI*u2);
+      particle->y_pos = y_center + r*sin(2*M_PI*u2);
+      particle->x_vel = 0.0;
+      particle->y_vel = 0.0;
+      break;
+    }
+    default:
+      fprintf(stderr, "Unknown distribution %d\n", dist);
+      abort();
+    }
+
+    particle->x_force = 0;
+    particle->y_force = 0;
+    particle->mass = 1.0 + (total+id)/total_particle;
+    particle->node = NULL;
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef NBODY_GENERATORS_H
+#define NBODY_GENERATORS_H
+#include <stdint.h>
+#include "nbody.h"
+
+/* initial distributions of the particles */
+enum distribution {
+  DIST_LINE,		/* deterministic layout along the x axis */
+  DIST_UNIFORM,		/* uniform in the square [-1,1]x[-1,1] */
+  DIST_PLUMMER,		/* Plummer density profile, particles on circular orbits */
+  DIST_DISK,		/* exponential disk, particles on circular orbits */
+  DIST_CLUSTERED,	/* gaussian clusters at random places */
+  NB_DISTRIBUTIONS
+};
+
+/* return the distribution named 'name', or -1 if there is no such distribution */
+int parse_distribution(const char* name);
+
+const char* distribution_name(enum distribution dist);
+
+/*
+  Initialize the particles first, ..., first+count-1 of a set of 'total' particles.
+  particles[0] is particle number 'first'.
+
+  Each particle only depends on (dist, seed, total, its number), so the slices
+  of the set can be generated independently, in any order, by any thread or
+  process: the result is the same as generating the whole set at once.
+*/
+void generate_particles(particle_t* particles, int first, int count, int total,
+			enum distribution dist, uint64_t seed);
+
+#endif	/* NBODY_GENERATORS_H */
@@ -0,0 +1,261 @@
+/*
+** nbody_main.c - command-line front-end of libnbody
+**
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <assert.h>
+#include <getopt.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include "ui.h"
+
+#include "nbody.h"
+#include "nbody_generators.h"
+#include "libnbody.h"
+
+extern Display *theDisplay;  /* These three variables are required to open the */
+extern GC theGC;             /* particle plotting window.  They are externally */
+extern Window theMain;       /* declared in ui.h but are also required here.   */
+
+#define CHECKPOINT_FILE "checkpoint.nbc"
+#define TRAJECTORY_FILE "trajectory.nbt"
+#define TUNE_CACHE_FILE "autotune.cache"
+
+static void usage(const char* name) {
+  fprintf(stderr, "usage: %s [options] [nparticles [T_FINAL [distribution [seed]]]]\n"
+	  "  --engine e       brute_force, barnes_hut or treepm (default: barnes_hut)\n"
+	  "  --kernel k       force kernel of brute_force: scalar, simd or float (default: scalar)\n"
+	  "  --theta t        opening criterion of the tree engines (default: 2, 0: exact)\n"
+	  "  --mesh n         size of the TreePM mesh (default: 256)\n"
+	  "  --threads t      number of threads (default: OpenMP default)\n"
+	  "  --chunk k        particles handed out at once to a thread by the tree engines (default: 64)\n"
+	  "  --autotune e     choose theta, chunk and reorder for an rms force error below e\n"
+	  "  --tune-cache f   cache of the autotune results (default: " TUNE_CACHE_FILE ")\n"
+	  "  --reorder k      sort the particles along a space-filling curve every k steps\n"
+	  "  --diag k         print the energy, momentum and virial ratio every k steps\n"
+	  "  --trajectory k   write the trajectory in " TRAJECTORY_FILE " every k steps\n"
+	  "  --checkpoint k   write the state in " CHECKPOINT_FILE " every k steps\n"
+	  "  --restart file   continue the simulation saved in a checkpoint\n"
+	  "  --dump file      write the final particles in file\n"
+	  "  --huge-pages     back the particles and the tree with huge pages\n"
+	  "  --placement      print the NUMA nodes and page sizes of the particles and the tree\n"
+	  "  --display        display the particles in an X window\n"
+	  "  --boxes          with --display, also draw the nodes of the tree\n", name);
+  exit(1);
+}
+
+/*
+  Simulate the movement of nparticles particles.
+*/
+int main(int argc, char**argv)
+{
+  static struct option options[] = {
+    {"engine", required_argument, NULL, 'e'},
+    {"kernel", required_argument, NULL, 'k'},
+    {"theta", required_argument, NULL, 'o'},
+    {"mesh", required_argument, NULL, 'm'},
+    {"threads", required_argument, NULL, 't'},
+    {"chunk", required_argument, NULL, 'u'},
+    {"autotune", required_argument, NULL, 'a'},
+    {"tune-cache", required_argument, NULL, 'f'},
+    {"reorder", required_argument, NULL, 's'},
+    {"diag", required_argument, NULL, 'g'},
+    {"trajectory", required_argument, NULL, 'j'},
+    {"checkpoint", required_argument, NULL, 'c'},
+    {"restart", required_argument, NULL, 'r'},
+    {"dump", required_argument, NULL, 'd'},
+    {"huge-pages", no_argument, NULL, 'h'},
+    {"placement", no_argument, NULL, 'p'},
+    {"display", no_argument, NULL, 'x'},
+    {"boxes", no_argument, NULL, 'b'},
+    {NULL, 0, NULL, 0}
+  };
+  const char* restart_file = NULL;
+  const char* dump_file = NULL;
+  int display = 0;
+  int draw_boxes = 0;
+  int placement = 0;
+  double error_bound = 0;
+  const char* tune_cache = TUNE_CACHE_FILE;
+  struct nbody_params params;
+  nbody_default_params(&params);
+  params.diag_file = stdout;
+
+  int opt, value;
+  while((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch(opt) {
+    case 'e':
+      value = nbody_parse_engine(optarg);
+      if(value < 0) {
+	fprintf(stderr, "Unknown engine '%s'\n", optarg);
+	exit(1);
+      }
+      params.engine = value;
+      break;
+    case 'k':
+      value = nbody_parse_kernel(optarg);
+      if(value < 0) {
+	fprintf(stderr, "Unknown kernel '%s'\n", optarg);
+	exit(1);
+      }
+      params.kernel = value;
+      break;
+    case 'o':
+      params.theta = atof(optarg);
+      break;
+    case 'm':
+      params.pm_grid = atoi(optarg);
+      break;
+    case 't':
+      params.nthreads = atoi(optarg);
+      break;
+    case 'u':
+      params.chunk = atoi(optarg);
+      break;
+    case 'a':
+      error_bound = atof(optarg);
+      break;
+    case 'f':
+      tune_cache = optarg;
+      break;
+    case 's':
+      params.reorder_interval = atoi(optarg);
+      break;
+    case 'g':
+      params.diag_interval = atoi(optarg);
+      break;
+    case 'j':
+      params.trajectory_file = TRAJECTORY_FILE;
+      params.trajectory_interval = atoi(optarg);
+      break;
+    case 'c':
+      params.checkpoint_file = CHECKPOINT_FILE;
+      params.checkpoint_interval = atoi(optarg);
+      break;
+    case 'r':
+      restart_file = optarg;
+      break;
+    case 'd':
+      dump_file = optarg;
+      break;
+    case 'h':
+      params.huge_pages = 1;
+      break;
+    case 'p':
+      placement = 1;
+      break;
+    case 'x':
+      display = 1;
+      break;
+    case 'b':
+      draw_boxes = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  /* positional arguments */
+  argc -= optind-1;
+  argv += optind-1;
+
+  if(argc >= 2) {
+    params.nparticles = atoi(argv[1]);
+  }
+  if(argc >= 3) {
+    params.t_final = atof(argv[2]);
+  }
+  if(argc >= 4) {
+    params.distribution = parse_distribution(argv[3]);
+    if(params.distribution < 0) {
+      fprintf(stderr, "Unknown distribution '%s'\n", argv[3]);
+      exit(1);
+    }
+  }
+  if(argc >= 5) {
+    params.seed = strtoull(argv[4], NULL, 10);
+  }
+
+  nbody_sim_t* sim;
+  if(restart_file) {
+    sim = nbody_restart(restart_file, &params);
+    if(!sim) {
+      fprintf(stderr, "Cannot restart from '%s'\n", restart_file);
+      exit(1);
+    }
+    /* the distribution and the seed of the command line are ignored: print the ones of the checkpoint */
+    nbody_get_params(sim, &params);
+    printf("Restarting at step %d (t=%f)\n", nbody_steps(sim), nbody_time(sim));
+  } else {
+    if(error_bound > 0 && nbody_autotune(&params, error_bound, tune_cache, stdout)) {
+      fprintf(stderr, "Cannot tune the %s engine\n", nbody_engine_name(params.engine));
+      exit(1);
+    }
+    sim = nbody_create(&params);
+    if(!sim) {
+      fprintf(stderr, "Invalid simulation parameters\n");
+      exit(1);
+    }
+  }
+
+  /* Initialize thread data structures */
+  if(display) {
+    /* Open an X window to display the particles */
+    simple_init (100,100,DISPLAY_SIZE, DISPLAY_SIZE);
+  }
+
+  struct timeval t1, t2;
+  gettimeofday(&t1, NULL);
+
+  /* Main thread starts simulation ... */
+  while(nbody_step(sim)) {
+    /* Plot the movement of the particle */
+    if(display) {
+      clear_display();
+      nbody_draw(sim, draw_boxes);
+      flush_display();
+    }
+  }
+
+  gettimeofday(&t2, NULL);
+
+  double duration = (t2.tv_sec -t1.tv_sec)+((t2.tv_usec-t1.tv_usec)/1e6);
+
+  if(dump_file) {
+    FILE* f_out = fopen(dump_file, "w");
+    if(!f_out) {
+      perror(dump_file);
+      exit(1);
+    }
+    nbody_print_particles(sim, f_out);
+    fclose(f_out);
+  }
+
+  printf("-----------------------------\n");
+  printf("nparticles: %d\n", nbody_nparticles(sim));
+  printf("T_FINAL: %f\n", params.t_final);
+  printf("distribution: %s (seed %llu)\n", distribution_name(params.distribution), params.seed);
+  printf("-----------------------------\n");
+  printf("Simulation took %lf s to complete\n", duration);
+  if(placement) {
+    nbody_print_placement(sim, stdout);
+  }
+
+  if(display) {
+    clear_display();
+    nbody_draw(sim, draw_boxes);
+    flush_display();
+
+    printf("Hit return to close the window.");
+
+    getchar();
+    /* Close the X window used to display the particles */
+    XCloseDisplay(theDisplay);
+  }
+
+  nbody_destroy(sim);
+  return 0;
+}
@@ -0,0 +1,418 @@
+/*
+** nbody_pm.c - particle-mesh solver for the long-range forces of the TreePM engine
+**
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "nbody.h"
+#include "nbody_reorder.h"
+#include "nbody_pm.h"
+
+#define EULER_GAMMA 0.57721566490153286061
+
+/* number of empty nodes kept between the particles and the border of the
+ * mesh, so that the cloud-in-cell stencil and the finite differences stay inside */
+#define PM_MARGIN 3
+
+struct pm_grid {
+  int n;			/* the mesh has n x n nodes */
+  int nfft;			/* size of the padded mesh: 2*n */
+  double x_min, y_min;		/* position of node (0,0) */
+  double cell;			/* distance between two nodes */
+  double r_split;
+  double green_0, green_1, green_11; /* Green function at (0,0), (1,0) and (1,1) */
+  double* mass;			/* n x n: mass assigned to the nodes */
+  int nthreads;			/* number of per-thread meshes */
+  double* thread_mass;		/* nthreads x n x n: mass assigned by each thread */
+  double* thread_total;		/* nthreads: mass of the particles of each thread */
+  double* phi;			/* n x n: potential at the nodes */
+  double* x_field;		/* n x n: -grad(phi) */
+  double* y_field;
+  double complex* rho;		/* nfft x nfft: masses, then potential */
+  double complex* green;	/* nfft x nfft: Green function */
+  double complex* roots;	/* nfft/2 roots of unity: exp(-2*i*pi*k/nfft) */
+};
+
+/* E1(x) + ln(x) + gamma, computed with its power series (0 <= x <= 1) */
+static double e1_series(double x) {
+  double term = x;
+  double sum = 0;
+  int k;
+  for(k=1; k<=20; k++) {
+    sum += term/k;
+    term *= -x/(k+1);
+  }
+  return sum;
+}
+
+/* E1(x) for x >= 1: rational approximation of Abramowitz and Stegun (error < 5e-8) */
+static double exp_integral(double x) {
+  double num = (((x + 8.5733287401)*x + 18.0590169730)*x + 8.6347608925)*x + 0.2677737343;
+  double den = (((x + 9.5733223454)*x + 25.6329561486)*x + 21.0996530827)*x + 3.9584969228;
+  return exp(-x)/x * num/den;
+}
+
+double pm_long_range_potential(double dist_sq, double r_split) {
+  double scale_sq = 4*r_split*r_split;
+  double x = dist_sq/scale_sq;
+  if(x <= 1) {
+    /* ln(d^2) + E1(x) = ln(4*r_split^2) - gamma + e1_series(x),
+     * which does not cancel out when d goes to 0 */
+    return 0.5*(log(scale_sq) - EULER_GAMMA + e1_series(x));
+  }
+  return 0.5*(log(dist_sq) + exp_integral(x));
+}
+
+/* in-place radix-2 FFT of a[0..n-1]. roots are the roots of unity of a
+ * transform of size root_n. The inverse transform is not scaled */
+static void fft(double complex* a, int n, const double complex* roots, int root_n, int inverse) {
+  int i, j, len;
+
+  /* bit-reversal permutation */
+  for(i=1, j=0; i<n; i++) {
+    int bit = n>>1;
+    for(; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if(i < j) {
+      double complex tmp = a[i];
+      a[i] = a[j];
+      a[j] = tmp;
+    }
+  }
+
+  for(len=2; len<=n; len<<=1) {
+    int half = len/2;
+    int root_step = root_n/len;
+    for(i=0; i<n; i+=len) {
+      for(j=0; j<half; j++) {
+	double complex w = inverse ? conj(roots[j*root_step]) : roots[j*root_step];
+	double complex u = a[i+j];
+	double complex v = a[i+j+half]*w;
+	a[i+j] = u + v;
+	a[i+j+half] = u - v;
+      }
+    }
+  }
+}
+
+/* transform the rows first..last-1 of the nfft x nfft array a */
+static void fft_rows(struct pm_grid* pm, double complex* a, int first, int last, int inverse) {
+  int nfft = pm->nfft;
+  int i;
+#pragma omp parallel for schedule(static)
+  for(i=first; i<last; i++) {
+    fft(&a[(size_t) i*nfft], nfft, pm->roots, nfft, inverse);
+  }
+}
+
+/* transform the columns of the nfft x nfft array a. Each thread copies the
+ * column it works on in a contiguous buffer */
+static void fft_columns(struct pm_grid* pm, double complex* a, int inverse) {
+  int nfft = pm->nfft;
+  int i;
+#pragma omp parallel
+  {
+    double complex* column = malloc(sizeof(double complex)*nfft);
+    assert(column);
+#pragma omp for schedule(static)
+    for(i=0; i<nfft; i++) {
+      int j;
+      for(j=0; j<nfft; j++) {
+	column[j] = a[(size_t) j*nfft + i];
+      }
+      fft(column, nfft, pm->roots, nfft, inverse);
+      for(j=0; j<nfft; j++) {
+	a[(size_t) j*nfft + i] = column[j];
+      }
+    }
+    free(column);
+  }
+}
+
+/* sinc(x)^2 */
+static double sinc_sq(double x) {
+  if(x == 0) {
+    return 1;
+  }
+  double s = sin(x)/x;
+  return s*s;
+}
+
+/*
+  Compute the transform of the Green function of a mesh whose cell size is 1.
+  With a cell size c, phi_long(d) = ln(c) + phi_long(d/c) since r_split is
+  proportional to c: the Green function only changes by a constant, which
+  does not change the forces.
+*/
+static void init_green(struct pm_grid* pm) {
+  int n = pm->n;
+  int nfft = pm->nfft;
+
+  /*
+    The Green function is sampled for the separations -n..n of the padded
+    mesh, wrapped around: the circular convolution of the zero-padded masses
+    is then the convolution of an isolated system.
+  */
+  int i;
+#pragma omp parallel for schedule(static)
+  for(i=0; i<nfft; i++) {
+    int j;
+    double dy = (i <= n ? i : i - nfft);
+    for(j=0; j<nfft; j++) {
+      double dx = (j <= n ? j : j - nfft);
+      pm->green[(size_t) i*nfft + j] =
+	GRAV_CONSTANT*pm_long_range_potential(dx*dx + dy*dy, PM_SPLIT);
+    }
+  }
+  fft_rows(pm, pm->green, 0, nfft, 0);
+  fft_columns(pm, pm->green, 0);
+
+  /*
+    The cloud-in-cell assignment and interpolation both smooth the field by
+    the window W(k) = (sinc(kx*cell/2)*sinc(ky*cell/2))^2: divide it out.
+  */
+#pragma omp parallel for schedule(static)
+  for(i=0; i<nfft; i++) {
+    int j;
+    double w_y = sinc_sq(M_PI*(i <= n ? i : i - nfft)/nfft);
+    for(j=0; j<nfft; j++) {
+      double w_x = sinc_sq(M_PI*(j <= n ? j : j - nfft)/nfft);
+      double w = w_x*w_y;
+      pm->green[(size_t) i*nfft + j] /= w*w;
+    }
+  }
+
+  /*
+    Green function actually applied at the separations (0,0), (1,0) and (1,1),
+    to remove the interaction of a cloud with itself from the potential.
+  */
+  double green_0 = 0, green_1 = 0, green_11 = 0;
+#pragma omp parallel for schedule(static) reduction(+:green_0, green_1, green_11)
+  for(i=0; i<nfft; i++) {
+    int j;
+    double complex shift_y = cexp(2*M_PI*I*i/nfft);
+    for(j=0; j<nfft; j++) {
+      double complex shift_x = cexp(2*M_PI*I*j/nfft);
+      double complex g = pm->green[(size_t) i*nfft + j];
+      green_0 += creal(g);
+      green_1 += creal(g*shift_x);
+      green_11 += creal(g*shift_x*shift_y);
+    }
+  }
+  double scale = 1.0/((double) nfft*nfft);
+  pm->green_0 = green_0*scale;
+  pm->green_1 = green_1*scale;
+  pm->green_11 = green_11*scale;
+}
+
+/* place the mesh on the box [x_min,x_max]x[y_min,y_max] */
+static void place_mesh(struct pm_grid* pm, double x_min, double x_max, double y_min, double y_max) {
+  int n = pm->n;
+  double extent = MAX(x_max - x_min, y_max - y_min);
+  if(extent <= 0) {
+    extent = 1;
+  }
+  pm->cell = extent/(n - 2*PM_MARGIN - 1);
+  pm->x_min = (x_min + x_max)/2 - (n-1)/2.*pm->cell;
+  pm->y_min = (y_min + y_max)/2 - (n-1)/2.*pm->cell;
+  pm->r_split = PM_SPLIT*pm->cell;
+}
+
+struct pm_grid* pm_create(int n) {
+  assert(n >= 16 && (n & (n-1)) == 0);
+  struct pm_grid* pm = malloc(sizeof(struct pm_grid));
+  assert(pm);
+  pm->n = n;
+  pm->nfft = 2*n;
+
+  size_t nnodes = (size_t) n*n;
+  size_t nfft_nodes = (size_t) pm->nfft*pm->nfft;
+  pm->mass = malloc(sizeof(double)*nnodes);
+  pm->phi = malloc(sizeof(double)*nnodes);
+  pm->x_field = malloc(sizeof(double)*nnodes);
+  pm->y_field = malloc(sizeof(double)*nnodes);
+  pm->rho = malloc(sizeof(double complex)*nfft_nodes);
+  pm->green = malloc(sizeof(double complex)*nfft_nodes);
+  pm->roots = malloc(sizeof(double complex)*pm->nfft/2);
+  pm->nthreads = omp_get_max_threads();
+  pm->thread_mass = malloc(sizeof(double)*pm->nthreads*nnodes);
+  pm->thread_total = malloc(sizeof(double)*pm->nthreads);
+  assert(pm->mass && pm->phi && pm->x_field && pm->y_field &&
+	 pm->rho && pm->green && pm->roots && pm->thread_mass && pm->thread_total);
+
+  int k;
+  for(k=0; k<pm->nfft/2; k++) {
+    pm->roots[k] = cexp(-2*M_PI*I*k/pm->nfft);
+  }
+  init_green(pm);
+  return pm;
+}
+
+void pm_destroy(struct pm_grid* pm) {
+  if(!pm) return;
+  free(pm->mass);
+  free(pm->phi);
+  free(pm->x_field);
+  free(pm->y_field);
+  free(pm->rho);
+  free(pm->green);
+  free(pm->roots);
+  free(pm->thread_mass);
+  free(pm->thread_total);
+  free(pm);
+}
+
+/* cloud-in-cell stencil of p: the nodes (ix..ix+1, iy..iy+1) and the weights
+ * of the nodes ix+1 and iy+1 */
+static void locate(struct pm_grid* pm, particle_t* p, int* ix, int* iy, double* fx, double* fy) {
+  double u = (p->x_pos - pm->x_min)/pm->cell;
+  double v = (p->y_pos - pm->y_min)/pm->cell;
+  *ix = (int) floor(u);
+  *iy = (int) floor(v);
+  *fx = u - *ix;
+  *fy = v - *iy;
+}
+
+/* interpolate the mesh field f at the stencil (ix, iy, fx, fy) */
+static double interpolate(struct pm_grid* pm, double* f, int ix, int iy, double fx, double fy) {
+  double* row = &f[(size_t) iy*pm->n + ix];
+  return ((1-fx)*row[0] + fx*row[1])*(1-fy) + ((1-fx)*row[pm->n] + fx*row[pm->n+1])*fy;
+}
+
+/* potential energy between the cloud of a particle of mass m and itself */
+static double self_potential(struct pm_grid* pm, double m, double fx, double fy) {
+  double x_0 = (1-fx)*(1-fx) + fx*fx;
+  double x_1 = 2*fx*(1-fx);
+  double y_0 = (1-fy)*(1-fy) + fy*fy;
+  double y_1 = 2*fy*(1-fy);
+  return m*m*(x_0*y_0*pm->green_0 + (x_1*y_0 + x_0*y_1)*pm->green_1 + x_1*y_1*pm->green_11);
+}
+
+double pm_compute_forces(struct pm_grid* pm, particle_t* particles, int n, double* potential) {
+  int size = pm->n;
+  int nfft = pm->nfft;
+  size_t nnodes = (size_t) size*size;
+  int i;
+
+  double x_min, x_max, y_min, y_max;
+  get_bounding_box(particles, n, &x_min, &x_max, &y_min, &y_max);
+  place_mesh(pm, x_min, x_max, y_min, y_max);
+
+  /* cloud-in-cell mass assignment: each thread fills its own mesh. The
+   * meshes are then added node by node, in the order of the threads, so
+   * that the sums do not depend on the order in which the threads finish */
+  int nteam = 1;
+#pragma omp parallel num_threads(pm->nthreads)
+  {
+    int t = omp_get_thread_num();
+    double* mass = &pm->thread_mass[t*nnodes];
+    double total = 0;
+#pragma omp single
+    nteam = omp_get_num_threads();
+    memset(mass, 0, sizeof(double)*nnodes);
+#pragma omp for schedule(static)
+    for(i=0; i<n; i++) {
+      int ix, iy;
+      double fx, fy;
+      locate(pm, &particles[i], &ix, &iy, &fx, &fy);
+      double* row = &mass[(size_t) iy*size + ix];
+      double m = particles[i].mass;
+      total += m;
+      row[0] += m*(1-fx)*(1-fy);
+      row[1] += m*fx*(1-fy);
+      row[size] += m*(1-fx)*fy;
+      row[size+1] += m*fx*fy;
+    }
+    pm->thread_total[t] = total;
+  }
+  double total_mass = 0;
+  int t;
+  for(t=0; t<nteam; t++) {
+    total_mass += pm->thread_total[t];
+  }
+  long k;
+#pragma omp parallel for schedule(static)
+  for(k=0; k<(long) nnodes; k++) {
+    double m = 0;
+    int t;
+    for(t=0; t<nteam; t++) {
+      m += pm->thread_mass[t*nnodes + k];
+    }
+    pm->mass[k] = m;
+  }
+
+  /* convolution with the Green function. The rows >= size of the padded
+   * masses are empty, and only the rows < size of the potential are used */
+#pragma omp parallel for schedule(static)
+  for(i=0; i<nfft; i++) {
+    int j;
+    double complex* row = &pm->rho[(size_t) i*nfft];
+    for(j=0; j<nfft; j++) {
+      row[j] = (i < size && j < size) ? pm->mass[(size_t) i*size + j] : 0;
+    }
+  }
+  fft_rows(pm, pm->rho, 0, size, 0);
+  fft_columns(pm, pm->rho, 0);
+  double scale = 1.0/((double) nfft*nfft);
+#pragma omp parallel for schedule(static)
+  for(i=0; i<nfft; i++) {
+    int j;
+    for(j=0; j<nfft; j++) {
+      pm->rho[(size_t) i*nfft + j] *= pm->green[(size_t) i*nfft + j]*scale;
+    }
+  }
+  fft_columns(pm, pm->rho, 1);
+  fft_rows(pm, pm->rho, 0, size, 1);
+
+  /* potential and field at the nodes */
+#pragma omp parallel for schedule(static)
+  for(i=0; i<size; i++) {
+    int j;
+    for(j=0; j<size; j++) {
+      pm->phi[(size_t) i*size + j] = creal(pm->rho[(size_t) i*nfft + j]);
+    }
+  }
+#pragma omp parallel for schedule(static)
+  for(i=0; i<size; i++) {
+    int j;
+    for(j=0; j<size; j++) {
+      size_t k = (size_t) i*size + j;
+      if(i < 2 || j < 2 || i >= size-2 || j >= size-2) {
+	pm->x_field[k] = 0;
+	pm->y_field[k] = 0;
+      } else {
+	/* 4-point finite differences */
+	double* phi = pm->phi;
+	pm->x_field[k] = -(8*(phi[k+1] - phi[k-1]) - (phi[k+2] - phi[k-2]))/(12*pm->cell);
+	pm->y_field[k] = -(8*(phi[k+size] - phi[k-size]) - (phi[k+2*size] - phi[k-2*size]))/(12*pm->cell);
+      }
+    }
+  }
+
+  /* interpolation back to the particles. The potential of the mesh of cell
+   * size 1 is shifted by ln(cell) per unit mass */
+  double shift = GRAV_CONSTANT*log(pm->cell);
+#pragma omp parallel for schedule(static)
+  for(i=0; i<n; i++) {
+    particle_t* p = &particles[i];
+    int ix, iy;
+    double fx, fy;
+    locate(pm, p, &ix, &iy, &fx, &fy);
+    p->x_force = p->mass*interpolate(pm, pm->x_field, ix, iy, fx, fy);
+    p->y_force = p->mass*interpolate(pm, pm->y_field, ix, iy, fx, fy);
+    if(potential) {
+      potential[i] = p->mass*(interpolate(pm, pm->phi, ix, iy, fx, fy) + shift*total_mass)
+	- self_potential(pm, p->mass, fx, fy) - shift*p->mass*p->mass;
+    }
+  }
+  return pm->r_split;
+}
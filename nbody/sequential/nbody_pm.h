@@ -0,0 +1,42 @@
+#ifndef NBODY_PM_H
+#define NBODY_PM_H
+#include "nbody.h"
+
+/*
+  Particle-mesh solver for the long-range part of the forces (TreePM).
+
+  The force between two particles is split with a gaussian of scale r_split:
+    F = F_short + F_long,  F_long = GMm/d * (1 - exp(-d^2/(4*r_split^2)))
+  F_long is smooth and derives from the potential
+    G*phi_long(d),  phi_long(d) = ln(d) + E1(d^2/(4*r_split^2))/2
+  so it is computed on a mesh: the masses are assigned to the mesh
+  (cloud-in-cell), convolved with phi_long by FFT on a mesh twice as large
+  (zero padding, so that the domain is not periodic), differentiated and
+  interpolated back to the particles. F_short vanishes beyond a few r_split
+  and is computed by walking the tree.
+*/
+
+/* r_split, in mesh cells */
+#define PM_SPLIT   1.25
+/* the short-range forces are neglected beyond PM_CUTOFF*r_split */
+#define PM_CUTOFF  4.5
+
+struct pm_grid;
+
+/* create a solver with a mesh of n x n cells (n must be a power of 2, at least 16) */
+struct pm_grid* pm_create(int n);
+
+void pm_destroy(struct pm_grid* pm);
+
+/*
+  Place the mesh on the bounding box of the particles and store their
+  long-range forces in x_force/y_force. If potential is not NULL, potential[i]
+  receives the long-range potential energy between particle i and the others.
+  Return r_split (in distance units).
+*/
+double pm_compute_forces(struct pm_grid* pm, particle_t* particles, int n, double* potential);
+
+/* phi_long at squared distance dist_sq (finite when dist_sq is 0) */
+double pm_long_range_potential(double dist_sq, double r_split);
+
+#endif	/* NBODY_PM_H */
@@ -0,0 +1,140 @@
+/*
+** nbody_reference.c - exact forces of a sample of the particles
+**
+** The exact force on a particle is an O(n) sum over all the particles, with
+** the same rule as the engines, so checking k particles costs O(k*n) and
+** large problems can be checked. The ids are drawn without replacement with
+** a partial Fisher-Yates shuffle of 0..nids-1.
+**/
+
+#include <stdlib.h>
+#include <math.h>
+#include <omp.h>
+
+#include "nbody.h"
+#include "nbody_rng.h"
+#include "nbody_reference.h"
+
+/* exact force that the particles apply to particles[i] */
+static void exact_force(struct nbody_particle* particles, int n, int i,
+			double* x_force, double* y_force) {
+  struct nbody_particle* p = &particles[i];
+  double fx = 0, fy = 0;
+  int j;
+  for(j=0; j<n; j++) {
+    if(j == i) {
+      continue;
+    }
+    double x_sep = particles[j].x_pos - p->x_pos;
+    double y_sep = particles[j].y_pos - p->y_pos;
+    double dist_sq = MAX((x_sep*x_sep) + (y_sep*y_sep), MIN_DIST_SQ);
+    double grav_base = GRAV_CONSTANT*(p->mass)*(particles[j].mass)/dist_sq;
+    fx += grav_base*x_sep;
+    fy += grav_base*y_sep;
+  }
+  *x_force = fx;
+  *y_force = fy;
+}
+
+/* copy the particles of sim into a new array, and set *n to their number */
+static struct nbody_particle* get_particles(nbody_sim_t* sim, int* n) {
+  struct nbody_particle* particles = malloc(sizeof(struct nbody_particle)*nbody_nparticles(sim));
+  *n = nbody_get_particles(sim, particles);
+  return particles;
+}
+
+/* position of each id in particles (-1: the particle was lost) */
+static int* slot_map(struct nbody_particle* particles, int n, int nids) {
+  int* slot = malloc(sizeof(int)*nids);
+  int i;
+  for(i=0; i<nids; i++) {
+    slot[i] = -1;
+  }
+  for(i=0; i<n; i++) {
+    slot[particles[i].id] = i;
+  }
+  return slot;
+}
+
+struct nbody_reference* nbody_reference_create(nbody_sim_t* sim, int nids,
+					       uint64_t seed, int nsamples) {
+  int n;
+  struct nbody_particle* particles = get_particles(sim, &n);
+  int* slot = slot_map(particles, n, nids);
+
+  if(nsamples > nids) {
+    nsamples = nids;
+  }
+  int* shuffle = malloc(sizeof(int)*nids);
+  int i;
+  for(i=0; i<nids; i++) {
+    shuffle[i] = i;
+  }
+  for(i=0; i<nsamples; i++) {
+    int j = i + rng_u64(seed, i) % (nids - i);
+    int tmp = shuffle[i];
+    shuffle[i] = shuffle[j];
+    shuffle[j] = tmp;
+  }
+
+  struct nbody_reference* ref = malloc(sizeof(struct nbody_reference));
+  ref->nids = nids;
+  ref->nsamples = 0;
+  ref->ids = malloc(sizeof(int)*nsamples);
+  ref->x_force = malloc(sizeof(double)*nsamples);
+  ref->y_force = malloc(sizeof(double)*nsamples);
+  for(i=0; i<nsamples; i++) {
+    if(slot[shuffle[i]] >= 0) {
+      ref->ids[ref->nsamples++] = shuffle[i];
+    }
+  }
+
+  double t1 = omp_get_wtime();
+#pragma omp parallel for schedule(dynamic)
+  for(i=0; i<ref->nsamples; i++) {
+    exact_force(particles, n, slot[ref->ids[i]], &ref->x_force[i], &ref->y_force[i]);
+  }
+  ref->time = omp_get_wtime() - t1;
+
+  free(shuffle);
+  free(slot);
+  free(particles);
+  return ref;
+}
+
+void nbody_reference_destroy(struct nbody_reference* ref) {
+  free(ref->ids);
+  free(ref->x_force);
+  free(ref->y_force);
+  free(ref);
+}
+
+int nbody_reference_error(const struct nbody_reference* ref, nbody_sim_t* sim,
+			  double* rms_error, double* max_error) {
+  int n;
+  struct nbody_particle* particles = get_particles(sim, &n);
+  int* slot = slot_map(particles, n, ref->nids);
+
+  double sum_sq = 0;
+  int nchecked = 0;
+  *max_error = 0;
+  int i;
+  for(i=0; i<ref->nsamples; i++) {
+    int k = slot[ref->ids[i]];
+    double norm = sqrt(ref->x_force[i]*ref->x_force[i] + ref->y_force[i]*ref->y_force[i]);
+    if(k < 0 || norm == 0) {
+      continue;
+    }
+    double dx = particles[k].x_force - ref->x_force[i];
+    double dy = particles[k].y_force - ref->y_force[i];
+    double error = sqrt(dx*dx + dy*dy)/norm;
+    sum_sq += error*error;
+    *max_error = MAX(*max_error, error);
+    nchecked++;
+  }
+  *rms_error = nchecked ? sqrt(sum_sq/nchecked) : 0;
+
+  free(slot);
+  free(particles);
+  return nchecked;
+}
@@ -0,0 +1,33 @@
+#ifndef NBODY_REFERENCE_H
+#define NBODY_REFERENCE_H
+#include <stdint.h>
+#include "libnbody.h"
+
+/*
+  Exact forces of a sample of the particles, to measure the error of the
+  engines. The sample is a set of distinct particle ids that only depends on
+  the seed, so that all the engines are checked on the same particles,
+  whatever order they keep them in.
+*/
+struct nbody_reference {
+  int nids;			/* the ids are 0..nids-1 */
+  int nsamples;			/* number of sampled particles */
+  int* ids;
+  double* x_force;		/* exact forces of the sampled particles */
+  double* y_force;
+  double time;			/* time taken by the exact computation */
+};
+
+/* compute the exact forces of nsamples particles of sim drawn among the ids
+ * 0..nids-1 (all of them if nsamples >= nids). Lost particles are not sampled */
+struct nbody_reference* nbody_reference_create(nbody_sim_t* sim, int nids,
+					       uint64_t seed, int nsamples);
+
+void nbody_reference_destroy(struct nbody_reference* ref);
+
+/* rms and maximum relative error of the forces of sim on the particles of
+ * ref. Return the number of particles checked */
+int nbody_reference_error(const struct nbody_reference* ref, nbody_sim_t* sim,
+			  double* rms_error, double* max_error);
+
+#endif	/* NBODY_REFERENCE_H */
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "nbody.h"
+#include "nbody_reorder.h"
+
+#define MORTON_BITS   16	/* number of bits per coordinate */
+#define RADIX_BITS    8		/* number of bits sorted by each pass of the radix sort */
+#define RADIX_SIZE    (1<<RADIX_BITS)
+
+/* an entry of the array to sort: the key of a particle and its current index */
+struct sort_item {
+  uint32_t key;
+  int index;
+};
+
+/* spread the 16 lower bits of x so that there is a 0 between each bit */
+static uint32_t spread_bits(uint32_t x) {
+  x &= 0x0000FFFF;
+  x = (x | (x << 8)) & 0x00FF00FF;
+  x = (x | (x << 4)) & 0x0F0F0F0F;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  return x;
+}
+
+/* convert a coordinate to an integer in [0, 2^MORTON_BITS-2] */
+static uint32_t quantize(double pos, double min, double max) {
+  /* the largest value is not used so that no particle gets the MORTON_OUTSIDE key */
+  const double max_cell = (1<<MORTON_BITS) - 2;
+  if(max <= min) {
+    return 0;
+  }
+  double q = (pos - min) / (max - min) * max_cell;
+  if(q > max_cell) {
+    q = max_cell;
+  }
+  return (uint32_t) q;
+}
+
+uint32_t morton_key(double x, double y, double x_min, double x_max, double y_min, double y_max) {
+  if(!(x >= x_min && x <= x_max &&
+       y >= y_min && y <= y_max)) {
+    return MORTON_OUTSIDE;
+  }
+  uint32_t qx = quantize(x, x_min, x_max);
+  uint32_t qy = quantize(y, y_min, y_max);
+  return spread_bits(qx) | (spread_bits(qy) << 1);
+}
+
+/* compute the bounding box of an array of particles */
+void get_bounding_box(particle_t* particles, int n,
+		      double* x_min, double* x_max, double* y_min, double* y_max) {
+  double xmin = 0, xmax = 0, ymin = 0, ymax = 0;
+  if(n > 0) {
+    xmin = xmax = particles[0].x_pos;
+    ymin = ymax = particles[0].y_pos;
+  }
+  int i;
+#pragma omp parallel for reduction(min:xmin, ymin) reduction(max:xmax, ymax)
+  for(i=0; i<n; i++) {
+    double x = particles[i].x_pos;
+    double y = particles[i].y_pos;
+    if(x < xmin) xmin = x;
+    if(x > xmax) xmax = x;
+    if(y < ymin) ymin = y;
+    if(y > ymax) ymax = y;
+  }
+  *x_min = xmin;
+  *x_max = xmax;
+  *y_min = ymin;
+  *y_max = ymax;
+}
+
+/*
+  Sort items by key with a parallel LSD radix sort.
+  Each thread builds the histogram of its (static) part of the array, then the
+  threads scatter their items to the positions given by the prefix sum of the
+  histograms. Since each thread handles a contiguous part of the array and the
+  threads are ordered in the prefix sum, every pass is stable.
+*/
+static void radix_sort(struct sort_item* items, struct sort_item* tmp, int n) {
+  int* hist = NULL;
+  int nthreads = 1;
+
+#pragma omp parallel
+  {
+#pragma omp single
+    {
+      nthreads = omp_get_num_threads();
+      hist = malloc(sizeof(int) * RADIX_SIZE * nthreads);
+      assert(hist);
+    }
+
+    int tid = omp_get_thread_num();
+    int first = (int) ((long) n * tid / nthreads);
+    int last = (int) ((long) n * (tid+1) / nthreads);
+    int* my_hist = &hist[tid*RADIX_SIZE];
+    struct sort_item* src = items;
+    struct sort_item* dst = tmp;
+    int shift;
+
+    for(shift=0; shift<32; shift+=RADIX_BITS) {
+      int i, d;
+      memset(my_hist, 0, sizeof(int) * RADIX_SIZE);
+      for(i=first; i<last; i++) {
+	my_hist[(src[i].key >> shift) & (RADIX_SIZE-1)]++;
+      }
+#pragma omp barrier
+
+#pragma omp single
+      {
+	/* exclusive prefix sum, in (digit, thread) order */
+	int offset = 0;
+	for(d=0; d<RADIX_SIZE; d++) {
+	  int t;
+	  for(t=0; t<nthreads; t++) {
+	    int count = hist[t*RADIX_SIZE + d];
+	    hist[t*RADIX_SIZE + d] = offset;
+	    offset += count;
+	  }
+	}
+      }
+      /* implicit barrier at the end of single */
+
+      for(i=first; i<last; i++) {
+	int digit = (src[i].key >> shift) & (RADIX_SIZE-1);
+	dst[my_hist[digit]++] = src[i];
+      }
+#pragma omp barrier
+
+      struct sort_item* swap = src;
+      src = dst;
+      dst = swap;
+    }
+  }
+  /* 32/RADIX_BITS is even: the sorted array is back in items */
+  free(hist);
+}
+
+int reorder_particles(particle_t* particles, int* ids, int n,
+		      double x_min, double x_max, double y_min, double y_max) {
+  if(n <= 1) {
+    return (n == 1 && morton_key(particles[0].x_pos, particles[0].y_pos,
+				 x_min, x_max, y_min, y_max) != MORTON_OUTSIDE);
+  }
+
+  struct sort_item* items = malloc(sizeof(struct sort_item) * n);
+  struct sort_item* tmp = malloc(sizeof(struct sort_item) * n);
+  particle_t* sorted = malloc(sizeof(particle_t) * n);
+  int* sorted_ids = malloc(sizeof(int) * n);
+  assert(items && tmp && sorted && sorted_ids);
+
+  int i;
+  int nb_inside = 0;
+#pragma omp parallel for reduction(+:nb_inside)
+  for(i=0; i<n; i++) {
+    items[i].key = morton_key(particles[i].x_pos, particles[i].y_pos,
+			      x_min, x_max, y_min, y_max);
+    items[i].index = i;
+    if(items[i].key != MORTON_OUTSIDE) {
+      nb_inside++;
+    }
+  }
+
+  radix_sort(items, tmp, n);
+
+  /* apply the permutation */
+#pragma omp parallel for
+  for(i=0; i<n; i++) {
+    sorted[i] = particles[items[i].index];
+    sorted_ids[i] = ids[items[i].index];
+  }
+  memcpy(particles, sorted, sizeof(particle_t) * n);
+  memcpy(ids, sorted_ids, sizeof(int) * n);
+
+  free(items);
+  free(tmp);
+  free(sorted);
+  free(sorted_ids);
+  return nb_inside;
+}
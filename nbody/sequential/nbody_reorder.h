@@ -0,0 +1,28 @@
+#ifndef NBODY_REORDER_H
+#define NBODY_REORDER_H
+#include <stdint.h>
+#include "nbody.h"
+
+/* Compute the Morton (Z-order) key of position (x, y) in the box [x_min,x_max]x[y_min,y_max].
+ * Positions outside the box get the key MORTON_OUTSIDE, which is greater than every other key.
+ */
+#define MORTON_OUTSIDE 0xFFFFFFFFu
+uint32_t morton_key(double x, double y, double x_min, double x_max, double y_min, double y_max);
+
+/* compute the bounding box of an array of particles */
+void get_bounding_box(particle_t* particles, int n,
+		      double* x_min, double* x_max, double* y_min, double* y_max);
+
+/*
+  Sort the particles along the Morton curve of the box [x_min,x_max]x[y_min,y_max]
+  so that particles that are close in space are close in memory.
+
+  ids[i] is the original index of the particle stored in particles[i]; it is
+  permuted along with the particles so that the output stays stable.
+  Particles located outside the box are moved at the end of the array.
+  Return the number of particles inside the box.
+*/
+int reorder_particles(particle_t* particles, int* ids, int n,
+		      double x_min, double x_max, double y_min, double y_max);
+
+#endif	/* NBODY_REORDER_H */
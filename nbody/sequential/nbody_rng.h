@@ -0,0 +1,29 @@
+#ifndef NBODY_RNG_H
+#define NBODY_RNG_H
+#include <stdint.h>
+
+/*
+  Counter-based pseudo-random number generator.
+
+  rng_u64(seed, counter) returns the counter-th number of the stream 'seed'.
+  There is no state: any thread (or MPI rank) can compute any number of the
+  stream directly, so a slice of the particles can be generated without
+  generating the numbers that precede it.
+  The mixing function is the finalizer of splitmix64.
+*/
+static inline uint64_t rng_mix(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static inline uint64_t rng_u64(uint64_t seed, uint64_t counter) {
+  return rng_mix(rng_mix(seed) + (counter+1) * 0x9E3779B97F4A7C15ull);
+}
+
+/* return a double in [0, 1) */
+static inline double rng_double(uint64_t seed, uint64_t counter) {
+  return (rng_u64(seed, counter) >> 11) * 0x1.0p-53;
+}
+
+#endif	/* NBODY_RNG_H */
@@ -0,0 +1,84 @@
+#ifndef NBODY_SIM_H
+#define NBODY_SIM_H
+#include "nbody.h"
+#include "nbody_alloc.h"
+#include "nbody_diagnostics.h"
+#include "nbody_trajectory.h"
+#include <sys/types.h>
+#include "libnbody.h"
+
+/*
+  Internal definition of a simulation context, shared by libnbody.c and the engines.
+*/
+
+/* the operations that an engine implements */
+struct nbody_engine_ops {
+  const char* name;
+  /* build the engine data structures once the particles are initialized */
+  void (*init)(nbody_sim_t* sim);
+  /* compute the forces on the particles at their current position
+   * (and the diagnostics if sim->compute_diag is set) */
+  void (*compute_forces)(nbody_sim_t* sim);
+  /* move the particles with the forces computed by compute_forces */
+  void (*move_particles)(nbody_sim_t* sim, double step);
+  /* sort the particles along a space-filling curve */
+  void (*reorder)(nbody_sim_t* sim);
+  /* set alive[i] if particles[i] is still in the simulation, for i < nslots */
+  void (*mark_alive)(nbody_sim_t* sim, char* alive);
+  void (*print_particles)(nbody_sim_t* sim, FILE* f);
+  void (*draw)(nbody_sim_t* sim, int draw_boxes);
+  void (*finalize)(nbody_sim_t* sim);
+};
+
+extern const struct nbody_engine_ops brute_force_engine;
+extern const struct nbody_engine_ops barnes_hut_engine;
+extern const struct nbody_engine_ops treepm_engine;
+
+/* allocate/free sim->particles and sim->particle_ids (params.nparticles entries) */
+void alloc_particles(nbody_sim_t* sim);
+void free_particles(nbody_sim_t* sim);
+
+struct nbody_sim {
+  struct nbody_params params;
+  const struct nbody_engine_ops* engine;
+
+  int nparticles;		/* number of particles still in the simulation */
+  int nslots;			/* number of entries of particles (including the particles that left the domain) */
+  particle_t* particles;
+  int* particle_ids;		/* particle_ids[i] is the original index of particles[i] */
+
+  double t, dt;			/* current time and time step */
+  int step;			/* number of steps done */
+
+  /* statistics computed when moving the particles */
+  double sum_speed_sq;
+  double max_acc;
+  double max_speed;
+
+  /* when set, the force phase also computes the diagnostics */
+  int compute_diag;
+  int has_diag;			/* set once diag holds a result */
+  struct diagnostics diag;
+
+  /* trajectory output */
+  struct trajectory_writer* trajectory;
+  char* alive;			/* scratch buffer for mark_alive */
+
+  /* checkpoints */
+  pid_t checkpoint_pid;		/* process writing the last checkpoint */
+
+  /* brute force: kernel selected at init, and the positions and masses
+   * copied in structure-of-arrays layout for the vectorized kernels */
+  void (*force_kernel)(nbody_sim_t* sim);
+  double* soa;
+  float* soa_float;
+
+  /* Barnes-Hut */
+  node_t* root;
+  struct memory_t mem_node;
+
+  /* TreePM */
+  struct pm_grid* pm;
+};
+
+#endif	/* NBODY_SIM_H */
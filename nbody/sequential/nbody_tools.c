@@ -1,30 +1,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <assert.h>
+#include <omp.h>
 
 #include "ui.h"
 #include "nbody.h"
 #include "nbody_tools.h"
 #include "nbody_alloc.h"
-
-extern node_t* root;
+#include "nbody_generators.h"
+#include "nbody_diagnostics.h"
 
 /* draw recursively the content of a node */
-void draw_node(node_t* n) {
-#ifndef DISPLAY
-  return;
-#else
+void draw_node(node_t* n, int draw_boxes) {
   if(!n)
     return;
 
-#if DRAW_BOXES
-  int x1 = POS_TO_SCREEN(n->x_min);
-  int y1 = POS_TO_SCREEN(n->y_min);
-  int x2 = POS_TO_SCREEN(n->x_max);
-  int y2 = POS_TO_SCREEN(n->y_max);
-  draw_rect(x1, y1, x2, y2);
-#endif
+  if(draw_boxes) {
+    int x1 = POS_TO_SCREEN(n->x_min);
+    int y1 = POS_TO_SCREEN(n->y_min);
+    int x2 = POS_TO_SCREEN(n->x_max);
+    int y2 = POS_TO_SCREEN(n->y_max);
+    draw_rect(x1, y1, x2, y2);
+  }
 
   if(n->particle) {
     int x = POS_TO_SCREEN(n->particle->x_pos);
@@ -41,11 +40,9 @@ void draw_node(node_t* n) {
 
     int i;
     for(i=0; i<4; i++) {
-      draw_node(&n->children[i]);
+      draw_node(&n->children[i], draw_boxes);
     }
   }
-
-#endif
 }
 
 
@@ -67,6 +64,89 @@ void print_particles(FILE* f, node_t*n) {
   }
 }
 
+/* compute the force that a particle with position (x_pos, y_pos) and mass 'mass'
+ * applies to particle p. If potential is not NULL, the potential energy of the
+ * pair is added to it.
+ */
+static void compute_force(particle_t*p, double x_pos, double y_pos, double mass, double *potential) {
+  double x_sep, y_sep, dist_sq, grav_base;
+
+  x_sep = x_pos - p->x_pos;
+  y_sep = y_pos - p->y_pos;
+  dist_sq = (x_sep*x_sep) + (y_sep*y_sep);
+  if(potential) {
+    *potential += pair_potential(dist_sq, p->mass, mass);
+  }
+  dist_sq = MAX(dist_sq, MIN_DIST_SQ);
+
+  /* Use the 2-dimensional gravity rule: F = d * (GMm/d^2) */
+  grav_base = GRAV_CONSTANT*(p->mass)*(mass)/dist_sq;
+
+  p->x_force += grav_base*x_sep;
+  p->y_force += grav_base*y_sep;
+}
+
+/* compute the force that node n acts on particle p. The nodes such that
+ * size/distance < theta are approximated by their center of mass.
+ * If potential is not NULL, the potential energy between n and p is added to it.
+ */
+void compute_force_on_particle(node_t* n, particle_t *p, double theta, double *potential) {
+  if(! n) {
+    return;
+  }
+  node_t* stack[WALK_STACK_SIZE(n)];
+  int top = 0;
+  stack[top++] = n;
+
+  while(top > 0) {
+    n = stack[--top];
+    if(n->n_particles==0) {
+      continue;
+    }
+    if(n->particle) {
+      /* only one particle */
+      assert(n->children == NULL);
+
+      /*
+	If the current node is an external node (and it is not body b),
+	calculate the force exerted by the current node on b, and add
+	this amount to b's net force.
+      */
+      compute_force(p, n->x_center, n->y_center, n->mass,
+		    n->particle == p ? NULL : potential);
+      continue;
+    }
+    /* There are multiple particles */
+
+    double size = n->x_max - n->x_min; // width of n
+    double diff_x = n->x_center - p->x_pos;
+    double diff_y = n->y_center - p->y_pos;
+    double distance = sqrt(diff_x*diff_x + diff_y*diff_y);
+
+    /*
+      Use the Barnes-Hut algorithm to get an approximation.
+      With theta = 0, the nodes are always opened: this results in a
+      brute-force computation (complexity: O(n*n))
+    */
+    if(size / distance < theta) {
+      /*
+	The particle is far away. Use an approximation of the force
+      */
+      compute_force(p, n->x_center, n->y_center, n->mass, potential);
+    } else {
+      /*
+	Otherwise, visit the current node's children. They are pushed
+	in reverse order so that child 0 is visited first.
+      */
+      prefetch_children(n);
+      int i;
+      for(i=3; i>=0; i--) {
+	stack[top++] = &n->children[i];
+      }
+    }
+  }
+}
+
 /* Initialize a node */
 void init_node(node_t* n, node_t* parent, double x_min, double x_max, double y_min, double y_max) {
   n->parent = parent;
@@ -129,8 +209,41 @@ int get_quadrant(particle_t* particle, node_t*node) {
   }
 }
 
+/* split node in 4 children allocated from mem */
+static void create_children(node_t* node, struct memory_t* mem) {
+  node->children = alloc_node(mem);
+  double x_min = node->x_min;
+  double x_max = node->x_max;
+  double x_center = x_min+(x_max-x_min)/2;
+
+  double y_min = node->y_min;
+  double y_max = node->y_max;
+  double y_center = y_min+(y_max-y_min)/2;
+
+  init_node(&node->children[0], node, x_min, x_center, y_min, y_center);
+  init_node(&node->children[1], node, x_center, x_max, y_min, y_center);
+  init_node(&node->children[2], node, x_min, x_center, y_center, y_max);
+  init_node(&node->children[3], node, x_center, x_max, y_center, y_max);
+}
+
+/* compute the mass and center of node from those of its children */
+static void update_center(node_t* node) {
+  double total_mass = 0;
+  double total_x = 0;
+  double total_y = 0;
+  int i;
+  for(i=0; i<4; i++) {
+    total_mass += node->children[i].mass;
+    total_x += node->children[i].x_center*node->children[i].mass;
+    total_y += node->children[i].y_center*node->children[i].mass;
+  }
+  node->mass = total_mass;
+  node->x_center = total_x/total_mass;
+  node->y_center = total_y/total_mass;
+}
+
 /* inserts a particle in a node (or one of its children)  */
-void insert_particle(particle_t* particle, node_t*node) {
+void insert_particle(particle_t* particle, node_t*node, struct memory_t* mem) {
 #if 0
   assert(particle->x_pos >= node->x_min);
   assert(particle->x_pos <= node->x_max);
@@ -161,19 +274,7 @@ void insert_particle(particle_t* particle, node_t*node) {
       /* there's no children yet */
       /* create 4 children and move the already-inserted particle to one of them */
       //assert(node->x_min != node->x_max);
-      node->children = alloc_node();
-      double x_min = node->x_min;
-      double x_max = node->x_max;
-      double x_center = x_min+(x_max-x_min)/2;
-
-      double y_min = node->y_min;
-      double y_max = node->y_max;
-      double y_center = y_min+(y_max-y_min)/2;
-
-      init_node(&node->children[0], node, x_min, x_center, y_min, y_center);
-      init_node(&node->children[1], node, x_center, x_max, y_min, y_center);
-      init_node(&node->children[2], node, x_min, x_center, y_center, y_max);
-      init_node(&node->children[3], node, x_center, x_max, y_center, y_max);
+      create_children(node, mem);
 
       /* move the already-inserted particle to one of the children */
       particle_t*ptr = node->particle;
@@ -182,7 +283,7 @@ void insert_particle(particle_t* particle, node_t*node) {
       node->particle = NULL;
       ptr->node = NULL;
 
-      insert_particle(ptr, &node->children[quadrant]);
+      insert_particle(ptr, &node->children[quadrant], mem);
     }
 
     /* insert the particle to one of the children */
@@ -190,21 +291,10 @@ void insert_particle(particle_t* particle, node_t*node) {
     node->n_particles++;
 
     //assert(particle->node == NULL);
-    insert_particle(particle, &node->children[quadrant]);
+    insert_particle(particle, &node->children[quadrant], mem);
 
     /* update the mass and center of the node */
-    double total_mass = 0;
-    double total_x = 0;
-    double total_y = 0;
-    int i;
-    for(i=0; i<4; i++) {
-      total_mass += node->children[i].mass;
-      total_x += node->children[i].x_center*node->children[i].mass;
-      total_y += node->children[i].y_center*node->children[i].mass;
-    }
-    node->mass = total_mass;
-    node->x_center = total_x/total_mass;
-    node->y_center = total_y/total_mass;
+    update_center(node);
 #if 0
     assert(node->particle == NULL);
     assert(node->n_particles > 0);
@@ -212,61 +302,193 @@ void insert_particle(particle_t* particle, node_t*node) {
   }
 }
 
-/*
-  Place particles in their initial positions.
-*/
-void all_init_particles(int num_particles, particle_t *particles)
-{
-  int    i;
-  double total_particle = num_particles;
+/* particles of a cell of the last split level of build_tree */
+struct build_task {
+  node_t* node;
+  int first;			/* the particles are order[first..first+count-1] */
+  int count;
+};
+
+/* index, in Morton order, of the cell of the last split level that contains
+ * particle p. The quadrants are chosen as in get_quadrant */
+static int build_cell(particle_t* p, node_t* root) {
+  double x_min = root->x_min;
+  double x_max = root->x_max;
+  double y_min = root->y_min;
+  double y_max = root->y_max;
+  int cell = 0;
+  int level;
+  for(level=0; level<BUILD_LEVELS; level++) {
+    double x_center = x_min+(x_max-x_min)/2;
+    double y_center = y_min+(y_max-y_min)/2;
+    int quadrant = 0;
+    if(p->x_pos <= x_center) {
+      x_max = x_center;
+    } else {
+      x_min = x_center;
+      quadrant |= 1;
+    }
+    if(p->y_pos <= y_center) {
+      y_max = y_center;
+    } else {
+      y_min = y_center;
+      quadrant |= 2;
+    }
+    cell = 4*cell + quadrant;
+  }
+  return cell;
+}
 
-  for (i = 0; i < num_particles; i++) {
-    particle_t *particle = &particles[i];
-#if 0
-    particle->x_pos = ((rand() % max_resolution)- (max_resolution/2))*2.0 / max_resolution;
-    particle->y_pos = ((rand() % max_resolution)- (max_resolution/2))*2.0 / max_resolution;
-    particle->x_vel = particle->y_pos;
-    particle->y_vel = particle->x_pos;
-#else
-    particle->x_pos = i*2.0/nparticles - 1.0;
-    particle->y_pos = 0.0;
-    particle->x_vel = 0.0;
-    particle->y_vel = particle->x_pos;
-#endif
-    particle->mass = 1.0 + (num_particles+i)/total_particle;
-    particle->node = NULL;
+/* create the nodes of the split levels below node, which is at depth 'level'
+ * and contains the cells [cell, cell+4^(BUILD_LEVELS-level)). The nodes of
+ * the last level with more than one particle are added to tasks */
+static void split_node(node_t* node, int level, int cell, particle_t* particles,
+		       const int* order, const int* cell_first,
+		       struct build_task* tasks, int* ntasks, struct memory_t* mem) {
+  int span = 1 << 2*(BUILD_LEVELS-level);
+  int first = cell_first[cell];
+  int count = cell_first[cell+span] - first;
+  if(count == 0) {
+    return;
+  }
+  if(count == 1) {
+    insert_particle(&particles[order[first]], node, mem);
+    return;
+  }
+  if(level == BUILD_LEVELS) {
+    tasks[*ntasks].node = node;
+    tasks[*ntasks].first = first;
+    tasks[*ntasks].count = count;
+    (*ntasks)++;
+    return;
+  }
+  create_children(node, mem);
+  node->n_particles = count;
+  int i;
+  for(i=0; i<4; i++) {
+    split_node(&node->children[i], level+1, cell + i*span/4, particles, order, cell_first,
+	       tasks, ntasks, mem);
+  }
+}
 
-    //insert_particle(particle, root);
+/* compute the mass, center and depth of the split nodes below node from
+ * those of their children, once the subtrees of the last level are built */
+static void merge_node(node_t* node, int level) {
+  if(level == BUILD_LEVELS || !node->children) {
+    return;
+  }
+  int depth = 0;
+  int i;
+  for(i=0; i<4; i++) {
+    merge_node(&node->children[i], level+1);
+    depth = MAX(depth, node->children[i].depth+1);
   }
+  update_center(node);
+  node->depth = depth;
 }
 
+/* sort the tasks by decreasing number of particles */
+static int compare_tasks(const void* a, const void* b) {
+  return ((const struct build_task*) b)->count - ((const struct build_task*) a)->count;
+}
+
+void build_tree(particle_t* particles, int n, node_t* root, struct memory_t* mem) {
+  int i;
+  if(n < BUILD_MIN_PARALLEL || omp_get_max_threads() == 1) {
+    for(i=0; i<n; i++) {
+      insert_particle(&particles[i], root, mem);
+    }
+    return;
+  }
+
+  const int ncells = 1 << 2*BUILD_LEVELS;
+  int* cell = malloc(sizeof(int)*n);
+  int* order = malloc(sizeof(int)*n);
+  int* cell_first = calloc(ncells+1, sizeof(int));
+  int* cell_next = malloc(sizeof(int)*ncells);
+  struct build_task* tasks = malloc(sizeof(struct build_task)*ncells);
+  assert(cell && order && cell_first && cell_next && tasks);
+
+#pragma omp parallel for schedule(static)
+  for(i=0; i<n; i++) {
+    cell[i] = build_cell(&particles[i], root);
+  }
+  /* counting sort: the particles of cell c are order[cell_first[c]..cell_first[c+1]-1] */
+  for(i=0; i<n; i++) {
+    cell_first[cell[i]+1]++;
+  }
+  for(i=0; i<ncells; i++) {
+    cell_first[i+1] += cell_first[i];
+    cell_next[i] = cell_first[i];
+  }
+  for(i=0; i<n; i++) {
+    order[cell_next[cell[i]]++] = i;
+  }
 
-struct memory_t mem_node;
+  int ntasks = 0;
+  split_node(root, 0, 0, particles, order, cell_first, tasks, &ntasks, mem);
+  /* the largest subtrees are handed out first, so that the last ones are small */
+  qsort(tasks, ntasks, sizeof(struct build_task), compare_tasks);
+
+#pragma omp parallel
+  {
+    struct memory_t local;
+    mem_init_local(&local, mem);
+    int t;
+#pragma omp for schedule(dynamic, 1)
+    for(t=0; t<ntasks; t++) {
+      node_t* node = tasks[t].node;
+      node_t* parent = node->parent;
+      /* init_node updates the depth of all the ancestors of a new node:
+       * the subtree is detached so that the nodes that several threads
+       * share are left to merge_node */
+      node->parent = NULL;
+      int k;
+      for(k=0; k<tasks[t].count; k++) {
+	insert_particle(&particles[order[tasks[t].first+k]], node, &local);
+      }
+      node->parent = parent;
+    }
+    mem_release_local(&local);
+  }
+  merge_node(root, 0);
 
-void init_alloc(int nb_blocks) {
-  mem_init(&mem_node, 4*sizeof(node_t), nb_blocks);
+  free(cell);
+  free(order);
+  free(cell_first);
+  free(cell_next);
+  free(tasks);
+}
+
+/*
+  Place particles in their initial positions.
+*/
+void all_init_particles(int num_particles, particle_t *particles)
+{
+  generate_particles(particles, 0, num_particles, num_particles, DIST_LINE, 0);
 }
 
+
 /* allocate a block of 4 nodes */
-node_t* alloc_node() {
-  node_t*ret = mem_alloc(&mem_node);
+node_t* alloc_node(struct memory_t* mem) {
+  node_t*ret = mem_alloc(mem);
   return ret;
 }
 
-void free_root(node_t*root) {
-  free_node(root);
-  mem_free(&mem_node, root);
+void free_root(node_t*root, struct memory_t* mem) {
+  free_node(root, mem);
+  mem_free(mem, root);
 }
 
-void free_node(node_t* n) {
+void free_node(node_t* n, struct memory_t* mem) {
   if(!n) return;
 
   if(n->children) {
     //assert(n->n_particles > 0);
     int i;
     for(i=0; i<4; i++) {
-      free_node(&n->children[i]);
+      free_node(&n->children[i], mem);
     }
-    mem_free(&mem_node, n->children);
+    mem_free(mem, n->children);
   }
 }
@@ -1,13 +1,46 @@
 #ifndef NBODY_TOOLS_H
 #define NBODY_TOOLS_H
+#include <stdio.h>
 #include "nbody.h"
+#include "nbody_alloc.h"
 
-/* draw recursively the content of a node */
-void draw_node(node_t* n);
+#define CACHE_LINE_SIZE 64
+
+/* size of a block of 4 children. The node pool is page-aligned and the blocks
+ * are rounded to a whole number of cache lines, so that the children of a
+ * node share the fewest possible cache lines */
+#define NODE_BLOCK_SIZE ((4*sizeof(node_t) + CACHE_LINE_SIZE-1)/CACHE_LINE_SIZE*CACHE_LINE_SIZE)
+
+/* maximum number of nodes on the stack of a walk of the tree of n:
+ * opening a node replaces it with its 4 children, so the stack holds at most
+ * 3 nodes per level below n, plus the node being opened */
+#define WALK_STACK_SIZE(n) (3*(n)->depth + 4)
+
+/* start loading the children of n in the cache. A walk calls it as soon as it
+ * opens n: the cache lines of the block are fetched in parallel instead of
+ * one after the other as the children are visited */
+static inline void prefetch_children(const node_t* n) {
+  const char* block = (const char*) n->children;
+  size_t offset;
+  for(offset=0; offset<4*sizeof(node_t); offset+=CACHE_LINE_SIZE) {
+    __builtin_prefetch(block + offset, 0, 3);
+  }
+}
+
+/* draw recursively the content of a node (and its box if draw_boxes is set) */
+void draw_node(node_t* n, int draw_boxes);
 
 /* print recursively the particles of a node */
 void print_particles(FILE* f, node_t*n);
 
+/* compute the force that node n acts on particle p (Barnes-Hut walk). The
+ * nodes such that size/distance < theta are approximated by their center of mass.
+ * The walk uses an explicit stack and visits the nodes in the same order as a
+ * recursive depth-first walk.
+ * If potential is not NULL, the potential energy between n and p is added to it.
+ */
+void compute_force_on_particle(node_t* n, particle_t *p, double theta, double *potential);
+
 /* Initialize a node */
 void init_node(node_t* n, node_t* parent, double x_min, double x_max, double y_min, double y_max);
 
@@ -16,20 +49,31 @@ void init_node(node_t* n, node_t* parent, double x_min, double x_max, double y_m
  */
 int get_quadrant(particle_t* particle, node_t*node);
 
-/* inserts a particle in a node (or one of its children)  */
-void insert_particle(particle_t* particle, node_t*node);
+/* inserts a particle in a node (or one of its children).
+ * The children are allocated from mem */
+void insert_particle(particle_t* particle, node_t*node, struct memory_t* mem);
+
+/*
+  Insert particles[0..n-1] in root, which must be empty, with all the threads.
+  The top BUILD_LEVELS levels of the tree are split serially, then each
+  thread builds whole subtrees of the last split level, with a local pool
+  borrowing blocks from mem. The tree is the same as the one built by
+  inserting the particles one by one with insert_particle. Below
+  BUILD_MIN_PARALLEL particles, or with one thread, they are inserted serially.
+*/
+#define BUILD_LEVELS 4
+#define BUILD_MIN_PARALLEL 4096
+void build_tree(particle_t* particles, int n, node_t* root, struct memory_t* mem);
 
 /*
   Place particles in their initial positions.
 */
 void all_init_particles(int num_particles, particle_t*particles);
 
-void init_alloc(int nb_blocks);
-
-void free_node(node_t* n);
+void free_node(node_t* n, struct memory_t* mem);
 
-node_t* alloc_node();
+node_t* alloc_node(struct memory_t* mem);
 
-void free_root(node_t*root);
+void free_root(node_t*root, struct memory_t* mem);
 
 #endif	/* NBODY_TOOLS_H */
@@ -0,0 +1,50 @@
+/*
+** nbody_traj_dump.c - print the content of a trajectory file
+**
+** usage: nbody_traj_dump trajectory_file [-s]
+**     -s: only print one summary line per frame
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nbody_trajectory.h"
+
+int main(int argc, char**argv)
+{
+  if(argc < 2) {
+    fprintf(stderr, "usage: %s trajectory_file [-s]\n", argv[0]);
+    exit(1);
+  }
+  int summary = (argc >= 3 && strcmp(argv[2], "-s") == 0);
+
+  struct trajectory_reader* r = trajectory_reader_open(argv[1]);
+  if(!r) {
+    fprintf(stderr, "%s: not a trajectory file\n", argv[1]);
+    exit(1);
+  }
+
+  struct trajectory_frame frame;
+  int ret, nframes = 0;
+  while((ret = trajectory_read_frame(r, &frame)) > 0) {
+    printf("frame %d: step=%d t=%f nparticles=%d\n", nframes, frame.step, frame.t, frame.nalive);
+    if(!summary) {
+      int id;
+      for(id=0; id<frame.nparticles; id++) {
+	if(frame.alive[id]) {
+	  printf("particle %d={pos=(%f,%f), vel=(%f,%f)}\n", id,
+		 frame.x_pos[id], frame.y_pos[id], frame.x_vel[id], frame.y_vel[id]);
+	}
+      }
+    }
+    nframes++;
+  }
+  trajectory_reader_close(r);
+
+  if(ret < 0) {
+    fprintf(stderr, "%s: corrupted frame %d\n", argv[1], nframes);
+    exit(1);
+  }
+  return 0;
+}
@@ -0,0 +1,455 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "nbody.h"
+#include "nbody_trajectory.h"
+
+#define TRAJ_MAGIC "NBTRAJ1"
+#define NB_FIELDS 4		/* x_pos, y_pos, x_vel, y_vel */
+#define MAX_VARINT_SIZE 10	/* bytes needed to encode a 64-bit integer */
+
+/* header of a chunk, written field by field */
+struct chunk_header {
+  uint32_t magic;
+  int32_t step;
+  double t;
+  int32_t nalive;
+  int32_t keyframe;
+  uint32_t size;
+};
+
+/* a frame waiting to be written, indexed by particle id */
+struct staging_buffer {
+  int full;			/* set while the buffer waits for the writer */
+  int step;
+  double t;
+  char* alive;
+  double* fields[NB_FIELDS];
+};
+
+struct trajectory_writer {
+  FILE* f;
+  int nparticles;
+
+  struct staging_buffer buffers[2];
+  int next_fill;		/* buffer filled by the next snapshot */
+  int next_write;		/* buffer written next by the writer thread */
+  int done;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  /* state of the writer thread */
+  int64_t* previous[NB_FIELDS];	/* quantized values of the previous frame */
+  int nframes;
+  unsigned char* payload;
+  int error;			/* a write failed */
+};
+
+struct trajectory_reader {
+  FILE* f;
+  int nparticles;
+  double pos_quantum, vel_quantum;
+  int64_t* previous[NB_FIELDS];
+  double* values[NB_FIELDS];
+  char* alive;
+  unsigned char* payload;
+  size_t payload_capacity;
+};
+
+/**************************************************************************/
+/* encoding                                                               */
+/**************************************************************************/
+
+static int64_t quantize(double value, double quantum) {
+  return (int64_t) llround(value / quantum);
+}
+
+static const double field_quantum[NB_FIELDS] = {
+  TRAJ_POS_QUANTUM, TRAJ_POS_QUANTUM, TRAJ_VEL_QUANTUM, TRAJ_VEL_QUANTUM
+};
+
+/* map signed integers to unsigned ones so that small values have few bits */
+static uint64_t zigzag(int64_t v) {
+  return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+  return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+/* write v 7 bits at a time, the high bit of each byte tells if another byte follows */
+static unsigned char* put_varint(unsigned char* out, uint64_t v) {
+  while(v >= 0x80) {
+    *out++ = (unsigned char) (v | 0x80);
+    v >>= 7;
+  }
+  *out++ = (unsigned char) v;
+  return out;
+}
+
+static const unsigned char* get_varint(const unsigned char* in, const unsigned char* end, uint64_t* v) {
+  uint64_t result = 0;
+  int shift = 0;
+  while(in < end && shift < 64) {
+    unsigned char byte = *in++;
+    result |= (uint64_t) (byte & 0x7F) << shift;
+    if(!(byte & 0x80)) {
+      *v = result;
+      return in;
+    }
+    shift += 7;
+  }
+  return NULL;
+}
+
+/* compress a staging buffer into w->payload. Return the size of the payload */
+static size_t encode_frame(struct trajectory_writer* w, struct staging_buffer* b, int keyframe) {
+  int n = w->nparticles;
+  unsigned char* out = w->payload;
+  int id, k;
+
+  /* bitmap of the alive particles */
+  size_t bitmap_size = ((size_t) n + 7)/8;
+  memset(out, 0, bitmap_size);
+  for(id=0; id<n; id++) {
+    if(b->alive[id]) {
+      out[id/8] |= 1 << (id%8);
+    }
+  }
+  out += bitmap_size;
+
+  for(id=0; id<n; id++) {
+    if(!b->alive[id]) continue;
+    for(k=0; k<NB_FIELDS; k++) {
+      int64_t q = quantize(b->fields[k][id], field_quantum[k]);
+      int64_t ref = keyframe ? 0 : w->previous[k][id];
+      out = put_varint(out, zigzag(q - ref));
+      w->previous[k][id] = q;
+    }
+  }
+  return out - w->payload;
+}
+
+static void write_frame(struct trajectory_writer* w, struct staging_buffer* b) {
+  int keyframe = (w->nframes % TRAJ_KEYFRAME_INTERVAL == 0);
+  struct chunk_header h;
+  int id;
+
+  h.magic = TRAJ_CHUNK_MAGIC;
+  h.step = b->step;
+  h.t = b->t;
+  h.nalive = 0;
+  for(id=0; id<w->nparticles; id++) {
+    h.nalive += b->alive[id];
+  }
+  h.keyframe = keyframe;
+  h.size = encode_frame(w, b, keyframe);
+
+  if(fwrite(&h.magic, sizeof(h.magic), 1, w->f) != 1 ||
+     fwrite(&h.step, sizeof(h.step), 1, w->f) != 1 ||
+     fwrite(&h.t, sizeof(h.t), 1, w->f) != 1 ||
+     fwrite(&h.nalive, sizeof(h.nalive), 1, w->f) != 1 ||
+     fwrite(&h.keyframe, sizeof(h.keyframe), 1, w->f) != 1 ||
+     fwrite(&h.size, sizeof(h.size), 1, w->f) != 1 ||
+     fwrite(w->payload, 1, h.size, w->f) != h.size) {
+    w->error = 1;
+  }
+  w->nframes++;
+}
+
+/**************************************************************************/
+/* writer                                                                 */
+/**************************************************************************/
+
+/* main loop of the writer thread: write the buffers in the order they were filled */
+static void* writer_thread(void* arg) {
+  struct trajectory_writer* w = arg;
+
+  pthread_mutex_lock(&w->lock);
+  for(;;) {
+    struct staging_buffer* b = &w->buffers[w->next_write];
+    while(!b->full && !w->done) {
+      pthread_cond_wait(&w->cond, &w->lock);
+    }
+    if(!b->full) {
+      /* done, and nothing left to write */
+      break;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    write_frame(w, b);
+
+    pthread_mutex_lock(&w->lock);
+    b->full = 0;
+    w->next_write = 1 - w->next_write;
+    pthread_cond_broadcast(&w->cond);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+/* allocate a writer that appends frames to f */
+static struct trajectory_writer* writer_create(FILE* f, int nparticles) {
+  struct trajectory_writer* w = calloc(1, sizeof(struct trajectory_writer));
+  assert(w);
+  w->f = f;
+  w->nparticles = nparticles;
+
+  int i, k;
+  for(i=0; i<2; i++) {
+    w->buffers[i].alive = malloc(nparticles);
+    for(k=0; k<NB_FIELDS; k++) {
+      w->buffers[i].fields[k] = malloc(sizeof(double)*nparticles);
+    }
+  }
+  for(k=0; k<NB_FIELDS; k++) {
+    w->previous[k] = calloc(nparticles, sizeof(int64_t));
+  }
+  w->payload = malloc((nparticles+7)/8 + (size_t) nparticles*NB_FIELDS*MAX_VARINT_SIZE);
+
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->cond, NULL);
+  pthread_create(&w->thread, NULL, writer_thread, w);
+  return w;
+}
+
+struct trajectory_writer* trajectory_open(const char* filename, int nparticles) {
+  FILE* f = fopen(filename, "wb");
+  if(!f) {
+    return NULL;
+  }
+
+  char magic[8] = TRAJ_MAGIC;
+  int32_t n = nparticles;
+  double pos_quantum = TRAJ_POS_QUANTUM;
+  double vel_quantum = TRAJ_VEL_QUANTUM;
+  if(fwrite(magic, sizeof(magic), 1, f) != 1 ||
+     fwrite(&n, sizeof(n), 1, f) != 1 ||
+     fwrite(&pos_quantum, sizeof(pos_quantum), 1, f) != 1 ||
+     fwrite(&vel_quantum, sizeof(vel_quantum), 1, f) != 1) {
+    fclose(f);
+    return NULL;
+  }
+
+  return writer_create(f, nparticles);
+}
+
+struct trajectory_writer* trajectory_append(const char* filename, int nparticles, int step) {
+  struct trajectory_reader* r = trajectory_reader_open(filename);
+  if(!r) {
+    if(access(filename, F_OK) == 0) {
+      /* not a trajectory: do not overwrite it */
+      errno = EINVAL;
+      return NULL;
+    }
+    return trajectory_open(filename, nparticles);
+  }
+  if(r->nparticles != nparticles ||
+     r->pos_quantum != TRAJ_POS_QUANTUM || r->vel_quantum != TRAJ_VEL_QUANTUM) {
+    trajectory_reader_close(r);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  /* keep the complete frames that precede step: the next ones are written again */
+  long end = ftell(r->f);
+  struct trajectory_frame frame;
+  while(trajectory_read_frame(r, &frame) == 1 && frame.step < step) {
+    end = ftell(r->f);
+  }
+  trajectory_reader_close(r);
+
+  FILE* f = fopen(filename, "r+b");
+  if(!f) {
+    return NULL;
+  }
+  if(ftruncate(fileno(f), end) != 0 || fseek(f, end, SEEK_SET) != 0) {
+    fclose(f);
+    return NULL;
+  }
+  /* nframes = 0: the first frame is a keyframe, it does not depend on the frames of the previous run */
+  return writer_create(f, nparticles);
+}
+
+void trajectory_snapshot(struct trajectory_writer* w, int step, double t,
+			 particle_t* particles, int* ids, const char* alive, int n) {
+  struct staging_buffer* b = &w->buffers[w->next_fill];
+
+  /* wait until the writer is done with this buffer */
+  pthread_mutex_lock(&w->lock);
+  while(b->full) {
+    pthread_cond_wait(&w->cond, &w->lock);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  b->step = step;
+  b->t = t;
+  memset(b->alive, 0, w->nparticles);
+  int i;
+#pragma omp parallel for schedule(static)
+  for(i=0; i<n; i++) {
+    int id = ids[i];
+    b->alive[id] = alive[i];
+    b->fields[0][id] = particles[i].x_pos;
+    b->fields[1][id] = particles[i].y_pos;
+    b->fields[2][id] = particles[i].x_vel;
+    b->fields[3][id] = particles[i].y_vel;
+  }
+
+  pthread_mutex_lock(&w->lock);
+  b->full = 1;
+  w->next_fill = 1 - w->next_fill;
+  pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+}
+
+int trajectory_close(struct trajectory_writer* w) {
+  if(!w) return 0;
+
+  pthread_mutex_lock(&w->lock);
+  w->done = 1;
+  pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+  pthread_join(w->thread, NULL);
+
+  int error = w->error;
+  if(fclose(w->f) != 0) {
+    error = 1;
+  }
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->cond);
+
+  int i, k;
+  for(i=0; i<2; i++) {
+    free(w->buffers[i].alive);
+    for(k=0; k<NB_FIELDS; k++) {
+      free(w->buffers[i].fields[k]);
+    }
+  }
+  for(k=0; k<NB_FIELDS; k++) {
+    free(w->previous[k]);
+  }
+  free(w->payload);
+  free(w);
+  return error ? -1 : 0;
+}
+
+/**************************************************************************/
+/* reader                                                                 */
+/**************************************************************************/
+
+
+struct trajectory_reader* trajectory_reader_open(const char* filename) {
+  FILE* f = fopen(filename, "rb");
+  if(!f) {
+    return NULL;
+  }
+  char magic[8];
+  int32_t n;
+  double pos_quantum, vel_quantum;
+  if(fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, TRAJ_MAGIC, sizeof(magic)) != 0 ||
+     fread(&n, sizeof(n), 1, f) != 1 || n < 0 ||
+     fread(&pos_quantum, sizeof(pos_quantum), 1, f) != 1 ||
+     fread(&vel_quantum, sizeof(vel_quantum), 1, f) != 1) {
+    fclose(f);
+    return NULL;
+  }
+
+  struct trajectory_reader* r = calloc(1, sizeof(struct trajectory_reader));
+  assert(r);
+  r->f = f;
+  r->nparticles = n;
+  r->pos_quantum = pos_quantum;
+  r->vel_quantum = vel_quantum;
+  int k;
+  for(k=0; k<NB_FIELDS; k++) {
+    r->previous[k] = calloc(n, sizeof(int64_t));
+    r->values[k] = calloc(n, sizeof(double));
+  }
+  r->alive = calloc(n, 1);
+  return r;
+}
+
+int trajectory_read_frame(struct trajectory_reader* r, struct trajectory_frame* frame) {
+  struct chunk_header h;
+  if(fread(&h.magic, sizeof(h.magic), 1, r->f) != 1) {
+    return 0;
+  }
+  if(h.magic != TRAJ_CHUNK_MAGIC ||
+     fread(&h.step, sizeof(h.step), 1, r->f) != 1 ||
+     fread(&h.t, sizeof(h.t), 1, r->f) != 1 ||
+     fread(&h.nalive, sizeof(h.nalive), 1, r->f) != 1 ||
+     fread(&h.keyframe, sizeof(h.keyframe), 1, r->f) != 1 ||
+     fread(&h.size, sizeof(h.size), 1, r->f) != 1) {
+    return -1;
+  }
+  if(h.size > r->payload_capacity) {
+    r->payload_capacity = h.size;
+    r->payload = realloc(r->payload, h.size);
+  }
+  if(fread(r->payload, 1, h.size, r->f) != h.size) {
+    return -1;
+  }
+
+  int n = r->nparticles;
+  const unsigned char* in = r->payload;
+  const unsigned char* end = r->payload + h.size;
+  const double quantum[NB_FIELDS] = {
+    r->pos_quantum, r->pos_quantum, r->vel_quantum, r->vel_quantum
+  };
+  int id, k;
+
+  if((size_t) (n+7)/8 > h.size) {
+    return -1;
+  }
+  for(id=0; id<n; id++) {
+    r->alive[id] = (in[id/8] >> (id%8)) & 1;
+  }
+  in += (n+7)/8;
+
+  for(id=0; id<n; id++) {
+    if(!r->alive[id]) continue;
+    for(k=0; k<NB_FIELDS; k++) {
+      uint64_t v;
+      in = get_varint(in, end, &v);
+      if(!in) {
+	return -1;
+      }
+      int64_t q = unzigzag(v) + (h.keyframe ? 0 : r->previous[k][id]);
+      r->previous[k][id] = q;
+      r->values[k][id] = q * quantum[k];
+    }
+  }
+
+  frame->step = h.step;
+  frame->t = h.t;
+  frame->nparticles = n;
+  frame->nalive = h.nalive;
+  frame->alive = r->alive;
+  frame->x_pos = r->values[0];
+  frame->y_pos = r->values[1];
+  frame->x_vel = r->values[2];
+  frame->y_vel = r->values[3];
+  return 1;
+}
+
+void trajectory_reader_close(struct trajectory_reader* r) {
+  if(!r) return;
+  fclose(r->f);
+  int k;
+  for(k=0; k<NB_FIELDS; k++) {
+    free(r->previous[k]);
+    free(r->values[k]);
+  }
+  free(r->alive);
+  free(r->payload);
+  free(r);
+}
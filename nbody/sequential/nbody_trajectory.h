@@ -0,0 +1,79 @@
+#ifndef NBODY_TRAJECTORY_H
+#define NBODY_TRAJECTORY_H
+#include <stdio.h>
+#include <stdint.h>
+#include "nbody.h"
+
+/*
+  Streaming trajectory output.
+
+  trajectory_snapshot copies the state of the particles into one of two
+  staging buffers and returns; a background thread compresses the buffer and
+  appends it to the file while the simulation goes on. The simulation only
+  waits if both buffers are still being written.
+
+  File format (host endianness):
+    header: "NBTRAJ1\0", int32 number of particles, double position quantum,
+            double velocity quantum
+    then one chunk per frame:
+      uint32 TRAJ_CHUNK_MAGIC, int32 step, double t, int32 alive particles,
+      int32 keyframe, uint32 payload size, payload
+    The payload is a bitmap of the alive particles (by particle id), followed
+    for each alive particle by x, y, x_vel, y_vel quantized to integers,
+    delta-encoded against the previous frame (against 0 in keyframes),
+    zigzag-encoded and packed as variable-length integers (7 bits per byte).
+*/
+
+#define TRAJ_CHUNK_MAGIC 0x4D415246	/* "FRAM" */
+#define TRAJ_POS_QUANTUM 1e-6
+#define TRAJ_VEL_QUANTUM 1e-6
+#define TRAJ_KEYFRAME_INTERVAL 16	/* one frame out of 16 does not depend on the previous ones */
+
+struct trajectory_writer;
+
+/* open a trajectory file for a set of nparticles particles. Return NULL on error */
+struct trajectory_writer* trajectory_open(const char* filename, int nparticles);
+
+/*
+  Continue a trajectory after a restart at step 'step': the frames of the file
+  before 'step' are kept, the later ones (written after the checkpoint) and an
+  incomplete last frame (written during the crash) are dropped. The file is
+  created if it does not exist. Return NULL (errno = EINVAL) if it exists but
+  is not a trajectory of nparticles particles: it is not overwritten.
+*/
+struct trajectory_writer* trajectory_append(const char* filename, int nparticles, int step);
+
+/*
+  Queue a frame. particles[i] is the particle whose id is ids[i];
+  alive[i] tells whether it is still in the simulation.
+*/
+void trajectory_snapshot(struct trajectory_writer* w, int step, double t,
+			 particle_t* particles, int* ids, const char* alive, int n);
+
+/* write the pending frames and close the file. Return 0 if every frame was
+   written, -1 if a write failed (the file is then incomplete) */
+int trajectory_close(struct trajectory_writer* w);
+
+
+/* a decoded frame */
+struct trajectory_frame {
+  int step;
+  double t;
+  int nparticles;		/* number of particles of the set */
+  int nalive;
+  char* alive;			/* alive[id] */
+  double *x_pos, *y_pos;	/* indexed by particle id */
+  double *x_vel, *y_vel;
+};
+
+struct trajectory_reader;
+
+struct trajectory_reader* trajectory_reader_open(const char* filename);
+
+/* decode the next frame. Return 0 at the end of the file, -1 if the file is corrupted.
+ * The arrays of the frame belong to the reader and are overwritten by the next call */
+int trajectory_read_frame(struct trajectory_reader* r, struct trajectory_frame* frame);
+
+void trajectory_reader_close(struct trajectory_reader* r);
+
+#endif	/* NBODY_TRAJECTORY_H */
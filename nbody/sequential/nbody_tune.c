@@ -0,0 +1,276 @@
+/*
+** nbody_tune.c - choice of the parameters of the tree engines
+**
+** The tuner runs the engine on the real initial conditions:
+**  1. theta: the forces are computed with decreasing values of theta, and
+**     compared to the exact forces on a sample of the particles. The error
+**     grows and the cost decreases with theta, so the first value whose error
+**     is within the bound is the fastest acceptable one.
+**  2. chunk: the force computation is timed with each candidate size of
+**     the chunks handed out to the threads.
+**  3. reorder interval: a few steps are timed with and without sorting the
+**     particles. Sorting every k steps costs sort_time/k per step; it is
+**     worth it when this is well below what it saves on the next steps.
+** The choice is cached in a file, keyed by the machine (host name, processor
+** and number of threads) and the problem (engine, number of particles,
+** distribution, mesh size for TreePM, error bound).
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <omp.h>
+
+#include "nbody.h"
+#include "nbody_generators.h"
+#include "libnbody.h"
+#include "nbody_reference.h"
+
+/* number of particles whose forces are compared to the exact forces */
+#define TUNE_SAMPLES 256
+/* each measurement is the best of TUNE_REPEAT runs */
+#define TUNE_REPEAT 2
+/* number of steps timed to evaluate the reordering */
+#define TUNE_STEPS 3
+#define MAX_KEY 256
+
+static const double theta_candidates[] = {3, 2, 1.5, 1, 0.75, 0.5, 0.35, 0.25, 0.1};
+static const int chunk_candidates[] = {16, 64, 256};
+static const int reorder_candidates[] = {1, 2, 5, 10, 20, 50};
+
+#define NB_CANDIDATES(a) ((int) (sizeof(a)/sizeof(a[0])))
+
+/* key of the machine: host name, processor model and number of threads */
+static void machine_key(const struct nbody_params* params, char* key, size_t size) {
+  char host[64] = "unknown";
+  char cpu[128] = "unknown";
+  gethostname(host, sizeof(host));
+  host[sizeof(host)-1] = '\0';
+
+  FILE* f = fopen("/proc/cpuinfo", "r");
+  if(f) {
+    char line[256];
+    while(fgets(line, sizeof(line), f)) {
+      char* value = strchr(line, ':');
+      if(strncmp(line, "model name", 10) == 0 && value) {
+	snprintf(cpu, sizeof(cpu), "%s", value + 2);
+	break;
+      }
+    }
+    fclose(f);
+  }
+  int nthreads = params->nthreads > 0 ? params->nthreads : omp_get_max_threads();
+  snprintf(key, size, "%s/%s/%d", host, cpu, nthreads);
+  /* the key is one word of the cache file */
+  char* c;
+  for(c=key; *c; c++) {
+    if(*c == ' ' || *c == '\t' || *c == '\n') {
+      *c = '_';
+    }
+  }
+}
+
+/* mesh size in the cache: the Barnes-Hut engine does not use the mesh */
+static int cache_pm_grid(const struct nbody_params* params) {
+  return params->engine == NBODY_TREEPM ? params->pm_grid : 0;
+}
+
+/* look for the parameters of the problem in the cache. Return 0 if found */
+static int read_cache(const char* filename, const char* key, struct nbody_params* params,
+		      double error_bound) {
+  FILE* f = fopen(filename, "r");
+  if(!f) {
+    return -1;
+  }
+  char line[512];
+  char k[MAX_KEY], engine[64], dist[64];
+  int nparticles, pm_grid, chunk, reorder;
+  double bound, theta;
+  int found = -1;
+  while(fgets(line, sizeof(line), f)) {
+    if(line[0] == '#') {
+      continue;
+    }
+    if(sscanf(line, "%255s %63s %d %63s %d %lf %lf %d %d", k, engine, &nparticles, dist,
+	      &pm_grid, &bound, &theta, &chunk, &reorder) != 9) {
+      continue;
+    }
+    if(strcmp(k, key) == 0 &&
+       strcmp(engine, nbody_engine_name(params->engine)) == 0 &&
+       nparticles == params->nparticles &&
+       strcmp(dist, distribution_name(params->distribution)) == 0 &&
+       pm_grid == cache_pm_grid(params) &&
+       bound == error_bound) {
+      /* the last entry wins */
+      params->theta = theta;
+      params->chunk = chunk;
+      params->reorder_interval = reorder;
+      found = 0;
+    }
+  }
+  fclose(f);
+  return found;
+}
+
+static void write_cache(const char* filename, const char* key, const struct nbody_params* params,
+			double error_bound) {
+  FILE* f = fopen(filename, "a");
+  if(!f) {
+    perror(filename);
+    return;
+  }
+  if(ftell(f) == 0) {
+    fprintf(f, "# machine engine nparticles distribution pm_grid error_bound theta chunk reorder_interval\n");
+  }
+  fprintf(f, "%s %s %d %s %d %.17g %.17g %d %d\n", key, nbody_engine_name(params->engine),
+	  params->nparticles, distribution_name(params->distribution), cache_pm_grid(params), error_bound,
+	  params->theta, params->chunk, params->reorder_interval);
+  fclose(f);
+}
+
+/* best time of the force computation of sim */
+static double time_forces(nbody_sim_t* sim) {
+  double best = -1;
+  int r;
+  for(r=0; r<TUNE_REPEAT; r++) {
+    double t1 = omp_get_wtime();
+    nbody_compute_forces(sim);
+    double t = omp_get_wtime() - t1;
+    if(best < 0 || t < best) {
+      best = t;
+    }
+  }
+  return best;
+}
+
+/* time of the steps of sim: first step, and best of the next ones */
+static void time_steps(nbody_sim_t* sim, double* first, double* next) {
+  int s;
+  *first = *next = -1;
+  for(s=0; s<TUNE_STEPS; s++) {
+    double t1 = omp_get_wtime();
+    nbody_step(sim);
+    double t = omp_get_wtime() - t1;
+    if(s == 0) {
+      *first = t;
+    } else if(*next < 0 || t < *next) {
+      *next = t;
+    }
+  }
+}
+
+/* run the calibration described at the top of this file */
+static void calibrate(struct nbody_params* params, double error_bound, FILE* log) {
+  struct nbody_params p = *params;
+  /* no output, and no step counted in the user's outputs */
+  p.diag_interval = 0;
+  p.trajectory_file = NULL;
+  p.checkpoint_file = NULL;
+  p.reorder_interval = 0;
+  p.t_final = 1e300;
+
+  nbody_sim_t* reference_sim = nbody_create(&p);
+  struct nbody_reference* ref = nbody_reference_create(reference_sim, nbody_nparticles(reference_sim),
+						       p.seed, TUNE_SAMPLES);
+  nbody_destroy(reference_sim);
+
+  /* 1. theta */
+  int i;
+  for(i=0; i<NB_CANDIDATES(theta_candidates); i++) {
+    p.theta = theta_candidates[i];
+    nbody_sim_t* sim = nbody_create(&p);
+    double t = time_forces(sim);
+    double error, max_error;
+    nbody_reference_error(ref, sim, &error, &max_error);
+    nbody_destroy(sim);
+    if(log) {
+      fprintf(log, "autotune: theta=%-5g forces %.6f s, rms error %.3e\n", p.theta, t, error);
+    }
+    if(error <= error_bound) {
+      break;
+    }
+  }
+  if(i == NB_CANDIDATES(theta_candidates) && log) {
+    fprintf(log, "autotune: no theta meets the error bound, using theta=%g\n", p.theta);
+  }
+  nbody_reference_destroy(ref);
+
+  /* 2. chunk */
+  double best = -1;
+  int best_chunk = p.chunk;
+  for(i=0; i<NB_CANDIDATES(chunk_candidates); i++) {
+    p.chunk = chunk_candidates[i];
+    nbody_sim_t* sim = nbody_create(&p);
+    double t = time_forces(sim);
+    nbody_destroy(sim);
+    if(log) {
+      fprintf(log, "autotune: chunk=%-4d forces %.6f s\n", p.chunk, t);
+    }
+    if(best < 0 || t < best) {
+      best = t;
+      best_chunk = p.chunk;
+    }
+  }
+  p.chunk = best_chunk;
+
+  /* 3. reorder interval */
+  double unsorted_first, unsorted, sorted_first, sorted;
+  nbody_sim_t* sim = nbody_create(&p);
+  time_steps(sim, &unsorted_first, &unsorted);
+  nbody_destroy(sim);
+  p.reorder_interval = 1;
+  sim = nbody_create(&p);
+  time_steps(sim, &sorted_first, &sorted);
+  nbody_destroy(sim);
+  /* both runs do the same first step, plus a sort with reorder_interval = 1;
+   * the next steps of the second run walk sorted particles, and sort them again */
+  double sort_time = MAX(sorted_first - unsorted_first, 0);
+  double gain = unsorted - (sorted - sort_time);
+  p.reorder_interval = 0;
+  for(i=0; i<NB_CANDIDATES(reorder_candidates) && gain > 0; i++) {
+    /* half of the gain is kept for the decay of the order between two sorts */
+    if(sort_time/reorder_candidates[i] < gain/2) {
+      p.reorder_interval = reorder_candidates[i];
+      break;
+    }
+  }
+  if(log) {
+    fprintf(log, "autotune: step %.6f s unsorted, %.6f s sorted, sort %.6f s\n",
+	    unsorted, sorted - sort_time, sort_time);
+  }
+
+  params->theta = p.theta;
+  params->chunk = p.chunk;
+  params->reorder_interval = p.reorder_interval;
+}
+
+int nbody_autotune(struct nbody_params* params, double error_bound,
+		   const char* cache_file, FILE* log) {
+  if(params->engine != NBODY_BARNES_HUT && params->engine != NBODY_TREEPM) {
+    return -1;
+  }
+  /* check the parameters once, instead of failing in the middle of the calibration */
+  if(!nbody_valid_params(params)) {
+    return -1;
+  }
+
+  char key[MAX_KEY];
+  machine_key(params, key, sizeof(key));
+  if(cache_file && read_cache(cache_file, key, params, error_bound) == 0) {
+    if(log) {
+      fprintf(log, "autotune: parameters found in %s\n", cache_file);
+    }
+  } else {
+    calibrate(params, error_bound, log);
+    if(cache_file) {
+      write_cache(cache_file, key, params, error_bound);
+    }
+  }
+  if(log) {
+    fprintf(log, "autotune: theta=%g chunk=%d reorder=%d\n",
+	    params->theta, params->chunk, params->reorder_interval);
+  }
+  return 0;
+}
@@ -0,0 +1,198 @@
+/*
+** nbody_validate.c - accuracy and speed of the force computation of the engines
+**
+** usage: nbody_validate [options] engines nparticles [distribution [seed]]
+**
+** engines is a comma-separated list of engine names, or "all". For each
+** engine, the forces computed by the engine are compared to the exact O(n*n)
+** forces on a random sample of the particles, and the time the engine takes
+** to compute the forces is measured. The exact forces are only computed for
+** the sampled particles, so large problems can be checked.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include <getopt.h>
+
+#include "nbody.h"
+#include "nbody_generators.h"
+#include "libnbody.h"
+#include "nbody_reference.h"
+
+#define MAX_ENGINES_ARG 256
+
+struct options {
+  int nsamples;			/* number of particles whose forces are checked */
+  int repeat;			/* the force computation is timed repeat times */
+  int steps;			/* number of steps done before measuring */
+  double budget;		/* maximum rms relative error (0: none) */
+};
+
+struct result {
+  double time;			/* best time of the force computation */
+  double exact_time;		/* estimated time of the exact computation */
+  double rms_error;		/* rms of the relative error of the sampled forces */
+  double max_error;		/* maximum relative error */
+  int nparticles;
+};
+
+static void usage(const char* name) {
+  fprintf(stderr, "usage: %s [options] engines nparticles [distribution [seed]]\n"
+	  "  engines is a comma-separated list of engines, or 'all'\n"
+	  "  --samples k   check the forces of k particles (default: 1000)\n"
+	  "  --repeat r    time the force computation r times (default: 3)\n"
+	  "  --steps s     move the particles s steps before measuring (default: 0)\n"
+	  "  --threads t   number of threads (default: OpenMP default)\n"
+	  "  --mesh n      size of the TreePM mesh (default: 256)\n"
+	  "  --theta t     opening criterion of the tree engines (default: 2)\n"
+	  "  --kernel k    force kernel of brute_force (default: scalar)\n"
+	  "  --budget e    fail if the rms relative error exceeds e\n", name);
+  exit(1);
+}
+
+static double now() {
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec + t.tv_usec/1e6;
+}
+
+/* run the engine described by params and measure its forces */
+static int validate(const struct nbody_params* params, const struct options* opt,
+		    struct result* res) {
+  nbody_sim_t* sim = nbody_create(params);
+  if(!sim) {
+    return -1;
+  }
+  /* the ids are 0..nids-1, even if particles are lost during the steps */
+  int nids = nbody_nparticles(sim);
+  int i;
+  for(i=0; i<opt->steps && nbody_step(sim); i++) {
+    ;
+  }
+
+  res->time = -1;
+  for(i=0; i<opt->repeat; i++) {
+    double t1 = now();
+    nbody_compute_forces(sim);
+    double t = now() - t1;
+    if(res->time < 0 || t < res->time) {
+      res->time = t;
+    }
+  }
+
+  /* the sample depends on the seed only, so that all the engines are checked
+   * on the same particles */
+  struct nbody_reference* ref = nbody_reference_create(sim, nids, params->seed, opt->nsamples);
+  int nchecked = nbody_reference_error(ref, sim, &res->rms_error, &res->max_error);
+  res->nparticles = nbody_nparticles(sim);
+  res->exact_time = nchecked ? ref->time/ref->nsamples*res->nparticles : 0;
+  nbody_reference_destroy(ref);
+  nbody_destroy(sim);
+  return 0;
+}
+
+int main(int argc, char**argv) {
+  static struct option long_options[] = {
+    {"samples", required_argument, NULL, 's'},
+    {"repeat", required_argument, NULL, 'r'},
+    {"steps", required_argument, NULL, 'n'},
+    {"threads", required_argument, NULL, 't'},
+    {"mesh", required_argument, NULL, 'm'},
+    {"theta", required_argument, NULL, 'o'},
+    {"kernel", required_argument, NULL, 'k'},
+    {"budget", required_argument, NULL, 'b'},
+    {NULL, 0, NULL, 0}
+  };
+  struct options opt = {
+    .nsamples = 1000,
+    .repeat = 3,
+    .steps = 0,
+    .budget = 0,
+  };
+  struct nbody_params params;
+  nbody_default_params(&params);
+
+  int c, value;
+  while((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+    switch(c) {
+    case 's': opt.nsamples = atoi(optarg); break;
+    case 'r': opt.repeat = atoi(optarg); break;
+    case 'n': opt.steps = atoi(optarg); break;
+    case 't': params.nthreads = atoi(optarg); break;
+    case 'm': params.pm_grid = atoi(optarg); break;
+    case 'o': params.theta = atof(optarg); break;
+    case 'k':
+      value = nbody_parse_kernel(optarg);
+      if(value < 0) {
+	fprintf(stderr, "Unknown kernel '%s'\n", optarg);
+	exit(1);
+      }
+      params.kernel = value;
+      break;
+    case 'b': opt.budget = atof(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  /* positional arguments */
+  argc -= optind-1;
+  argv += optind-1;
+  if(argc < 3 || opt.repeat < 1) {
+    usage(argv[0]);
+  }
+
+  char engines[MAX_ENGINES_ARG];
+  snprintf(engines, MAX_ENGINES_ARG, "%s", argv[1]);
+  params.nparticles = atoi(argv[2]);
+  if(argc >= 4) {
+    params.distribution = parse_distribution(argv[3]);
+    if(params.distribution < 0) {
+      fprintf(stderr, "Unknown distribution '%s'\n", argv[3]);
+      exit(1);
+    }
+  }
+  if(argc >= 5) {
+    params.seed = strtoull(argv[4], NULL, 10);
+  }
+
+  printf("# nparticles=%d distribution=%s seed=%llu steps=%d samples=%d theta=%g mesh=%d kernel=%s\n",
+	 params.nparticles, distribution_name(params.distribution), params.seed,
+	 opt.steps, opt.nsamples, params.theta, params.pm_grid, nbody_kernel_name(params.kernel));
+  printf("# %-12s %10s %12s %12s %10s %12s %12s\n", "engine", "nparticles",
+	 "time (s)", "exact (s)", "speedup", "rms error", "max error");
+
+  int failed = 0;
+  char* saveptr;
+  char* name;
+  for(name = strtok_r(engines, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+    int first = 0, last = NBODY_NB_ENGINES;
+    if(strcmp(name, "all") != 0) {
+      first = nbody_parse_engine(name);
+      if(first < 0) {
+	fprintf(stderr, "Unknown engine '%s'\n", name);
+	exit(1);
+      }
+      last = first+1;
+    }
+
+    int e;
+    for(e=first; e<last; e++) {
+      struct result res;
+      params.engine = e;
+      if(validate(&params, &opt, &res)) {
+	fprintf(stderr, "Invalid parameters for engine %s\n", nbody_engine_name(e));
+	exit(1);
+      }
+      int ok = (opt.budget <= 0 || res.rms_error <= opt.budget);
+      failed |= !ok;
+      printf("  %-12s %10d %12.6f %12.6f %10.2f %12.4e %12.4e%s\n",
+	     nbody_engine_name(e), res.nparticles, res.time, res.exact_time,
+	     res.time > 0 ? res.exact_time/res.time : 0,
+	     res.rms_error, res.max_error, ok ? "" : "  over budget");
+      fflush(stdout);
+    }
+  }
+  return failed;
+}
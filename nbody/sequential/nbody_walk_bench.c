@@ -0,0 +1,272 @@
+/*
+** nbody_walk_bench.c - cost of the Barnes-Hut tree walk
+**
+** usage: nbody_walk_bench [options] nparticles [distribution [seed]]
+**
+** Build the tree of the particles and walk it once per particle with:
+**   recursive  a recursive walk (the walk of the previous versions)
+**   stack      an explicit-stack walk, without prefetch
+**   prefetch   an explicit-stack walk that prefetches the children of the
+**              nodes it opens (the walk of the engines)
+**   forces     compute_force_on_particle: the prefetching walk plus the
+**              computation of the forces
+** The first three walks only apply the opening criterion and count the nodes
+** they visit: they measure the latency of the traversal. The difference
+** between 'forces' and 'prefetch' is the cost of the arithmetic.
+** The walks run on one thread, so that the memory latency is not hidden by
+** the other threads.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include <getopt.h>
+
+#include "nbody.h"
+#include "nbody_rng.h"
+#include "nbody_tools.h"
+#include "nbody_alloc.h"
+#include "nbody_reorder.h"
+#include "nbody_generators.h"
+
+enum order {
+  ORDER_ARRAY,			/* order of the generator */
+  ORDER_MORTON,			/* sorted along the Morton curve */
+  ORDER_RANDOM,			/* shuffled: consecutive walks share nothing */
+};
+
+struct walk_count {
+  long visited;			/* nodes visited */
+  long interactions;		/* particles and approximated nodes */
+};
+
+static void usage(const char* name) {
+  fprintf(stderr, "usage: %s [options] nparticles [distribution [seed]]\n"
+	  "  --theta t     opening criterion (default: 2)\n"
+	  "  --repeat r    run each walk r times and keep the best time (default: 3)\n"
+	  "  --order o     order in which the particles are walked: array, morton\n"
+	  "                or random (default: morton)\n", name);
+  exit(1);
+}
+
+static double now() {
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec + t.tv_usec/1e6;
+}
+
+/* same opening criterion as compute_force_on_particle */
+static int approximate(const node_t* n, const particle_t* p, double theta) {
+  double size = n->x_max - n->x_min;
+  double diff_x = n->x_center - p->x_pos;
+  double diff_y = n->y_center - p->y_pos;
+  double distance = sqrt(diff_x*diff_x + diff_y*diff_y);
+  return size / distance < theta;
+}
+
+static void walk_recursive(node_t* n, particle_t* p, double theta, struct walk_count* c) {
+  if(!n || n->n_particles == 0) {
+    return;
+  }
+  c->visited++;
+  if(n->particle || approximate(n, p, theta)) {
+    c->interactions++;
+    return;
+  }
+  int i;
+  for(i=0; i<4; i++) {
+    walk_recursive(&n->children[i], p, theta, c);
+  }
+}
+
+static void walk_stack(node_t* n, particle_t* p, double theta, int prefetch,
+		       struct walk_count* c) {
+  node_t* stack[WALK_STACK_SIZE(n)];
+  int top = 0;
+  stack[top++] = n;
+  while(top > 0) {
+    n = stack[--top];
+    if(n->n_particles == 0) {
+      continue;
+    }
+    c->visited++;
+    if(n->particle || approximate(n, p, theta)) {
+      c->interactions++;
+      continue;
+    }
+    if(prefetch) {
+      prefetch_children(n);
+    }
+    int i;
+    for(i=3; i>=0; i--) {
+      stack[top++] = &n->children[i];
+    }
+  }
+}
+
+enum walk {
+  WALK_RECURSIVE,
+  WALK_STACK,
+  WALK_PREFETCH,
+  WALK_FORCES,
+  NB_WALKS
+};
+
+static const char* walk_names[NB_WALKS] = {
+  [WALK_RECURSIVE] = "recursive",
+  [WALK_STACK] = "stack",
+  [WALK_PREFETCH] = "prefetch",
+  [WALK_FORCES] = "forces",
+};
+
+/* walk the tree for every particle of order[]. Return the time it takes */
+static double run_walk(enum walk w, node_t* root, particle_t* particles, int* order, int n,
+		       double theta, struct walk_count* c) {
+  memset(c, 0, sizeof(struct walk_count));
+  double t1 = now();
+  int i;
+  for(i=0; i<n; i++) {
+    particle_t* p = &particles[order[i]];
+    switch(w) {
+    case WALK_RECURSIVE:
+      walk_recursive(root, p, theta, c);
+      break;
+    case WALK_STACK:
+      walk_stack(root, p, theta, 0, c);
+      break;
+    case WALK_PREFETCH:
+      walk_stack(root, p, theta, 1, c);
+      break;
+    default:
+      p->x_force = 0;
+      p->y_force = 0;
+      compute_force_on_particle(root, p, theta, NULL);
+      break;
+    }
+  }
+  return now() - t1;
+}
+
+int main(int argc, char**argv) {
+  static struct option long_options[] = {
+    {"theta", required_argument, NULL, 'o'},
+    {"repeat", required_argument, NULL, 'r'},
+    {"order", required_argument, NULL, 's'},
+    {NULL, 0, NULL, 0}
+  };
+  double theta = 2;
+  int repeat = 3;
+  enum order walk_order = ORDER_MORTON;
+  int c;
+  while((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+    switch(c) {
+    case 'o': theta = atof(optarg); break;
+    case 'r': repeat = atoi(optarg); break;
+    case 's':
+      if(strcmp(optarg, "array") == 0) {
+	walk_order = ORDER_ARRAY;
+      } else if(strcmp(optarg, "morton") == 0) {
+	walk_order = ORDER_MORTON;
+      } else if(strcmp(optarg, "random") == 0) {
+	walk_order = ORDER_RANDOM;
+      } else {
+	usage(argv[0]);
+      }
+      break;
+    default: usage(argv[0]);
+    }
+  }
+  argc -= optind-1;
+  argv += optind-1;
+  if(argc < 2 || repeat < 1) {
+    usage(argv[0]);
+  }
+  int n = atoi(argv[1]);
+  int dist = DIST_LINE;
+  unsigned long long seed = 0;
+  if(argc >= 3) {
+    dist = parse_distribution(argv[2]);
+    if(dist < 0) {
+      fprintf(stderr, "Unknown distribution '%s'\n", argv[2]);
+      exit(1);
+    }
+  }
+  if(argc >= 4) {
+    seed = strtoull(argv[3], NULL, 10);
+  }
+  if(n < 1) {
+    usage(argv[0]);
+  }
+
+  particle_t* particles = malloc(sizeof(particle_t)*n);
+  int* ids = malloc(sizeof(int)*n);
+  int* order = malloc(sizeof(int)*n);
+  int i;
+  generate_particles(particles, 0, n, n, dist, seed);
+  for(i=0; i<n; i++) {
+    ids[i] = i;
+  }
+  int ninside = n;
+  if(walk_order == ORDER_MORTON) {
+    /* the particles and the nodes are inserted along the curve too */
+    ninside = reorder_particles(particles, ids, n, XMIN, XMAX, YMIN, YMAX);
+  }
+
+  struct memory_t mem;
+  mem_init(&mem, NODE_BLOCK_SIZE, 4*n, 0);
+  node_t root;
+  init_node(&root, NULL, XMIN, XMAX, YMIN, YMAX);
+  int nwalks = 0;
+  for(i=0; i<ninside; i++) {
+    particle_t* p = &particles[i];
+    if(p->x_pos < XMIN || p->x_pos > XMAX || p->y_pos < YMIN || p->y_pos > YMAX) {
+      continue;
+    }
+    p->node = NULL;
+    insert_particle(p, &root, &mem);
+    order[nwalks++] = i;
+  }
+  if(walk_order == ORDER_RANDOM) {
+    for(i=nwalks-1; i>0; i--) {
+      int j = rng_u64(seed, i) % (i+1);
+      int tmp = order[i];
+      order[i] = order[j];
+      order[j] = tmp;
+    }
+  }
+
+  printf("# nparticles=%d distribution=%s seed=%llu theta=%g order=%s depth=%d\n",
+	 nwalks, distribution_name(dist), seed, theta,
+	 walk_order == ORDER_ARRAY ? "array" : walk_order == ORDER_MORTON ? "morton" : "random",
+	 root.depth);
+  printf("# %-10s %12s %14s %14s %12s %12s\n", "walk", "time (s)", "nodes/walk",
+	 "interact/walk", "ns/walk", "ns/node");
+  int w;
+  for(w=0; w<NB_WALKS; w++) {
+    struct walk_count count;
+    double best = -1;
+    int r;
+    for(r=0; r<repeat; r++) {
+      double t = run_walk(w, &root, particles, order, nwalks, theta, &count);
+      if(best < 0 || t < best) {
+	best = t;
+      }
+    }
+    if(w == WALK_FORCES) {
+      /* same nodes as the prefetching walk */
+      run_walk(WALK_PREFETCH, &root, particles, order, nwalks, theta, &count);
+    }
+    printf("  %-10s %12.6f %14.1f %14.1f %12.1f %12.2f\n", walk_names[w], best,
+	   (double) count.visited/nwalks, (double) count.interactions/nwalks,
+	   best/nwalks*1e9, count.visited ? best/count.visited*1e9 : 0);
+  }
+
+  free_node(&root, &mem);
+  mem_destroy(&mem);
+  free(particles);
+  free(ids);
+  free(order);
+  return 0;
+}